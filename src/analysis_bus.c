@@ -0,0 +1,212 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "analysis_bus.h"
+#include "log.h"
+
+static bool map_bus(analysis_bus_t *bus, HANDLE mapping, const char *name) {
+  bus->mapping = mapping;
+  bus->frame_event = NULL;
+  bus->layout = (analysis_bus_layout_t *)MapViewOfFile(
+      mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(analysis_bus_layout_t));
+  if (bus->layout == NULL) {
+    log_error("Could not map analysis bus \"%s\".", name);
+    CloseHandle(mapping);
+    bus->mapping = NULL;
+    return false;
+  }
+  return true;
+}
+
+static void make_frame_event_name(char *event_name, size_t size,
+                                  const char *name) {
+  snprintf(event_name, size, "%s-frame", name);
+}
+
+bool analysis_bus_create(analysis_bus_t *bus, const char *name) {
+  const HANDLE mapping =
+      CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+                         sizeof(analysis_bus_layout_t), name);
+  if (mapping == NULL) {
+    log_error("Could not create analysis bus \"%s\".", name);
+    return false;
+  }
+  // Another leader (or a follower still attached) owns it, leave it alone
+  if (GetLastError() == ERROR_ALREADY_EXISTS) {
+    log_error("Analysis bus \"%s\" exists already, is another leader "
+              "running?",
+              name);
+    CloseHandle(mapping);
+    return false;
+  }
+
+  if (!map_bus(bus, mapping, name)) {
+    return false;
+  }
+
+  char event_name[MAX_PATH];
+  make_frame_event_name(event_name, sizeof(event_name), name);
+  bus->frame_event = CreateEventA(NULL, FALSE, FALSE, event_name);
+  if (bus->frame_event == NULL) {
+    log_error("Could not create event \"%s\".", event_name);
+    analysis_bus_close(bus);
+    return false;
+  }
+
+  analysis_bus_layout_t *const layout = bus->layout;
+  memset(layout, 0, sizeof(*layout));
+  layout->slot_size = sizeof(analysis_bus_slot_t);
+  layout->slot_count = ANALYSIS_BUS_SLOTS;
+  layout->version = ANALYSIS_BUS_VERSION;
+  MemoryBarrier();
+  layout->magic = ANALYSIS_BUS_MAGIC; // i.e. ready
+  return true;
+}
+
+bool analysis_bus_open(analysis_bus_t *bus, const char *name) {
+  const HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+  if (mapping == NULL) {
+    return false;
+  }
+
+  if (!map_bus(bus, mapping, name)) {
+    return false;
+  }
+
+  const analysis_bus_layout_t *const layout = bus->layout;
+  if (layout->magic != ANALYSIS_BUS_MAGIC ||
+      layout->version != ANALYSIS_BUS_VERSION ||
+      layout->slot_size != sizeof(analysis_bus_slot_t)) {
+    log_error("Analysis bus \"%s\" has an unsupported layout.", name);
+    analysis_bus_close(bus);
+    return false;
+  }
+
+  char event_name[MAX_PATH];
+  make_frame_event_name(event_name, sizeof(event_name), name);
+  bus->frame_event = OpenEventA(SYNCHRONIZE, FALSE, event_name);
+  return true;
+}
+
+void analysis_bus_close(analysis_bus_t *bus) {
+  if (bus->layout != NULL) {
+    UnmapViewOfFile(bus->layout);
+    bus->layout = NULL;
+  }
+  if (bus->mapping != NULL) {
+    CloseHandle(bus->mapping);
+    bus->mapping = NULL;
+  }
+  if (bus->frame_event != NULL) {
+    CloseHandle(bus->frame_event);
+    bus->frame_event = NULL;
+  }
+}
+
+void analysis_bus_publish(analysis_bus_t *bus, const analysis_frame_t *frame) {
+  analysis_bus_layout_t *const layout = bus->layout;
+  // Unsigned, as the signed increment past LONG_MAX would be undefined
+  const ULONG next_frame_number = (ULONG)layout->latest_frame_number + 1;
+  const LONG frame_number = next_frame_number > (ULONG)LONG_MAX
+                                ? 1 // i.e. wrap around, never publishing 0
+                                : (LONG)next_frame_number;
+
+  analysis_bus_slot_t *const slot =
+      &layout->slots[frame_number % ANALYSIS_BUS_SLOTS];
+  InterlockedExchange(&slot->sequence, 0);
+  memcpy(&slot->frame, frame, sizeof(*frame));
+  InterlockedExchange(&slot->sequence, frame_number);
+  InterlockedExchange(&layout->latest_frame_number, frame_number);
+  SetEvent(bus->frame_event);
+}
+
+LONG analysis_bus_read_latest(const analysis_bus_t *bus,
+                              analysis_frame_t *frame) {
+  const analysis_bus_layout_t *const layout = bus->layout;
+  for (;;) {
+    const LONG frame_number = layout->latest_frame_number;
+    if (frame_number == 0) {
+      return 0;
+    }
+
+    const analysis_bus_slot_t *const slot =
+        &layout->slots[frame_number % ANALYSIS_BUS_SLOTS];
+    MemoryBarrier();
+    if (slot->sequence != frame_number) {
+      continue; // i.e. overtaken by the writer
+    }
+    memcpy(frame, &slot->frame, sizeof(*frame));
+    MemoryBarrier();
+    if (slot->sequence == frame_number) {
+      return frame_number;
+    }
+  }
+}
+
+void analysis_bus_publish_clock(analysis_bus_t *bus, LONGLONG clock_at_us,
+                                int clock_position_ms) {
+  analysis_bus_layout_t *const layout = bus->layout;
+  InterlockedIncrement(&layout->clock_sequence); // i.e. odd, writing
+  layout->clock_at_us = clock_at_us;
+  layout->clock_position_ms = clock_position_ms;
+  InterlockedIncrement(&layout->clock_sequence); // i.e. even, done
+}
+
+LONG analysis_bus_read_due(const analysis_bus_t *bus, LONGLONG now_us,
+                           analysis_frame_t *frame, LONGLONG *next_due_us) {
+  const analysis_bus_layout_t *const layout = bus->layout;
+  const LONG latest_frame_number = layout->latest_frame_number;
+  *next_due_us = 0;
+
+  // From the latest frame back in time, but not as far back as the slot
+  // that the writer will fill next
+  for (LONG age = 0; age < ANALYSIS_BUS_SLOTS - 1; age++) {
+    const LONG frame_number = latest_frame_number - age;
+    if (frame_number <= 0) {
+      break;
+    }
+
+    const analysis_bus_slot_t *const slot =
+        &layout->slots[frame_number % ANALYSIS_BUS_SLOTS];
+    MemoryBarrier();
+    if (slot->sequence != frame_number) {
+      break; // i.e. overtaken by the writer
+    }
+    const LONGLONG present_at_us = slot->frame.present_at_us;
+    MemoryBarrier();
+    if (slot->sequence != frame_number) {
+      break;
+    }
+
+    if (present_at_us > now_us) {
+      *next_due_us = present_at_us; // i.e. the earliest one, eventually
+      continue;
+    }
+
+    memcpy(frame, &slot->frame, sizeof(*frame));
+    MemoryBarrier();
+    if (slot->sequence == frame_number) {
+      return frame_number;
+    }
+    break;
+  }
+  return 0;
+}
@@ -0,0 +1,93 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef ANALYSIS_BUS_H
+#define ANALYSIS_BUS_H
+
+#include <stdbool.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "analysis_frame.h"
+
+#define ANALYSIS_BUS_MAGIC 0x53425641 // "AVBS"
+#define ANALYSIS_BUS_VERSION 2
+#define ANALYSIS_BUS_SLOTS 256 // i.e. a few seconds, see present_at_us
+
+// Shared memory layout of the analysis bus.
+//
+// The writer fills slot (frame_number % ANALYSIS_BUS_SLOTS) after
+// invalidating its sequence, then publishes the slot's sequence
+// and finally latest_frame_number.  Readers copy the slot of
+// latest_frame_number and check that its sequence did not change
+// while copying; with several slots they never wait for the writer.
+//
+// With a playback clock (see set_playback_clock), frames are published
+// ahead of time and stamped with when their audio will be heard.  The
+// clock is QueryPerformanceCounter based and hence shared by all processes
+// on the machine, so readers showing frames at present_at_us (see
+// analysis_bus_read_due) show them in sync.  The clock itself is published
+// as well: stream position clock_position_ms was audible at clock_at_us,
+// protected by clock_sequence, which is odd while being written.
+typedef struct _analysis_bus_slot_t {
+  volatile LONG sequence; // frame number held, 0 while being written
+  analysis_frame_t frame;
+} analysis_bus_slot_t;
+
+typedef struct _analysis_bus_layout_t {
+  DWORD magic;
+  DWORD version;
+  DWORD slot_size;
+  DWORD slot_count;
+  volatile LONG latest_frame_number; // 0 for none, yet
+  volatile LONG clock_sequence;
+  LONGLONG clock_at_us;
+  int clock_position_ms;
+  analysis_bus_slot_t slots[ANALYSIS_BUS_SLOTS];
+} analysis_bus_layout_t;
+
+// Next to the shared memory, the writer signals an auto-reset event named
+// like the bus plus suffix "-frame" after every frame published; it suits a
+// single waiting reader, others should poll latest_frame_number.
+typedef struct _analysis_bus_t {
+  HANDLE mapping;
+  analysis_bus_layout_t *layout;
+  HANDLE frame_event; // NULL if missing (for readers)
+} analysis_bus_t;
+
+bool analysis_bus_create(analysis_bus_t *bus, const char *name);
+
+bool analysis_bus_open(analysis_bus_t *bus, const char *name);
+
+void analysis_bus_close(analysis_bus_t *bus);
+
+void analysis_bus_publish(analysis_bus_t *bus, const analysis_frame_t *frame);
+
+void analysis_bus_publish_clock(analysis_bus_t *bus, LONGLONG clock_at_us,
+                                int clock_position_ms);
+
+// Returns the frame number copied, or 0 if nothing was published, yet
+LONG analysis_bus_read_latest(const analysis_bus_t *bus,
+                              analysis_frame_t *frame);
+
+// Copies the most recent frame due at now_us, returns its frame number or 0
+// for none; *next_due_us is set to when the next frame is due (0 if unknown)
+LONG analysis_bus_read_due(const analysis_bus_t *bus, LONGLONG now_us,
+                           analysis_frame_t *frame, LONGLONG *next_due_us);
+
+#endif // ifndef ANALYSIS_BUS_H
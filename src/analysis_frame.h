@@ -0,0 +1,50 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef ANALYSIS_FRAME_H
+#define ANALYSIS_FRAME_H
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#define ANALYSIS_FRAME_SAMPLES 576 // dictated by vis.h
+#define ANALYSIS_FRAME_CHANNELS 2
+
+// One frame of audio analysis, as computed from PCM data once
+// and then handed to vis plug-ins and external consumers.
+// NOTE: This is part of the analysis bus shared memory layout,
+//       so any change needs a bump of ANALYSIS_BUS_VERSION.
+typedef struct _analysis_frame_t {
+  LONGLONG analyzed_at_us;  // QueryPerformanceCounter based, in microseconds
+  LONGLONG present_at_us;   // when to show it (same clock), 0 for right away
+  int stream_timestamp_ms;  // as passed by the input plug-in
+  int sample_rate;
+  int channels;
+
+  // Full precision: spectrum is linear amplitude with 1.0 for a full-scale
+  // sine, waveform is in range -1.0 to +1.0, VU is RMS and peak per channel.
+  float spectrum[ANALYSIS_FRAME_CHANNELS][ANALYSIS_FRAME_SAMPLES];
+  float waveform[ANALYSIS_FRAME_CHANNELS][ANALYSIS_FRAME_SAMPLES];
+  float vu_rms[ANALYSIS_FRAME_CHANNELS];
+  float vu_peak[ANALYSIS_FRAME_CHANNELS];
+
+  // 8 bit, exactly as handed to winampVisModule
+  unsigned char spectrum_data[ANALYSIS_FRAME_CHANNELS][ANALYSIS_FRAME_SAMPLES];
+  unsigned char waveform_data[ANALYSIS_FRAME_CHANNELS][ANALYSIS_FRAME_SAMPLES];
+} analysis_frame_t;
+
+#endif // ifndef ANALYSIS_FRAME_H
@@ -15,13 +15,217 @@
 // You should have received a copy of the GNU General Public License along
 // with visdriver. If not, see <https://www.gnu.org/licenses/>.
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_dsp.h"
+#include "equalizer.h"
 #include "log.h"
+#include "loudness.h"
+#include "module_registry.h"
+#include "timing.h"
+
+// As in dsp.h of the Winamp SDK
+typedef struct winampDSPModule {
+  char *description;
+  HWND hwndParent;
+  HINSTANCE hDllInstance;
+  void (*Config)(struct winampDSPModule *this_mod);
+  int (*Init)(struct winampDSPModule *this_mod); // 0 on success
+  // Returns the number of samples (frames) after processing in place, up to
+  // twice numsamples
+  int (*ModifySamples)(struct winampDSPModule *this_mod, short int *samples,
+                       int numsamples, int bps, int nch, int srate);
+  void (*Quit)(struct winampDSPModule *this_mod);
+  void *userData;
+} winampDSPModule;
+
+typedef struct {
+  int version;
+  char *description;
+  winampDSPModule *(*getModule)(int);
+  int (*sf)(int key); // i.e. for version 0x21 and later
+} winampDSPHeader;
+
+typedef winampDSPHeader *(*winampDSPGetHeaderType)(HWND);
+
+typedef struct _dsp_plugin_t {
+  HMODULE dll_handle;
+  winampDSPModule *module;
+  LONGLONG calls;
+  LONGLONG total_us;
+  LONGLONG max_us;
+} dsp_plugin_t;
+
+static dsp_plugin_t g_dsp_plugins[AUDIO_DSP_PLUGINS_MAX];
+static int g_dsp_plugin_count = 0;
+
+// For DSPs following one that stretched the audio already, whose own
+// stretching might not fit the buffer of the input plug-in anymore
+static char *g_scratch = NULL;
+static size_t g_scratch_size = 0;
+static bool g_truncation_logged = false;
+
+static bool load_dsp_plugin(dsp_plugin_t *plugin, const char *spec,
+                            HWND main_window) {
+  char filename[MAX_PATH];
+  int index = 0;
+  const char *const question_mark = strrchr(spec, '?');
+  const size_t filename_len = (question_mark != NULL)
+                                  ? (size_t)(question_mark - spec)
+                                  : strlen(spec);
+  if (filename_len >= sizeof(filename)) {
+    log_error("DSP plugin path \"%s\" is too long.", spec);
+    return false;
+  }
+  memcpy(filename, spec, filename_len);
+  filename[filename_len] = '\0';
+  if (question_mark != NULL) {
+    index = atoi(question_mark + 1);
+  }
+
+  const HMODULE dll_handle = LoadLibraryA(filename);
+  if (dll_handle == NULL) {
+    log_error("LoadLibraryA failed for file \"%s\".", filename);
+    return false;
+  }
+
+  const char *const function_name = "winampDSPGetHeader2";
+  winampDSPGetHeaderType winampDSPGetHeader2 =
+      (winampDSPGetHeaderType)GetProcAddress(dll_handle, function_name);
+  if (winampDSPGetHeader2 == NULL) {
+    log_error("GetProcAddress failed for function \"%s\".", function_name);
+    FreeLibrary(dll_handle);
+    return false;
+  }
+
+  winampDSPHeader *const header = winampDSPGetHeader2(main_window);
+  winampDSPModule *const module =
+      (header != NULL) ? header->getModule(index) : NULL;
+  if (module == NULL) {
+    log_error("DSP plugin \"%s\" has no module %d.", filename, index);
+    FreeLibrary(dll_handle);
+    return false;
+  }
+  module->hwndParent = main_window;
+  module->hDllInstance = dll_handle;
+
+  module_registry_add(filename, dll_handle);
+
+  if (module->Init(module) != 0) {
+    log_error("DSP module \"%s\" failed to initialize.", module->description);
+    module_registry_remove(dll_handle);
+    FreeLibrary(dll_handle);
+    return false;
+  }
+  log_info("DSP plugin is \"%s\" (module %d, \"%s\").", header->description,
+           index, module->description);
+
+  memset(plugin, 0, sizeof(*plugin));
+  plugin->dll_handle = dll_handle;
+  plugin->module = module;
+  return true;
+}
+
+bool load_dsp_plugins(const char *const *filenames, int count,
+                      HWND main_window) {
+  for (int i = 0; i < count && i < AUDIO_DSP_PLUGINS_MAX; i++) {
+    log_info("Loading DSP plugin \"%s\"...", filenames[i]);
+    if (!load_dsp_plugin(&g_dsp_plugins[g_dsp_plugin_count], filenames[i],
+                         main_window)) {
+      unload_dsp_plugins();
+      return false;
+    }
+    g_dsp_plugin_count++;
+  }
+  return true;
+}
+
+void unload_dsp_plugins() {
+  for (int i = 0; i < g_dsp_plugin_count; i++) {
+    dsp_plugin_t *const plugin = &g_dsp_plugins[i];
+    if (plugin->calls > 0) {
+      log_info("DSP \"%s\": %lld calls, %.1fus average, %lldus max.",
+               plugin->module->description, (long long)plugin->calls,
+               (double)plugin->total_us / plugin->calls,
+               (long long)plugin->max_us);
+    }
+    plugin->module->Quit(plugin->module);
+    module_registry_remove(plugin->dll_handle);
+    FreeLibrary(plugin->dll_handle);
+  }
+  g_dsp_plugin_count = 0;
+
+  free(g_scratch);
+  g_scratch = NULL;
+  g_scratch_size = 0;
+}
 
 int __cdecl dsp_isactive() {
-  return 1; // i.e. active
+  // i.e. have input plug-ins reserve room and call dsp_dosamples
+  return g_dsp_plugin_count > 0 || equalizer_active() ||
+         loudness_gain_active();
 }
 
+static int modify_samples(dsp_plugin_t *plugin, short int *samples,
+                          int numsamples, int bps, int nch, int srate) {
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = plugin->module->ModifySamples(
+      plugin->module, samples, numsamples, bps, nch, srate);
+  const LONGLONG duration_us = timing_now_us() - started_at_us;
+
+  plugin->calls++;
+  plugin->total_us += duration_us;
+  if (duration_us > plugin->max_us) {
+    plugin->max_us = duration_us;
+  }
+  return (result < 0) ? 0 : result;
+}
+
+// The input plug-in has room for twice numsamples, as would a single DSP.
+// Once a DSP has stretched the audio, the next one works on g_scratch, with
+// room for twice of what it gets, and the chain's result is cut to fit.
 int __cdecl dsp_dosamples(short int *samples, int numsamples, int bps, int nch,
                           int srate) {
-  return numsamples; // i.e. unchanged number of samples
+  const size_t frame_size = (size_t)(bps / 8) * nch;
+  const int capacity = 2 * numsamples;
+  short int *current = samples;
+  int count = numsamples;
+
+  loudness_apply_gain(samples, numsamples, bps, nch); // i.e. first
+  equalizer_process(samples, numsamples, bps, nch, srate);
+
+  for (int i = 0; i < g_dsp_plugin_count; i++) {
+    if (count > numsamples) {
+      const size_t needed = 2 * (size_t)count * frame_size;
+      if (needed > g_scratch_size) {
+        char *const scratch = realloc(g_scratch, needed); // keeps content
+        if (scratch == NULL) {
+          break; // i.e. skip the rest of the chain
+        }
+        g_scratch = scratch;
+        g_scratch_size = needed;
+      }
+      if (current == samples) {
+        memcpy(g_scratch, samples, count * frame_size);
+      }
+      current = (short int *)g_scratch;
+    }
+    count = modify_samples(&g_dsp_plugins[i], current, count, bps, nch, srate);
+  }
+
+  if (count > capacity) {
+    if (!g_truncation_logged) {
+      log_error("DSP chain stretched %d samples to %d, more than the input "
+                "plugin has room for, dropping the excess.",
+                numsamples, count);
+      g_truncation_logged = true;
+    }
+    count = capacity;
+  }
+  if (current != samples) {
+    memcpy(samples, current, count * frame_size);
+  }
+  return count;
 }
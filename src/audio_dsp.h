@@ -18,6 +18,21 @@
 #ifndef AUDIO_DSP_H
 #define AUDIO_DSP_H
 
+#include <stdbool.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#define AUDIO_DSP_PLUGINS_MAX 8
+
+// Loads DSP plug-ins given as "PATH/DSP.dll" (or "PATH/DSP.dll?N" for
+// other than their first module) to form a chain in that order
+bool load_dsp_plugins(const char *const *filenames, int count,
+                      HWND main_window);
+
+// Also logs how long each DSP took
+void unload_dsp_plugins();
+
 int __cdecl dsp_isactive();
 
 int __cdecl dsp_dosamples(short int *samples, int numsamples, int bps, int nch,
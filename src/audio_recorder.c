@@ -0,0 +1,202 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_recorder.h"
+#include "log.h"
+#include "pcm.h"
+#include "stream_io.h"
+#include "wav_writer.h"
+
+static Out_Module g_real_output_module;
+static const char *g_path = NULL;
+
+// A WAV file has a single format, that of the first track
+static int g_sample_rate = 0; // i.e. not recording (yet)
+static int g_channels = 0;
+static int g_bits_per_sample = 0;
+static bool g_failed = false;
+
+// A single-producer single-consumer ring: Write fills at g_filled_count,
+// the writer thread drains at g_drained_count.  Counts wrap around.
+static char *g_ring = NULL;
+static volatile LONG g_filled_count = 0;
+static volatile LONG g_drained_count = 0;
+static LONGLONG g_dropped_bytes = 0;
+
+static HANDLE g_writer_thread = NULL;
+static HANDLE g_filled_event = NULL;
+static volatile LONG g_stop_requested = 0;
+static volatile LONG g_output_open = 0;
+static volatile LONG g_write_failed = 0;
+
+static ULONG filled_bytes() {
+  return (ULONG)g_filled_count - (ULONG)g_drained_count;
+}
+
+static DWORD WINAPI writer_thread_main(LPVOID parameter) {
+  wav_writer_t writer = {NULL, 0, false};
+  if (!wav_writer_open(&writer, g_path, g_sample_rate, g_channels,
+                       g_bits_per_sample)) {
+    InterlockedExchange(&g_write_failed, 1);
+    return 1;
+  }
+  InterlockedExchange(&g_output_open, 1);
+  log_info("Recording audio to \"%s\"...", g_path);
+
+  bool failed = false;
+  while (!failed) {
+    WaitForSingleObject(g_filled_event, INFINITE);
+
+    // Audio pending at stop still gets written
+    ULONG available;
+    while (!failed && (available = filled_bytes()) > 0) {
+      const ULONG offset =
+          (ULONG)g_drained_count & (AUDIO_RECORDER_RING_BYTES - 1);
+      ULONG size = AUDIO_RECORDER_RING_BYTES - offset; // i.e. contiguous
+      if (size > available) {
+        size = available;
+      }
+      if (size > AUDIO_RECORDER_CHUNK_BYTES) {
+        size = AUDIO_RECORDER_CHUNK_BYTES;
+      }
+      failed = !wav_writer_write(&writer, g_ring + offset, size);
+      InterlockedExchangeAdd(&g_drained_count, (LONG)size);
+    }
+
+    if (g_stop_requested) {
+      break;
+    }
+  }
+
+  if (failed) {
+    if (!g_stop_requested) {
+      log_error("Could not write to \"%s\" (error %lu), stopped recording.",
+                g_path, (unsigned long)GetLastError());
+    }
+    InterlockedExchange(&g_write_failed, 1);
+  }
+  wav_writer_close(&writer);
+  return 0;
+}
+
+static bool start_recording(int samplerate, int numchannels,
+                            int bitspersamp) {
+  if (samplerate <= 0 || numchannels <= 0 ||
+      !pcm_bits_supported(bitspersamp)) {
+    log_error("Cannot record %d Hz, %d channels at %d bits.", samplerate,
+              numchannels, bitspersamp);
+    return false;
+  }
+
+  g_ring = malloc(AUDIO_RECORDER_RING_BYTES);
+  g_filled_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+  if (g_ring == NULL || g_filled_event == NULL) {
+    log_error("Could not allocate buffer for recording.");
+    return false;
+  }
+  g_sample_rate = samplerate;
+  g_channels = numchannels;
+  g_bits_per_sample = bitspersamp;
+
+  g_writer_thread = CreateThread(NULL, 0, writer_thread_main, NULL, 0, NULL);
+  if (g_writer_thread == NULL) {
+    log_error("Could not start recording thread.");
+    return false;
+  }
+  return true;
+}
+
+static void stop_recording() {
+  if (g_writer_thread != NULL) {
+    InterlockedExchange(&g_stop_requested, 1);
+    SetEvent(g_filled_event);
+    stream_io_join_thread(g_writer_thread, &g_output_open);
+    g_writer_thread = NULL;
+  }
+  if (g_dropped_bytes > 0) {
+    log_error("Recording could not keep up, dropped %lld bytes of audio.",
+              (long long)g_dropped_bytes);
+  }
+
+  if (g_filled_event != NULL) {
+    CloseHandle(g_filled_event);
+    g_filled_event = NULL;
+  }
+  free(g_ring);
+  g_ring = NULL;
+}
+
+static void __cdecl recording_quit() {
+  g_real_output_module.Quit();
+  stop_recording();
+}
+
+static int __cdecl recording_open(int samplerate, int numchannels,
+                                  int bitspersamp, int bufferlenms,
+                                  int prebufferms) {
+  const int latency_ms = g_real_output_module.Open(
+      samplerate, numchannels, bitspersamp, bufferlenms, prebufferms);
+  if (latency_ms < 0 || g_failed) {
+    return latency_ms;
+  }
+
+  if (g_sample_rate == 0) {
+    g_failed = !start_recording(samplerate, numchannels, bitspersamp);
+  } else if (samplerate != g_sample_rate || numchannels != g_channels ||
+             bitspersamp != g_bits_per_sample) {
+    log_error("Track format differs from that of \"%s\", stopped recording.",
+              g_path);
+    g_failed = true;
+  }
+  return latency_ms;
+}
+
+static int __cdecl recording_write(char *buf, int len) {
+  const int result = g_real_output_module.Write(buf, len);
+  if (result != 0 || g_failed || g_ring == NULL || g_write_failed) {
+    return result;
+  }
+
+  if ((ULONG)len > AUDIO_RECORDER_RING_BYTES - filled_bytes()) {
+    g_dropped_bytes += len; // i.e. never have the decoder wait
+    return result;
+  }
+  const ULONG offset =
+      (ULONG)g_filled_count & (AUDIO_RECORDER_RING_BYTES - 1);
+  const ULONG first = ((ULONG)len < AUDIO_RECORDER_RING_BYTES - offset)
+                          ? (ULONG)len
+                          : AUDIO_RECORDER_RING_BYTES - offset;
+  memcpy(g_ring + offset, buf, first);
+  memcpy(g_ring, buf + first, len - first); // i.e. after wrapping around
+  MemoryBarrier(); // i.e. done copying before handing the bytes over
+  InterlockedExchangeAdd(&g_filled_count, len);
+  SetEvent(g_filled_event);
+  return result;
+}
+
+void record_output_module(Out_Module *out_module, const char *path) {
+  g_real_output_module = *out_module;
+  g_path = path;
+
+  out_module->Quit = recording_quit;
+  out_module->Open = recording_open;
+  out_module->Write = recording_write;
+}
@@ -0,0 +1,37 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef AUDIO_RECORDER_H
+#define AUDIO_RECORDER_H
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <winamp/out.h>
+
+#define AUDIO_RECORDER_RING_BYTES (4 * 1024 * 1024) // a power of two
+#define AUDIO_RECORDER_CHUNK_BYTES (256 * 1024)
+
+// Tees what the input plug-in writes to the output plug-in into a WAV file,
+// FIFO or named pipe (see wav_writer_open), for all tracks played until
+// Quit.  Write only copies into a ring; a thread of its own does the file
+// I/O, so that disk or reader never hold up the decoder: should the ring
+// fill up, audio is dropped from the recording rather than waited for.
+// Like proxy_output_module, this replaces the module's functions in place.
+void record_output_module(Out_Module *out_module, const char *path);
+
+#endif // ifndef AUDIO_RECORDER_H
@@ -0,0 +1,148 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "builtin_input.h"
+#include "log.h"
+#include "pcm.h"
+
+static In_Module *g_in_module = NULL;
+static volatile LONG g_paused = 0;
+
+static int g_sample_rate = 0;
+static int g_channels = 0;
+static int g_bits_per_sample = 0;
+static int g_block_align = 0;
+
+// Room for twice the samples, as DSP may stretch them
+static char g_dsp_samples[2 * BUILTIN_INPUT_CHUNK_FRAMES *
+                          BUILTIN_INPUT_CHANNELS_MAX * 4];
+// 16 bit stereo for vis, unless that is what we have
+static int16_t g_vis_samples[BUILTIN_INPUT_CHUNK_FRAMES * 2];
+
+static void __cdecl builtin_config(HWND hwndParent) {}
+
+static void __cdecl builtin_about(HWND hwndParent) {}
+
+static int __cdecl builtin_init() { return 0; }
+
+static void __cdecl builtin_quit() {}
+
+static int __cdecl builtin_info_box(const char *file, HWND hwndParent) {
+  return INFOBOX_UNCHANGED;
+}
+
+static void __cdecl builtin_pause() {
+  g_paused = 1;
+  g_in_module->outMod->Pause(1);
+}
+
+static void __cdecl builtin_unpause() {
+  g_paused = 0;
+  g_in_module->outMod->Pause(0);
+}
+
+static int __cdecl builtin_is_paused() { return g_paused; }
+
+static int __cdecl builtin_get_output_time() {
+  return g_in_module->outMod->GetOutputTime();
+}
+
+static void __cdecl builtin_set_volume(int volume) {
+  g_in_module->outMod->SetVolume(volume);
+}
+
+static void __cdecl builtin_set_pan(int pan) {
+  g_in_module->outMod->SetPan(pan);
+}
+
+void builtin_input_init(In_Module *in_module) {
+  g_in_module = in_module;
+
+  memset(in_module, 0, sizeof(*in_module));
+  in_module->version = IN_VER_RET;
+  in_module->UsesOutputPlug = IN_MODULE_FLAG_USES_OUTPUT_PLUGIN;
+  in_module->Config = builtin_config;
+  in_module->About = builtin_about;
+  in_module->Init = builtin_init;
+  in_module->Quit = builtin_quit;
+  in_module->InfoBox = builtin_info_box;
+  in_module->Pause = builtin_pause;
+  in_module->UnPause = builtin_unpause;
+  in_module->IsPaused = builtin_is_paused;
+  in_module->GetOutputTime = builtin_get_output_time;
+  in_module->SetVolume = builtin_set_volume;
+  in_module->SetPan = builtin_set_pan;
+}
+
+bool builtin_input_open(int sample_rate, int channels, int bits_per_sample) {
+  Out_Module *const out = g_in_module->outMod;
+  const int latency_ms =
+      out->Open(sample_rate, channels, bits_per_sample, -1, -1);
+  if (latency_ms < 0) {
+    log_error("Output plugin could not be opened.");
+    return false;
+  }
+  out->SetVolume(-666); // i.e. the current volume
+  g_in_module->SAVSAInit(latency_ms, sample_rate);
+  g_in_module->VSASetInfo(sample_rate, channels);
+  g_in_module->SetInfo(sample_rate * channels * bits_per_sample / 1000,
+                       sample_rate / 1000, channels, 1);
+
+  g_sample_rate = sample_rate;
+  g_channels = channels;
+  g_bits_per_sample = bits_per_sample;
+  g_block_align = channels * bits_per_sample / 8;
+  g_paused = 0;
+  return true;
+}
+
+void builtin_input_close() {
+  g_in_module->outMod->Close();
+  g_in_module->SAVSADeInit();
+}
+
+bool builtin_input_can_write(int frames) {
+  const int bytes = frames * g_block_align;
+  const bool dsp_active = g_in_module->dsp_isactive();
+  return g_in_module->outMod->CanWrite() >= (dsp_active ? 2 * bytes : bytes);
+}
+
+void builtin_input_write(const char *chunk, int frames) {
+  Out_Module *const out = g_in_module->outMod;
+
+  if (frames == BUILTIN_INPUT_CHUNK_FRAMES) { // i.e. vis needs a full 576
+    void *const samples = (void *)pcm_to_16_bit_stereo(
+        chunk, g_bits_per_sample, g_channels, frames, g_vis_samples);
+    const int timestamp = out->GetWrittenTime();
+    g_in_module->SAAddPCMData(samples, 2, 16, timestamp);
+    g_in_module->VSAAddPCMData(samples, 2, 16, timestamp);
+  }
+
+  const int bytes = frames * g_block_align;
+  if (g_in_module->dsp_isactive()) {
+    memcpy(g_dsp_samples, chunk, bytes);
+    const int dsp_frames = g_in_module->dsp_dosamples(
+        (short int *)g_dsp_samples, frames, g_bits_per_sample, g_channels,
+        g_sample_rate);
+    out->Write(g_dsp_samples, dsp_frames * g_block_align);
+  } else {
+    out->Write((char *)chunk, bytes);
+  }
+}
@@ -0,0 +1,53 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef BUILTIN_INPUT_H
+#define BUILTIN_INPUT_H
+
+#include <stdbool.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <winamp/in2.h>
+
+// Frames per Write, as many as a vis frame takes
+#define BUILTIN_INPUT_CHUNK_FRAMES 576
+#define BUILTIN_INPUT_CHANNELS_MAX 8
+
+// What the built-in input plug-ins (see wav_input.h, pcm_input.h and
+// gen_input.h) have in common, for the one of them in use: callbacks that
+// only pass on to the output plug-in, and the way from a chunk of samples
+// through vis and DSP to the output plug-in.  Fills in all but
+// description, FileExtensions, is_seekable, GetFileInfo, IsOurFile, Play,
+// Stop, GetLength and SetOutputTime.
+void builtin_input_init(In_Module *in_module);
+
+// Opens the output plug-in and vis for Play, returns false on failure
+bool builtin_input_open(int sample_rate, int channels, int bits_per_sample);
+
+// Closes both for Stop, after the decoding thread has ended
+void builtin_input_close();
+
+// Whether the output plug-in has room for a chunk of this many frames
+bool builtin_input_can_write(int frames);
+
+// Hands a chunk of at most BUILTIN_INPUT_CHUNK_FRAMES frames to vis and
+// (through DSP, if active) the output plug-in
+void builtin_input_write(const char *chunk, int frames);
+
+#endif // ifndef BUILTIN_INPUT_H
@@ -18,6 +18,7 @@
 #include <argparse/argparse.h>
 
 #include "config.h"
+#include "equalizer.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -52,6 +53,105 @@ static void report_error(struct argparse_option *opt, const char *reason) {
 
 static void blank_line(FILE *file) { fprintf(file, "\n"); }
 
+static int append_vis_plugin(struct argparse *self,
+                             const struct argparse_option *option) {
+  visdriver_config_t *const config = (visdriver_config_t *)option->data;
+  if (config->vis_plugin_count >= CONFIG_VIS_PLUGINS_MAX) {
+    report_error((struct argparse_option *)option, "is given too many times");
+    exit(1);
+  }
+  config->vis_plugin_filenames[config->vis_plugin_count++] =
+      config->vis_plugin_filename;
+  return 0;
+}
+
+static int append_dsp_plugin(struct argparse *self,
+                             const struct argparse_option *option) {
+  visdriver_config_t *const config = (visdriver_config_t *)option->data;
+  if (config->dsp_plugin_count >= CONFIG_DSP_PLUGINS_MAX) {
+    report_error((struct argparse_option *)option, "is given too many times");
+    exit(1);
+  }
+  config->dsp_plugin_filenames[config->dsp_plugin_count++] =
+      config->dsp_plugin_filename;
+  return 0;
+}
+
+static bool is_eq_gain(float gain_db) {
+  return gain_db >= -EQUALIZER_MAX_DB && gain_db <= EQUALIZER_MAX_DB;
+}
+
+static int parse_eq(struct argparse *self,
+                    const struct argparse_option *option) {
+  visdriver_config_t *const config = (visdriver_config_t *)option->data;
+  float *const gains = config->eq_gains_db;
+  char trailing;
+  bool valid = sscanf(config->eq, "%f,%f,%f,%f,%f,%f,%f,%f,%f,%f%c",
+                      &gains[0], &gains[1], &gains[2], &gains[3], &gains[4],
+                      &gains[5], &gains[6], &gains[7], &gains[8], &gains[9],
+                      &trailing) == 10;
+  for (int i = 0; valid && i < EQUALIZER_BANDS; i++) {
+    valid = is_eq_gain(gains[i]);
+  }
+  if (!valid) {
+    report_error((struct argparse_option *)option,
+                 "needs ten gains from -12 to 12 dB like "
+                 "\"3,2,0,0,0,0,0,1,2,3\"");
+    exit(1);
+  }
+  return 0;
+}
+
+static int check_eq_preamp(struct argparse *self,
+                           const struct argparse_option *option) {
+  visdriver_config_t *const config = (visdriver_config_t *)option->data;
+  if (!is_eq_gain(config->eq_preamp_db)) {
+    report_error((struct argparse_option *)option,
+                 "needs a gain from -12 to 12 dB");
+    exit(1);
+  }
+  return 0;
+}
+
+static int check_scan_jobs(struct argparse *self,
+                           const struct argparse_option *option) {
+  visdriver_config_t *const config = (visdriver_config_t *)option->data;
+  if (config->scan_jobs < 1 || config->scan_jobs > CONFIG_SCAN_JOBS_MAX) {
+    report_error((struct argparse_option *)option,
+                 "needs a number of processes from 1 to 16");
+    exit(1);
+  }
+  return 0;
+}
+
+static int parse_vis_internal_size(struct argparse *self,
+                                   const struct argparse_option *option) {
+  visdriver_config_t *const config = (visdriver_config_t *)option->data;
+  char trailing;
+  if (sscanf(config->vis_internal_size, "%dx%d%c", &config->vis_internal_width,
+             &config->vis_internal_height, &trailing) != 2 ||
+      config->vis_internal_width <= 0 || config->vis_internal_height <= 0) {
+    report_error((struct argparse_option *)option,
+                 "needs a size like \"320x240\"");
+    exit(1);
+  }
+  return 0;
+}
+
+static void exit_with_argument_error(struct argparse_option *option,
+                                     const char *reason,
+                                     struct argparse *argparse) {
+  report_error(option, reason);
+  blank_line(stderr);
+
+  argparse_usage(argparse);
+
+  blank_line(stderr);
+  report_error(option, reason);
+
+  exit(1);
+}
+
 static void require_argument_that_is_wired_to(const char *const *target,
                                               struct argparse *argparse,
                                               struct argparse_option *options) {
@@ -66,15 +166,40 @@ static void require_argument_that_is_wired_to(const char *const *target,
   struct argparse_option *option = find_argument_writing_to(target, options);
   assert(option != NULL);
 
-  report_error(option, reason);
-  blank_line(stderr);
+  exit_with_argument_error(option, reason, argparse);
+}
 
-  argparse_usage(argparse);
+static void reject_argument_that_is_wired_to(const int *target,
+                                             const char *reason,
+                                             struct argparse *argparse,
+                                             struct argparse_option *options) {
+  assert(target != NULL);
 
-  blank_line(stderr);
-  report_error(option, reason);
+  if (*target == 0) {
+    return;
+  }
 
-  exit(1);
+  struct argparse_option *option = find_argument_writing_to(target, options);
+  assert(option != NULL);
+
+  exit_with_argument_error(option, reason, argparse);
+}
+
+static void
+reject_string_argument_that_is_wired_to(const char *const *target,
+                                        const char *reason,
+                                        struct argparse *argparse,
+                                        struct argparse_option *options) {
+  assert(target != NULL);
+
+  if (*target == NULL) {
+    return;
+  }
+
+  struct argparse_option *option = find_argument_writing_to(target, options);
+  assert(option != NULL);
+
+  exit_with_argument_error(option, reason, argparse);
 }
 
 void parse_command_line(visdriver_config_t *config, int argc,
@@ -94,11 +219,134 @@ void parse_command_line(visdriver_config_t *config, int argc,
 
       OPT_GROUP("Plug-in related arguments:"),
       OPT_STRING('I', "in", &config->input_plugin_filename,
-                 "input plug-in to use", NULL, 0, 0),
+                 "input plug-in to use, or \"builtin:wav\" for WAV and AIFF "
+                 "files, \"builtin:pcm?RATE,CHANNELS,BITS\" for raw PCM "
+                 "from files, pipes or \"-\" for stdin, \"builtin:gen\" "
+                 "for test signals like \"gen://sweep?dur=60\"",
+                 NULL, 0, 0),
       OPT_STRING('O', "out", &config->output_plugin_filename,
-                 "output plug-in to use", NULL, 0, 0),
-      OPT_STRING('W', "vis", &config->vis_plugin_filename, "vis plug-in to use",
+                 "output plug-in to use, or \"builtin:null\" for none "
+                 "(\"builtin:null?buffer=MS\" for a device buffer of MS "
+                 "milliseconds, \"builtin:null?free\" for decoding as fast "
+                 "as possible)",
+                 NULL, 0, 0),
+      OPT_INTEGER(0, "out-buffer", &config->out_buffer_ms,
+                  "buffer N milliseconds of audio ahead of the output "
+                  "plug-in, fed from a thread of its own (against dropouts "
+                  "when decoding is slow at times)",
+                  NULL, 0, 0),
+      OPT_BOOLEAN(0, "tap-output", &config->tap_output,
+                  "analyze the audio written to the output plug-in rather "
+                  "than what the input plug-in hands to vis plug-ins (for "
+                  "input plug-ins that do not, and to include DSP)",
+                  NULL, 0, 0),
+      OPT_STRING('W', "vis", &config->vis_plugin_filename,
+                 "vis plug-in to use (can be given multiple times, each "
+                 "plug-in renders on a thread of its own)",
+                 append_vis_plugin, (intptr_t)config, 0),
+      OPT_STRING(0, "dsp", &config->dsp_plugin_filename,
+                 "DSP plug-in to run audio through (can be given multiple "
+                 "times, for a chain in that order), \"PATH/DSP.dll?N\" "
+                 "for other than its first module",
+                 append_dsp_plugin, (intptr_t)config, 0),
+      OPT_STRING(0, "eq", &config->eq,
+                 "equalize with these ten gains in dB (-12 to 12) for 60, "
+                 "170, 310, 600, 1k, 3k, 6k, 12k, 14k and 16k Hz, e.g. "
+                 "\"3,2,0,0,0,0,0,1,2,3\"",
+                 parse_eq, (intptr_t)config, 0),
+      OPT_FLOAT(0, "eq-preamp", &config->eq_preamp_db,
+                "amplify by this many dB (-12 to 12) before equalizing",
+                check_eq_preamp, (intptr_t)config, 0),
+      OPT_STRING(0, "vis-modules", &config->vis_modules,
+                 "vis modules to run side by side, e.g. \"0,2\" or \"all\" "
+                 "(default: \"0\")",
+                 NULL, 0, 0),
+      OPT_BOOLEAN(0, "rotate", &config->rotate,
+                  "take turns with the --vis plug-ins rather than running "
+                  "them side by side (Ctrl+Alt+N switches to the next one)",
+                  NULL, 0, 0),
+      OPT_INTEGER(0, "rotate-seconds", &config->rotate_seconds,
+                  "switch to the next vis plug-in every N seconds (implies "
+                  "--rotate)",
+                  NULL, 0, 0),
+      OPT_STRING(0, "rotate-schedule", &config->rotate_schedule_filename,
+                 "take turns with the vis plug-ins listed in this file, one "
+                 "\"SECONDS PATH/VIS.dll\" per line (implies --rotate)",
                  NULL, 0, 0),
+      OPT_BOOLEAN(0, "vis-isolated", &config->vis_isolated,
+                  "run vis plug-ins in a separate process that is restarted "
+                  "should it crash",
+                  NULL, 0, 0),
+      OPT_STRING(0, "vis-internal-size", &config->vis_internal_size,
+                 "have vis plug-ins render at this size, e.g. \"320x240\", "
+                 "and scale that up to the window (for weak hardware)",
+                 parse_vis_internal_size, (intptr_t)config, 0),
+      OPT_INTEGER(0, "render-watchdog", &config->render_watchdog_ms,
+                  "log Render calls taking longer than N milliseconds, skip "
+                  "frames for and re-initialize modules that keep doing so, "
+                  "start plug-ins hung for 10x as long afresh",
+                  NULL, 0, 0),
+
+      OPT_GROUP("Integration arguments:"),
+      OPT_STRING(0, "analysis-bus", &config->analysis_bus_name,
+                 "publish analysis frames to shared memory of this name "
+                 "(e.g. \"Local\\visdriver\")",
+                 NULL, 0, 0),
+      OPT_STRING(0, "vis-host", &config->vis_host_bus_name,
+                 "only visualize analysis frames from shared memory of this "
+                 "name, rather than playing audio (as used by --vis-isolated)",
+                 NULL, 0, 0),
+      OPT_STRING(0, "capture", &config->capture_filename,
+                 "stream the vis window as raw BGRA video to this file or "
+                 "FIFO, or to a named pipe like \"\\\\.\\pipe\\visdriver\"",
+                 NULL, 0, 0),
+      OPT_STRING(0, "record", &config->record_filename,
+                 "record the audio played to this WAV file, FIFO or named "
+                 "pipe, from a thread of its own",
+                 NULL, 0, 0),
+      OPT_INTEGER(0, "offline", &config->offline_fps,
+                  "render N frames per second of audio as fast as possible "
+                  "rather than playing it, every frame (with --capture), "
+                  "plays the playlist once (--out is not needed)",
+                  NULL, 0, 0),
+      OPT_STRING(0, "offline-audio", &config->offline_audio_filename,
+                 "write the audio rendered with --offline to this WAV file",
+                 NULL, 0, 0),
+      OPT_BOOLEAN(0, "wall-leader", &config->wall_leader,
+                  "stamp analysis frames with when their audio is heard, so "
+                  "that all --vis-host processes show them in sync (requires "
+                  "--analysis-bus, --vis is optional and implies "
+                  "--vis-isolated)",
+                  NULL, 0, 0),
+
+      OPT_BOOLEAN(0, "scan-loudness", &config->scan_loudness,
+                  "measure the loudness of all tracks not in "
+                  "--loudness-cache yet as fast as possible, add it there, "
+                  "and exit (--out and --vis are not needed)",
+                  NULL, 0, 0),
+      OPT_INTEGER(0, "scan-jobs", &config->scan_jobs,
+                  "scan N tracks at a time, each in a process of its own "
+                  "(default: 1)",
+                  check_scan_jobs, (intptr_t)config, 0),
+      OPT_STRING(0, "loudness-cache", &config->loudness_cache_filename,
+                 "file of track loudness as measured by --scan-loudness; "
+                 "tracks found there are played at -18 LUFS",
+                 NULL, 0, 0),
+
+      OPT_GROUP("Diagnostic arguments:"),
+      OPT_BOOLEAN(0, "trace-plugins", &config->trace_plugins,
+                  "count and time all calls into plug-ins", NULL, 0, 0),
+      OPT_BOOLEAN(0, "metrics", &config->metrics,
+                  "report pipeline metrics once per second", NULL, 0, 0),
+      OPT_STRING(0, "metrics-file", &config->metrics_filename,
+                 "append pipeline metrics to this file as JSON lines "
+                 "(implies --metrics)",
+                 NULL, 0, 0),
+      OPT_BOOLEAN(0, "profile", &config->profile,
+                  "sample where CPU time goes, by plug-in DLL", NULL, 0, 0),
+      OPT_BOOLEAN(0, "monitor-resources", &config->monitor_resources,
+                  "watch threads, memory and handles for growth", NULL, 0,
+                  0),
 
       OPT_END(),
   };
@@ -121,14 +369,113 @@ void parse_command_line(visdriver_config_t *config, int argc,
   argc = argparse_parse(&argparse, argc, argv);
 
   // Check for required arguments
-  require_argument_that_is_wired_to(&config->input_plugin_filename, &argparse,
-                                    options);
-  require_argument_that_is_wired_to(&config->output_plugin_filename, &argparse,
-                                    options);
-  require_argument_that_is_wired_to(&config->vis_plugin_filename, &argparse,
-                                    options);
+  if (config->vis_host_bus_name == NULL) {
+    require_argument_that_is_wired_to(&config->input_plugin_filename,
+                                      &argparse, options);
+    if (config->offline_fps <= 0 && !config->scan_loudness) {
+      require_argument_that_is_wired_to(&config->output_plugin_filename,
+                                        &argparse, options);
+    }
+  }
+  if (config->scan_loudness) {
+    // Scanning takes the place of the output plug-in, without vis
+    require_argument_that_is_wired_to(&config->loudness_cache_filename,
+                                      &argparse, options);
+    reject_argument_that_is_wired_to(&config->offline_fps,
+                                     "cannot be combined with --scan-loudness",
+                                     &argparse, options);
+    reject_argument_that_is_wired_to(&config->vis_isolated,
+                                     "cannot be combined with --scan-loudness",
+                                     &argparse, options);
+    reject_argument_that_is_wired_to(&config->wall_leader,
+                                     "cannot be combined with --scan-loudness",
+                                     &argparse, options);
+    // What gets measured (and cached) is the audio as decoded
+    reject_argument_that_is_wired_to(&config->out_buffer_ms,
+                                     "cannot be combined with --scan-loudness",
+                                     &argparse, options);
+    reject_string_argument_that_is_wired_to(
+        &config->dsp_plugin_filename, "cannot be combined with --scan-loudness",
+        &argparse, options);
+    reject_string_argument_that_is_wired_to(
+        &config->eq, "cannot be combined with --scan-loudness", &argparse,
+        options);
+    if (config->eq_preamp_db != 0) {
+      exit_with_argument_error(
+          find_argument_writing_to(&config->eq_preamp_db, options),
+          "cannot be combined with --scan-loudness", &argparse);
+    }
+    reject_string_argument_that_is_wired_to(
+        &config->record_filename, "cannot be combined with --scan-loudness",
+        &argparse, options);
+  } else {
+    reject_argument_that_is_wired_to(&config->scan_jobs,
+                                     "needs --scan-loudness", &argparse,
+                                     options);
+  }
+  if (config->offline_fps > 0) {
+    // Offline, frames are rendered right here, one at a time
+    reject_argument_that_is_wired_to(&config->vis_isolated,
+                                     "cannot be combined with --offline",
+                                     &argparse, options);
+    reject_argument_that_is_wired_to(&config->wall_leader,
+                                     "cannot be combined with --offline",
+                                     &argparse, options);
+    reject_argument_that_is_wired_to(&config->out_buffer_ms,
+                                     "cannot be combined with --offline",
+                                     &argparse, options);
+    reject_argument_that_is_wired_to(&config->tap_output,
+                                     "cannot be combined with --offline",
+                                     &argparse, options);
+    if (config->record_filename != NULL) {
+      // Decoding outpaces any recorder offline, see --offline-audio instead
+      exit_with_argument_error(
+          find_argument_writing_to(&config->record_filename, options),
+          "cannot be combined with --offline, use --offline-audio",
+          &argparse);
+    }
+  }
+  if (config->rotate || config->rotate_seconds > 0 ||
+      config->rotate_schedule_filename != NULL) {
+    // Hung plug-ins are only ever started afresh (and offline rendering
+    // only ever stops waiting for them) by the side-by-side vis host
+    reject_argument_that_is_wired_to(&config->render_watchdog_ms,
+                                     "cannot be combined with --rotate",
+                                     &argparse, options);
+    reject_argument_that_is_wired_to(&config->offline_fps,
+                                     "cannot be combined with --rotate",
+                                     &argparse, options);
+  }
+  if (config->wall_leader) {
+    require_argument_that_is_wired_to(&config->analysis_bus_name, &argparse,
+                                      options);
+  } else if (config->rotate_schedule_filename == NULL &&
+             !config->scan_loudness) {
+    require_argument_that_is_wired_to(&config->vis_plugin_filename, &argparse,
+                                      options);
+  }
 
   // Apply defaults
+  if (config->metrics_filename != NULL) {
+    config->metrics = 1;
+  }
+  if (config->rotate_seconds > 0 || config->rotate_schedule_filename != NULL) {
+    config->rotate = 1;
+  }
+  if (config->scan_loudness) {
+    config->rotate = 0; // i.e. no vis plug-ins at all
+  }
+  if (config->scan_jobs == 0) {
+    config->scan_jobs = 1;
+  }
+  if (config->vis_modules == NULL) {
+    config->vis_modules = "0";
+  }
+  if (config->wall_leader && (config->vis_plugin_count > 0 ||
+                              config->rotate_schedule_filename != NULL)) {
+    config->vis_isolated = 1; // i.e. our own screen is just another follower
+  }
+
   static const char *const default_track =
       "line://"; // for in_line.dll or in_linein.dll
   const char *const *const default_tracks = &default_track;
@@ -18,12 +18,50 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#define CONFIG_VIS_PLUGINS_MAX 8
+#define CONFIG_DSP_PLUGINS_MAX 8
+#define CONFIG_SCAN_JOBS_MAX 16
+
 typedef struct _visdriver_config_t {
   const char *input_plugin_filename;
   const char *output_plugin_filename;
+  int out_buffer_ms;
+  int tap_output;
   const char *vis_plugin_filename;
+  const char *vis_plugin_filenames[CONFIG_VIS_PLUGINS_MAX];
+  int vis_plugin_count;
+  const char *dsp_plugin_filename;
+  const char *dsp_plugin_filenames[CONFIG_DSP_PLUGINS_MAX];
+  int dsp_plugin_count;
+  const char *eq;
+  float eq_gains_db[10];
+  float eq_preamp_db;
+  const char *vis_modules;
+  int rotate;
+  int rotate_seconds;
+  const char *rotate_schedule_filename;
+  int vis_isolated;
+  const char *vis_internal_size;
+  int vis_internal_width;
+  int vis_internal_height;
+  int render_watchdog_ms;
+  const char *vis_host_bus_name;
+  const char *analysis_bus_name;
+  const char *capture_filename;
+  const char *record_filename;
+  int offline_fps;
+  const char *offline_audio_filename;
+  int wall_leader;
+  int scan_loudness;
+  int scan_jobs;
+  const char *loudness_cache_filename;
   const char *const *tracks;
   int track_count;
+  int trace_plugins;
+  int metrics;
+  const char *metrics_filename;
+  int profile;
+  int monitor_resources;
 } visdriver_config_t;
 
 void parse_command_line(visdriver_config_t *config, int argc,
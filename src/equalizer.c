@@ -0,0 +1,246 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#if defined(_MSC_VER)
+#define _USE_MATH_DEFINES // for M_PI from math.h
+#else
+#define _GNU_SOURCE // for M_PI from math.h
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// SSE is a given for x64, MinGW gets -msse for this file (see CMakeLists.txt)
+#if defined(__SSE__) || defined(_M_X64) ||                                     \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define EQUALIZER_SSE
+#include <xmmintrin.h>
+#endif
+
+#include "equalizer.h"
+#include "log.h"
+
+#define EQUALIZER_CHANNELS_MAX 8
+#define EQUALIZER_Q 1.0f
+
+typedef struct _biquad_t {
+  float b0, b1, b2, a1, a2; // i.e. normalized by a0
+} biquad_t;
+
+static const float g_band_frequencies[EQUALIZER_BANDS] = {
+    60, 170, 310, 600, 1000, 3000, 6000, 12000, 14000, 16000};
+
+static float g_gains_db[EQUALIZER_BANDS];
+static float g_preamp_db = 0;
+static bool g_enabled = false;
+static bool g_flat = true;
+
+// Only bands with a gain and below Nyquist, for the current sample rate
+static int g_sample_rate = 0;
+static biquad_t g_filters[EQUALIZER_BANDS];
+static int g_filter_count = 0;
+static float g_preamp = 1.0f;
+// Transposed direct form II state, per filter: z1 and z2 of every channel
+static float g_state[EQUALIZER_BANDS][2][EQUALIZER_CHANNELS_MAX];
+
+static float *g_work = NULL;
+static size_t g_work_size = 0; // in floats
+static bool g_bps_logged = false;
+
+static float clamp_db(float db) {
+  if (db > EQUALIZER_MAX_DB) {
+    return EQUALIZER_MAX_DB;
+  }
+  return (db < -EQUALIZER_MAX_DB) ? -EQUALIZER_MAX_DB : db;
+}
+
+void equalizer_configure(const float gains_db[EQUALIZER_BANDS],
+                         float preamp_db) {
+  g_flat = (preamp_db == 0);
+  for (int i = 0; i < EQUALIZER_BANDS; i++) {
+    g_gains_db[i] = clamp_db(gains_db[i]);
+    g_flat = g_flat && (g_gains_db[i] == 0);
+  }
+  g_preamp_db = clamp_db(preamp_db);
+  g_sample_rate = 0; // i.e. compute filters afresh
+}
+
+// Winamp has 31 steps above 0 dB, but 32 below
+static char to_winamp(float db) {
+  const int steps = (db < 0) ? 32 : 31;
+  return (char)(31 - (int)lroundf(db * steps / EQUALIZER_MAX_DB));
+}
+
+void equalizer_to_winamp(char data[EQUALIZER_BANDS], int *preamp) {
+  for (int i = 0; i < EQUALIZER_BANDS; i++) {
+    data[i] = to_winamp(g_gains_db[i]);
+  }
+  *preamp = to_winamp(g_preamp_db);
+}
+
+void equalizer_enable(bool enabled) { g_enabled = enabled; }
+
+bool equalizer_active() { return g_enabled && !g_flat; }
+
+// A peaking filter, see Robert Bristow-Johnson's Audio EQ Cookbook
+static biquad_t make_peaking_filter(float frequency, float gain_db,
+                                    int sample_rate) {
+  const double a = pow(10.0, gain_db / 40.0);
+  const double w0 = 2.0 * M_PI * frequency / sample_rate;
+  const double alpha = sin(w0) / (2.0 * EQUALIZER_Q);
+  const double a0 = 1.0 + alpha / a;
+
+  biquad_t filter;
+  filter.b0 = (float)((1.0 + alpha * a) / a0);
+  filter.b1 = (float)(-2.0 * cos(w0) / a0);
+  filter.b2 = (float)((1.0 - alpha * a) / a0);
+  filter.a1 = filter.b1;
+  filter.a2 = (float)((1.0 - alpha / a) / a0);
+  return filter;
+}
+
+static void prepare_filters(int sample_rate) {
+  g_filter_count = 0;
+  for (int i = 0; i < EQUALIZER_BANDS; i++) {
+    if (g_gains_db[i] != 0 && g_band_frequencies[i] < 0.45f * sample_rate) {
+      g_filters[g_filter_count++] =
+          make_peaking_filter(g_band_frequencies[i], g_gains_db[i],
+                              sample_rate);
+    }
+  }
+  g_preamp = powf(10.0f, g_preamp_db / 20.0f);
+  memset(g_state, 0, sizeof(g_state));
+  g_sample_rate = sample_rate;
+}
+
+static void run_filter_channel(const biquad_t *filter,
+                               float (*state)[EQUALIZER_CHANNELS_MAX], int c,
+                               float *samples, int frames, int nch) {
+  float z1 = state[0][c];
+  float z2 = state[1][c];
+  float *sample = samples + c;
+  for (int i = 0; i < frames; i++, sample += nch) {
+    const float x = *sample;
+    const float y = filter->b0 * x + z1;
+    z1 = filter->b1 * x - filter->a1 * y + z2;
+    z2 = filter->b2 * x - filter->a2 * y;
+    *sample = y;
+  }
+  state[0][c] = z1;
+  state[1][c] = z2;
+}
+
+#ifdef EQUALIZER_SSE
+// Two or four neighbouring floats, i.e. channels of a frame
+static __m128 load_lanes(const float *values, int lanes) {
+  return (lanes == 4) ? _mm_loadu_ps(values)
+                      : _mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)values);
+}
+
+static void store_lanes(float *values, __m128 vector, int lanes) {
+  if (lanes == 4) {
+    _mm_storeu_ps(values, vector);
+  } else {
+    _mm_storel_pi((__m64 *)values, vector);
+  }
+}
+
+// The recursion runs along time, but channels are independent of each
+// other, so channels c to c + lanes - 1 share a vector, one lane each
+static void run_filter_lanes(const biquad_t *filter,
+                             float (*state)[EQUALIZER_CHANNELS_MAX], int c,
+                             int lanes, float *samples, int frames, int nch) {
+  const __m128 b0 = _mm_set1_ps(filter->b0);
+  const __m128 b1 = _mm_set1_ps(filter->b1);
+  const __m128 b2 = _mm_set1_ps(filter->b2);
+  const __m128 a1 = _mm_set1_ps(filter->a1);
+  const __m128 a2 = _mm_set1_ps(filter->a2);
+  __m128 z1 = load_lanes(&state[0][c], lanes);
+  __m128 z2 = load_lanes(&state[1][c], lanes);
+  float *frame = samples + c;
+  for (int i = 0; i < frames; i++, frame += nch) {
+    const __m128 x = load_lanes(frame, lanes);
+    const __m128 y = _mm_add_ps(_mm_mul_ps(b0, x), z1);
+    z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), z2);
+    z2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+    store_lanes(frame, y, lanes);
+  }
+  store_lanes(&state[0][c], z1, lanes);
+  store_lanes(&state[1][c], z2, lanes);
+}
+#endif
+
+// One filter at a time, so that coefficients and state stay in registers
+// for the whole run; with SSE, channels go four (or two) at a time
+static void run_filter(const biquad_t *filter,
+                       float (*state)[EQUALIZER_CHANNELS_MAX], float *samples,
+                       int frames, int nch) {
+  int c = 0;
+#ifdef EQUALIZER_SSE
+  while (nch - c >= 2) {
+    const int lanes = (nch - c >= 4) ? 4 : 2;
+    run_filter_lanes(filter, state, c, lanes, samples, frames, nch);
+    c += lanes;
+  }
+#endif
+  for (; c < nch; c++) {
+    run_filter_channel(filter, state, c, samples, frames, nch);
+  }
+}
+
+void equalizer_process(short int *samples, int numsamples, int bps, int nch,
+                       int srate) {
+  if (!equalizer_active() || numsamples <= 0 || nch <= 0 ||
+      nch > EQUALIZER_CHANNELS_MAX || srate <= 0) {
+    return;
+  }
+  if (bps != 16) {
+    if (!g_bps_logged) {
+      log_error("Equalizer needs 16 bit samples, got %d bits, skipping.",
+                bps);
+      g_bps_logged = true;
+    }
+    return;
+  }
+  if (srate != g_sample_rate) {
+    prepare_filters(srate);
+  }
+
+  const size_t count = (size_t)numsamples * nch;
+  if (count > g_work_size) {
+    float *const work = realloc(g_work, count * sizeof(float));
+    if (work == NULL) {
+      return;
+    }
+    g_work = work;
+    g_work_size = count;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    g_work[i] = samples[i] * g_preamp;
+  }
+  for (int f = 0; f < g_filter_count; f++) {
+    run_filter(&g_filters[f], g_state[f], g_work, numsamples, nch);
+  }
+  for (size_t i = 0; i < count; i++) {
+    const float value = g_work[i];
+    samples[i] = (value >= 32767.0f)    ? 32767
+                 : (value <= -32768.0f) ? -32768
+                                        : (short int)lrintf(value);
+  }
+}
@@ -0,0 +1,48 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef EQUALIZER_H
+#define EQUALIZER_H
+
+#include <stdbool.h>
+
+#define EQUALIZER_BANDS 10 // as in Winamp
+#define EQUALIZER_MAX_DB 12.0f
+
+// Sets gains (in dB, from -12 to +12) for the bands at 60, 170, 310, 600,
+// 1k, 3k, 6k, 12k, 14k and 16k Hz, and a preamp; all zero means flat
+void equalizer_configure(const float gains_db[EQUALIZER_BANDS],
+                         float preamp_db);
+
+// Converts the configuration to what In_Module.EQSet takes (0 to 63, with
+// 31 for 0 dB, 0 for +12 dB and 63 for -12 dB)
+void equalizer_to_winamp(char data[EQUALIZER_BANDS], int *preamp);
+
+// Has equalizer_process apply the configuration, unless flat; off for
+// input plug-ins that equalize themselves (see EQSet)
+void equalizer_enable(bool enabled);
+
+// False when disabled or flat, i.e. when equalizer_process would not
+// touch the samples
+bool equalizer_active();
+
+// Applies the equalizer to 16 bit samples in place, other sample sizes are
+// left alone
+void equalizer_process(short int *samples, int numsamples, int bps, int nch,
+                       int srate);
+
+#endif // ifndef EQUALIZER_H
@@ -0,0 +1,277 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "frame_capture.h"
+#include "log.h"
+#include "main_window.h"
+#include "stream_io.h"
+
+#ifndef PW_RENDERFULLCONTENT
+#define PW_RENDERFULLCONTENT 0x00000002 // Windows >=8.1, also captures DirectX
+#endif
+
+typedef struct _capture_slot_t {
+  HDC dc;
+  HBITMAP bitmap;
+  void *pixels;
+} capture_slot_t;
+
+// A single-producer single-consumer ring: the render thread fills slot
+// g_filled_count % FRAME_CAPTURE_SLOTS, the writer thread drains slot
+// g_written_count % FRAME_CAPTURE_SLOTS
+static capture_slot_t g_slots[FRAME_CAPTURE_SLOTS];
+static volatile LONG g_filled_count = 0;
+static volatile LONG g_written_count = 0;
+static LONG g_dropped_count = 0;
+static int g_width = 0; // i.e. not known before the first frame
+static int g_height = 0;
+
+static CRITICAL_SECTION g_producer_lock; // in case of concurrent renders
+static HANDLE g_filled_event = NULL;
+static HANDLE g_drained_event = NULL;
+static bool g_lossless = false;
+static HANDLE g_writer_thread = NULL;
+static volatile LONG g_stop_requested = 0;
+static volatile LONG g_output_open = 0;
+static char g_path[MAX_PATH];
+
+static DWORD WINAPI writer_thread_main(LPVOID parameter) {
+  const HANDLE output = stream_io_open_output(g_path);
+  if (output == INVALID_HANDLE_VALUE) {
+    if (!g_stop_requested) {
+      log_error("Could not open \"%s\" for capturing (error %lu).", g_path,
+                (unsigned long)GetLastError());
+    }
+    return 1;
+  }
+  InterlockedExchange(&g_output_open, 1);
+  log_info("Capturing frames to \"%s\"...", g_path);
+
+  const DWORD frame_bytes = (DWORD)g_width * g_height * 4;
+  bool header_written = false;
+  bool failed = false;
+  while (!failed) {
+    WaitForSingleObject(g_filled_event, INFINITE);
+
+    // Frames pending at stop still get written
+    while (!failed && g_written_count != g_filled_count) {
+      const capture_slot_t *const slot =
+          &g_slots[g_written_count % FRAME_CAPTURE_SLOTS];
+
+      if (!header_written) {
+        const frame_capture_header_t header = {
+            FRAME_CAPTURE_MAGIC, FRAME_CAPTURE_VERSION, (DWORD)g_width,
+            (DWORD)g_height};
+        failed = !stream_io_write_all(output, &header, sizeof(header));
+        header_written = true;
+      }
+      if (!failed) {
+        failed = !stream_io_write_all(output, slot->pixels, frame_bytes);
+      }
+      InterlockedIncrement(&g_written_count);
+      SetEvent(g_drained_event);
+    }
+
+    if (g_stop_requested) {
+      break;
+    }
+  }
+
+  if (failed && !g_stop_requested) {
+    log_error("Could not write to \"%s\" (error %lu), stopped capturing.",
+              g_path, (unsigned long)GetLastError());
+  }
+  CloseHandle(output);
+  return 0;
+}
+
+bool frame_capture_start(const char *path) {
+  if (strlen(path) >= sizeof(g_path)) {
+    log_error("Capture path \"%s\" is too long.", path);
+    return false;
+  }
+  strcpy(g_path, path);
+
+  g_filled_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+  g_drained_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+  if (g_filled_event == NULL || g_drained_event == NULL) {
+    log_error("CreateEventA failed.");
+    if (g_filled_event != NULL) {
+      CloseHandle(g_filled_event);
+      g_filled_event = NULL;
+    }
+    if (g_drained_event != NULL) {
+      CloseHandle(g_drained_event);
+      g_drained_event = NULL;
+    }
+    return false;
+  }
+  InitializeCriticalSection(&g_producer_lock);
+
+  g_stop_requested = 0;
+  g_writer_thread = CreateThread(NULL, 0, writer_thread_main, NULL, 0, NULL);
+  if (g_writer_thread == NULL) {
+    log_error("Could not create capture writer thread.");
+    DeleteCriticalSection(&g_producer_lock);
+    CloseHandle(g_filled_event);
+    g_filled_event = NULL;
+    CloseHandle(g_drained_event);
+    g_drained_event = NULL;
+    return false;
+  }
+  return true;
+}
+
+static void free_slots() {
+  for (int i = 0; i < FRAME_CAPTURE_SLOTS; i++) {
+    capture_slot_t *const slot = &g_slots[i];
+    if (slot->dc != NULL) {
+      DeleteDC(slot->dc);
+    }
+    if (slot->bitmap != NULL) {
+      DeleteObject(slot->bitmap);
+    }
+    memset(slot, 0, sizeof(*slot));
+  }
+}
+
+static bool allocate_slots(int width, int height) {
+  BITMAPINFO info;
+  memset(&info, 0, sizeof(info));
+  info.bmiHeader.biSize = sizeof(info.bmiHeader);
+  info.bmiHeader.biWidth = width;
+  info.bmiHeader.biHeight = -height; // i.e. top-down
+  info.bmiHeader.biPlanes = 1;
+  info.bmiHeader.biBitCount = 32;
+  info.bmiHeader.biCompression = BI_RGB;
+
+  for (int i = 0; i < FRAME_CAPTURE_SLOTS; i++) {
+    capture_slot_t *const slot = &g_slots[i];
+    slot->dc = CreateCompatibleDC(NULL);
+    slot->bitmap = CreateDIBSection(NULL, &info, DIB_RGB_COLORS,
+                                    &slot->pixels, NULL, 0);
+    if (slot->dc == NULL || slot->bitmap == NULL) {
+      log_error("Could not create %dx%d capture bitmaps.", width, height);
+      free_slots();
+      return false;
+    }
+    SelectObject(slot->dc, slot->bitmap);
+  }
+
+  g_width = width;
+  g_height = height;
+  return true;
+}
+
+static void capture_into(capture_slot_t *slot, HWND window, int width,
+                         int height) {
+  if (width == g_width && height == g_height &&
+      PrintWindow(window, slot->dc, PW_CLIENTONLY | PW_RENDERFULLCONTENT)) {
+    return;
+  }
+
+  // The stream has a fixed size, so later sizes need scaling
+  const HDC window_dc = GetDC(window);
+  if (window_dc == NULL) {
+    return;
+  }
+  SetStretchBltMode(slot->dc, COLORONCOLOR);
+  StretchBlt(slot->dc, 0, 0, g_width, g_height, window_dc, 0, 0, width,
+             height, SRCCOPY);
+  ReleaseDC(window, window_dc);
+}
+
+void frame_capture_set_lossless(bool lossless) { g_lossless = lossless; }
+
+// Gives up once the writer thread has ended, e.g. after a write error
+static void wait_for_free_slot() {
+  while (g_filled_count - g_written_count >= FRAME_CAPTURE_SLOTS &&
+         WaitForSingleObject(g_writer_thread, 0) == WAIT_TIMEOUT) {
+    WaitForSingleObject(g_drained_event, 100);
+  }
+}
+
+void frame_capture_submit(HWND window) {
+  if (g_writer_thread == NULL ||
+      GetAncestor(window, GA_ROOT) != g_main_window) {
+    return;
+  }
+  if (g_lossless) {
+    EnterCriticalSection(&g_producer_lock);
+  } else if (!TryEnterCriticalSection(&g_producer_lock)) {
+    return; // i.e. another render thread is capturing right now
+  }
+
+  RECT rect;
+  if (GetClientRect(g_main_window, &rect) && rect.right > rect.left &&
+      rect.bottom > rect.top) {
+    const int width = rect.right - rect.left;
+    const int height = rect.bottom - rect.top;
+
+    if (g_width == 0 && !allocate_slots(width, height)) {
+      g_width = -1; // i.e. do not try again
+    }
+
+    if (g_width > 0) {
+      if (g_lossless) {
+        wait_for_free_slot();
+      }
+      if (g_filled_count - g_written_count >= FRAME_CAPTURE_SLOTS) {
+        g_dropped_count++; // i.e. the writer is behind, never wait for it
+      } else {
+        capture_into(&g_slots[g_filled_count % FRAME_CAPTURE_SLOTS],
+                     g_main_window, width, height);
+        GdiFlush(); // before the writer thread gets to see the pixels
+        InterlockedIncrement(&g_filled_count);
+        SetEvent(g_filled_event);
+      }
+    }
+  }
+
+  LeaveCriticalSection(&g_producer_lock);
+}
+
+void frame_capture_stop() {
+  if (g_writer_thread == NULL) {
+    return;
+  }
+
+  InterlockedExchange(&g_stop_requested, 1);
+  SetEvent(g_filled_event);
+  stream_io_join_thread(g_writer_thread, &g_output_open);
+  g_writer_thread = NULL;
+
+  log_info("Captured %ld frames, dropped %ld.", (long)g_written_count,
+           (long)g_dropped_count);
+
+  free_slots();
+  g_width = 0;
+  g_height = 0;
+  g_filled_count = 0;
+  g_written_count = 0;
+  g_dropped_count = 0;
+  g_output_open = 0;
+
+  DeleteCriticalSection(&g_producer_lock);
+  CloseHandle(g_filled_event);
+  g_filled_event = NULL;
+  CloseHandle(g_drained_event);
+  g_drained_event = NULL;
+}
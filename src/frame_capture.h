@@ -0,0 +1,56 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <stdbool.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#define FRAME_CAPTURE_SLOTS 8
+#define FRAME_CAPTURE_MAGIC 0x41524742 // "BGRA"
+#define FRAME_CAPTURE_VERSION 1
+
+// The stream starts with this header, followed by nothing but frames of
+// width * height * 4 bytes, top-down BGRA, so that e.g. ffmpeg can read it
+// as rawvideo after skipping sizeof(frame_capture_header_t) bytes.
+typedef struct _frame_capture_header_t {
+  DWORD magic;
+  DWORD version;
+  DWORD width;
+  DWORD height;
+} frame_capture_header_t;
+
+// Streams the main window to a file, a Unix FIFO (under Wine) or, for
+// paths like "\\.\pipe\NAME", a named pipe that we create.  Opening and
+// writing happen on a thread of its own, frames that the writer cannot
+// keep up with are dropped.
+bool frame_capture_start(const char *path);
+
+// Has frame_capture_submit wait for the writer rather than drop frames,
+// e.g. for offline rendering
+void frame_capture_set_lossless(bool lossless);
+
+// Captures the main window, if the window given is part of it; meant to be
+// called by the render thread right after Render
+void frame_capture_submit(HWND window);
+
+void frame_capture_stop();
+
+#endif // ifndef FRAME_CAPTURE_H
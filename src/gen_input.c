@@ -0,0 +1,361 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#if defined(_MSC_VER)
+#define _USE_MATH_DEFINES // for M_PI from math.h
+#else
+#define _GNU_SOURCE // for M_PI from math.h
+#endif
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <winamp/wa_ipc.h>
+
+#include "builtin_input.h"
+#include "gen_input.h"
+#include "log.h"
+#include "pcm.h"
+
+typedef enum _gen_kind_t {
+  GEN_SINE,
+  GEN_SWEEP,
+  GEN_MULTITONE,
+  GEN_WHITE,
+  GEN_PINK,
+  GEN_IMPULSE,
+  GEN_SILENCE,
+} gen_kind_t;
+
+typedef struct _gen_signal_t {
+  gen_kind_t kind;
+  double frequency;
+  double from;
+  double to;
+  double every_ms;
+  double amplitude;
+  ULONGLONG seed;
+  double duration_s;
+  int sample_rate;
+  int channels;
+  int bits_per_sample;
+} gen_signal_t;
+
+static const char *const g_kind_names[] = {
+    "sine", "sweep", "multitone", "white", "pink", "impulse", "silence",
+};
+
+static const double g_multitone_frequencies[] = {63, 250, 1000, 4000, 12000};
+
+static In_Module g_in_module;
+
+static gen_signal_t g_signal;
+static LONGLONG g_frame_count = 0; // i.e. endless if 0
+static HANDLE g_generator_thread = NULL;
+static volatile LONG g_stop_requested = 0;
+static volatile LONG g_seek_to_ms = -1; // i.e. no seek pending
+static LONGLONG g_position = 0; // in frames, generator thread only
+
+// Paul Kellet's economy pink noise filter, per channel
+static float g_pink_state[BUILTIN_INPUT_CHANNELS_MAX][3];
+
+static char g_samples[BUILTIN_INPUT_CHUNK_FRAMES * BUILTIN_INPUT_CHANNELS_MAX *
+                      4];
+
+// Returns the number for key in a query like "a=1&b=2", or fallback
+static double query_number(const char *query, const char *key,
+                           double fallback) {
+  const size_t key_len = strlen(key);
+  const char *pair = query;
+  while (pair != NULL && pair[0] != '\0') {
+    if (strncmp(pair, key, key_len) == 0 && pair[key_len] == '=') {
+      return strtod(pair + key_len + 1, NULL);
+    }
+    pair = strchr(pair, '&');
+    if (pair != NULL) {
+      pair++;
+    }
+  }
+  return fallback;
+}
+
+static bool parse_track(gen_signal_t *signal, const char *track) {
+  if (strncmp(track, GEN_INPUT_PREFIX, strlen(GEN_INPUT_PREFIX)) != 0) {
+    log_error("Track \"%s\" does not start with \"%s\".", track,
+              GEN_INPUT_PREFIX);
+    return false;
+  }
+  const char *const kind = track + strlen(GEN_INPUT_PREFIX);
+  const char *const query = strchr(kind, '?');
+  const size_t kind_len =
+      (query != NULL) ? (size_t)(query - kind) : strlen(kind);
+
+  bool known = false;
+  for (size_t i = 0; i < sizeof(g_kind_names) / sizeof(g_kind_names[0]);
+       i++) {
+    if (kind_len == strlen(g_kind_names[i]) &&
+        strncmp(kind, g_kind_names[i], kind_len) == 0) {
+      signal->kind = (gen_kind_t)i;
+      known = true;
+    }
+  }
+  if (!known) {
+    log_error("There is no test signal \"%.*s\".", (int)kind_len, kind);
+    return false;
+  }
+
+  const char *const parameters = (query != NULL) ? query + 1 : "";
+  signal->frequency = query_number(parameters, "freq", 1000);
+  signal->from = query_number(parameters, "from", 20);
+  signal->to = query_number(parameters, "to", 20000);
+  signal->every_ms = query_number(parameters, "every", 500);
+  signal->amplitude = query_number(parameters, "amp", 0.5);
+  signal->seed = (ULONGLONG)query_number(parameters, "seed", 1);
+  signal->duration_s = query_number(parameters, "dur", 60);
+  signal->sample_rate = (int)query_number(parameters, "rate", 44100);
+  signal->channels = (int)query_number(parameters, "channels", 2);
+  signal->bits_per_sample = (int)query_number(parameters, "bits", 16);
+
+  if (signal->sample_rate <= 0 || signal->channels <= 0 ||
+      signal->channels > BUILTIN_INPUT_CHANNELS_MAX ||
+      !pcm_bits_supported(signal->bits_per_sample)) {
+    log_error("Cannot generate %d Hz, %d channels at %d bits.",
+              signal->sample_rate, signal->channels,
+              signal->bits_per_sample);
+    return false;
+  }
+  if (signal->duration_s < 0 || signal->from <= 0 || signal->to <= 0 ||
+      signal->every_ms <= 0) {
+    log_error("Test signal \"%s\" has parameters out of range.", track);
+    return false;
+  }
+  return true;
+}
+
+// SplitMix64, as a hash of the sample position rather than a sequence
+static ULONGLONG mix(ULONGLONG value) {
+  value += 0x9e3779b97f4a7c15ULL;
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+  return value ^ (value >> 31);
+}
+
+static double white_noise_at(LONGLONG frame, int channel) {
+  const ULONGLONG bits =
+      mix(g_signal.seed * 0x100000001b3ULL ^
+          ((ULONGLONG)frame * g_signal.channels + channel));
+  return (double)(bits >> 40) / (double)(1 << 23) - 1.0; // i.e. [-1, 1)
+}
+
+static double sine_at(double frequency, LONGLONG frame) {
+  // Whole cycles dropped first, for precision far into the signal
+  const double cycles =
+      fmod(frequency * frame, g_signal.sample_rate) / g_signal.sample_rate;
+  return sin(2.0 * M_PI * cycles);
+}
+
+static double value_at(LONGLONG frame, int channel) {
+  switch (g_signal.kind) {
+  case GEN_SINE:
+    return sine_at(g_signal.frequency, frame);
+  case GEN_SWEEP: {
+    // Endless sweeps start over every 60 seconds, rather than growing on
+    // past Nyquist (and eventually to infinity)
+    const double duration_s =
+        (g_signal.duration_s > 0) ? g_signal.duration_s : 60;
+    LONGLONG period = (LONGLONG)(duration_s * g_signal.sample_rate);
+    if (period < 1) {
+      period = 1;
+    }
+    const double t = (double)(frame % period) / g_signal.sample_rate;
+    const double growth = log(g_signal.to / g_signal.from);
+    if (fabs(growth) < 1e-9) {
+      return sine_at(g_signal.from, frame);
+    }
+    const double phase = 2.0 * M_PI * g_signal.from * duration_s / growth *
+                         (exp(t * growth / duration_s) - 1.0);
+    return sin(phase);
+  }
+  case GEN_MULTITONE: {
+    const size_t count = sizeof(g_multitone_frequencies) /
+                         sizeof(g_multitone_frequencies[0]);
+    double sum = 0;
+    for (size_t i = 0; i < count; i++) {
+      sum += sine_at(g_multitone_frequencies[i], frame);
+    }
+    return sum / count;
+  }
+  case GEN_WHITE:
+    return white_noise_at(frame, channel);
+  case GEN_PINK: {
+    const float white = (float)white_noise_at(frame, channel);
+    float *const state = g_pink_state[channel];
+    state[0] = 0.99765f * state[0] + white * 0.0990460f;
+    state[1] = 0.96300f * state[1] + white * 0.2965164f;
+    state[2] = 0.57000f * state[2] + white * 1.0526913f;
+    return (state[0] + state[1] + state[2] + white * 0.1848f) * 0.25f;
+  }
+  case GEN_IMPULSE: {
+    LONGLONG period =
+        (LONGLONG)(g_signal.every_ms * g_signal.sample_rate / 1000);
+    if (period < 1) {
+      period = 1;
+    }
+    return (frame % period == 0) ? 1.0 : 0.0;
+  }
+  default: // i.e. GEN_SILENCE
+    return 0;
+  }
+}
+
+static void generate(char *target, LONGLONG first_frame, int frames) {
+  for (int i = 0; i < frames; i++) {
+    for (int c = 0; c < g_signal.channels; c++) {
+      const double value = g_signal.amplitude * value_at(first_frame + i, c);
+      pcm_store_sample(target, g_signal.bits_per_sample,
+                       i * g_signal.channels + c, (float)value);
+    }
+  }
+}
+
+static DWORD WINAPI generator_thread_main(LPVOID parameter) {
+  Out_Module *const out = g_in_module.outMod;
+
+  while (!g_stop_requested) {
+    const LONG seek_to_ms = InterlockedExchange(&g_seek_to_ms, -1);
+    if (seek_to_ms >= 0) {
+      g_position = (LONGLONG)seek_to_ms * g_signal.sample_rate / 1000;
+      if (g_frame_count > 0 && g_position > g_frame_count) {
+        g_position = g_frame_count;
+      }
+      memset(g_pink_state, 0, sizeof(g_pink_state));
+      out->Flush(seek_to_ms);
+    }
+
+    if (g_frame_count > 0 && g_position >= g_frame_count) {
+      if (!out->IsPlaying()) {
+        PostMessageA(g_in_module.hMainWindow, WM_WA_MPEG_EOF, 0, 0);
+        return 0;
+      }
+      Sleep(10);
+      continue;
+    }
+
+    int frames = BUILTIN_INPUT_CHUNK_FRAMES;
+    if (g_frame_count > 0 && frames > g_frame_count - g_position) {
+      frames = (int)(g_frame_count - g_position);
+    }
+    if (!builtin_input_can_write(frames)) {
+      Sleep(10);
+      continue;
+    }
+
+    generate(g_samples, g_position, frames);
+    builtin_input_write(g_samples, frames);
+    g_position += frames;
+  }
+  return 0;
+}
+
+static void gen_get_file_info(const char *file, char *title,
+                              int *length_in_ms) {
+  gen_signal_t signal;
+  if (file == NULL || file[0] == '\0') {
+    signal = g_signal;
+  } else if (!parse_track(&signal, file)) {
+    return;
+  }
+
+  if (title != NULL) {
+    snprintf(title, GETFILEINFO_TITLE_LENGTH, "%s (%d Hz, %d channels)",
+             g_kind_names[signal.kind], signal.sample_rate, signal.channels);
+  }
+  if (length_in_ms != NULL) {
+    *length_in_ms = (int)(signal.duration_s * 1000);
+  }
+}
+
+static int __cdecl gen_is_our_file(const char *fn) {
+  return strncmp(fn, GEN_INPUT_PREFIX, strlen(GEN_INPUT_PREFIX)) == 0;
+}
+
+static void __cdecl gen_stop();
+
+static int __cdecl gen_play(const char *fn) {
+  gen_stop(); // i.e. in case of a track that just finished
+
+  if (!parse_track(&g_signal, fn)) {
+    return 1;
+  }
+  g_frame_count = (LONGLONG)(g_signal.duration_s * g_signal.sample_rate);
+
+  if (!builtin_input_open(g_signal.sample_rate, g_signal.channels,
+                          g_signal.bits_per_sample)) {
+    return 1;
+  }
+
+  memset(g_pink_state, 0, sizeof(g_pink_state));
+  g_position = 0;
+  g_seek_to_ms = -1;
+  g_stop_requested = 0;
+  g_generator_thread =
+      CreateThread(NULL, 0, generator_thread_main, NULL, 0, NULL);
+  if (g_generator_thread == NULL) {
+    log_error("Could not start generator thread.");
+    builtin_input_close();
+    return 1;
+  }
+  return 0;
+}
+
+static void __cdecl gen_stop() {
+  if (g_generator_thread == NULL) {
+    return;
+  }
+  InterlockedExchange(&g_stop_requested, 1);
+  WaitForSingleObject(g_generator_thread, INFINITE);
+  CloseHandle(g_generator_thread);
+  g_generator_thread = NULL;
+
+  builtin_input_close();
+}
+
+static int __cdecl gen_get_length() {
+  return (g_frame_count > 0) ? (int)(g_signal.duration_s * 1000)
+                             : -1000; // i.e. endless
+}
+
+static void __cdecl gen_set_output_time(int time_in_ms) {
+  InterlockedExchange(&g_seek_to_ms, time_in_ms);
+}
+
+In_Module *gen_input_module() {
+  builtin_input_init(&g_in_module);
+  g_in_module.description = "visdriver test signal generator";
+  g_in_module.FileExtensions = "\0"; // i.e. gen:// only, see IsOurFile
+  g_in_module.is_seekable = 1;
+  g_in_module.GetFileInfo = gen_get_file_info;
+  g_in_module.IsOurFile = gen_is_our_file;
+  g_in_module.Play = gen_play;
+  g_in_module.Stop = gen_stop;
+  g_in_module.GetLength = gen_get_length;
+  g_in_module.SetOutputTime = gen_set_output_time;
+  return &g_in_module;
+}
@@ -0,0 +1,46 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef GEN_INPUT_H
+#define GEN_INPUT_H
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <winamp/in2.h>
+
+#define GEN_INPUT_PREFIX "gen://"
+
+// A built-in input plug-in generating test signals, for benchmarks that
+// give the same results anywhere.  Tracks are named like
+// "gen://KIND?KEY=VALUE&..." with KIND one of
+//   sine       (freq=HZ, default 1000)
+//   sweep      logarithmic (from=HZ, default 20; to=HZ, default 20000),
+//              repeating every 60 seconds if endless
+//   multitone  63, 250, 1000, 4000 and 12000 Hz at once
+//   white      noise (seed=N, default 1)
+//   pink       noise (seed=N, default 1)
+//   impulse    a train of single samples (every=MS, default 500)
+//   silence
+// and, for all kinds: dur=SECONDS (default 60, 0 for endless), rate=HZ
+// (default 44100), channels=N (default 2), bits=N (default 16) and
+// amp=GAIN (default 0.5).  Every sample is a function of its position, so
+// output is identical across runs, machines and seeks (but for pink noise,
+// whose filter starts afresh after seeking).
+In_Module *gen_input_module();
+
+#endif // ifndef GEN_INPUT_H
@@ -0,0 +1,93 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+
+#include "histogram.h"
+
+static int bucket_index_of(LONGLONG value) {
+  int index = 0;
+  while (value > 0 && index < HISTOGRAM_BUCKET_COUNT - 1) {
+    value >>= 1;
+    index++;
+  }
+  return index;
+}
+
+void histogram_add(histogram_t *histogram, LONGLONG value) {
+  InterlockedIncrement(&histogram->buckets[bucket_index_of(value)]);
+  InterlockedIncrement(&histogram->count);
+}
+
+void histogram_drain(histogram_t *histogram, histogram_t *snapshot) {
+  // The count is derived from the buckets so that the two always agree
+  LONG count = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; i++) {
+    snapshot->buckets[i] = InterlockedExchange(&histogram->buckets[i], 0);
+    count += snapshot->buckets[i];
+  }
+  InterlockedExchangeAdd(&histogram->count, -count);
+  snapshot->count = count;
+}
+
+LONGLONG histogram_percentile(const histogram_t *histogram, int percent) {
+  const LONG count = histogram->count;
+  if (count <= 0) {
+    return 0;
+  }
+
+  const LONGLONG needed = ((LONGLONG)count * percent + 99) / 100;
+  LONGLONG seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; i++) {
+    seen += histogram->buckets[i];
+    if (seen >= needed && seen > 0) {
+      return (i == 0) ? 0 : ((LONGLONG)1 << i) - 1;
+    }
+  }
+  return ((LONGLONG)1 << (HISTOGRAM_BUCKET_COUNT - 1)) - 1;
+}
+
+void histogram_format(const histogram_t *histogram, char *text, size_t size) {
+  snprintf(text, size, "p50<=%d p90<=%d p99<=%d max<=%d",
+           (int)histogram_percentile(histogram, 50),
+           (int)histogram_percentile(histogram, 90),
+           (int)histogram_percentile(histogram, 99),
+           (int)histogram_percentile(histogram, 100));
+}
+
+static void format_duration_us(LONGLONG us, char *text, size_t size) {
+  if (us < 1000) {
+    snprintf(text, size, "%dus", (int)us);
+  } else if (us < 1000000) {
+    snprintf(text, size, "%.1fms", us / 1000.0);
+  } else {
+    snprintf(text, size, "%.1fs", us / 1000000.0);
+  }
+}
+
+void histogram_format_us(const histogram_t *histogram, char *text,
+                         size_t size) {
+  char p50[16];
+  char p90[16];
+  char p99[16];
+  char max[16];
+  format_duration_us(histogram_percentile(histogram, 50), p50, sizeof(p50));
+  format_duration_us(histogram_percentile(histogram, 90), p90, sizeof(p90));
+  format_duration_us(histogram_percentile(histogram, 99), p99, sizeof(p99));
+  format_duration_us(histogram_percentile(histogram, 100), max, sizeof(max));
+  snprintf(text, size, "p50<=%s p90<=%s p99<=%s max<=%s", p50, p90, p99, max);
+}
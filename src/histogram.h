@@ -0,0 +1,50 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stddef.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#define HISTOGRAM_BUCKET_COUNT 32
+
+// Histogram with logarithmic buckets: bucket 0 counts value 0,
+// bucket i>=1 counts values from 2^(i-1) to 2^i-1.
+// Adding is lock-free so that it is safe from plugin threads.
+typedef struct _histogram_t {
+  volatile LONG count;
+  volatile LONG buckets[HISTOGRAM_BUCKET_COUNT];
+} histogram_t;
+
+void histogram_add(histogram_t *histogram, LONGLONG value);
+
+// Moves all counts over to snapshot, leaving histogram empty; safe against
+// concurrent histogram_add
+void histogram_drain(histogram_t *histogram, histogram_t *snapshot);
+
+// Returns the upper bound of the bucket that holds the given percentile
+LONGLONG histogram_percentile(const histogram_t *histogram, int percent);
+
+void histogram_format(const histogram_t *histogram, char *text, size_t size);
+
+void histogram_format_us(const histogram_t *histogram, char *text,
+                         size_t size);
+
+#endif // ifndef HISTOGRAM_H
@@ -25,8 +25,13 @@
 #include <winamp/in2.h>
 
 #include "audio_dsp.h"
+#include "gen_input.h"
+#include "input_plugin.h"
 #include "log.h"
+#include "module_registry.h"
+#include "pcm_input.h"
 #include "visualization.h"
+#include "wav_input.h"
 
 typedef In_Module *(__cdecl *winamp_get_in_module2_func)(void);
 
@@ -82,8 +87,66 @@ bool can_play_file(In_Module *in_module, const char *filename) {
   }
 }
 
+// Fills in what Winamp would
+static void wire_input_module(In_Module *in_module, HWND main_window,
+                              Out_Module *output_module) {
+  in_module->hMainWindow = main_window;
+
+  in_module->SAVSAInit = SAVSAInit;
+  in_module->SAVSADeInit = SAVSADeInit;
+  in_module->SAAddPCMData = SAAddPCMData;
+  in_module->SAGetMode = SAGetMode;
+  in_module->SAAdd = SAAdd;
+  in_module->VSAAddPCMData = VSAAddPCMData;
+  in_module->VSAGetMode = VSAGetMode;
+  in_module->VSAAdd = VSAAdd;
+  in_module->VSASetInfo = VSASetInfo;
+
+  in_module->dsp_dosamples = dsp_dosamples;
+  in_module->dsp_isactive = dsp_isactive;
+
+  in_module->SetInfo = SetInfo;
+
+  in_module->outMod = output_module;
+}
+
+static In_Module *load_builtin_input_module(const char *name,
+                                            HWND main_window,
+                                            Out_Module *output_module) {
+  In_Module *in_module = NULL;
+  const char *const parameters = strchr(name, '?');
+  const size_t name_len =
+      (parameters != NULL) ? (size_t)(parameters - name) : strlen(name);
+
+  if (name_len == strlen("wav") && strncmp(name, "wav", name_len) == 0) {
+    in_module = wav_input_module();
+  } else if (name_len == strlen("gen") &&
+             strncmp(name, "gen", name_len) == 0) {
+    in_module = gen_input_module();
+  } else if (name_len == strlen("pcm") &&
+             strncmp(name, "pcm", name_len) == 0) {
+    in_module = pcm_input_module((parameters != NULL) ? parameters + 1 : "");
+  } else {
+    log_error("There is no built-in input plug-in \"%.*s\".", (int)name_len,
+              name);
+  }
+
+  if (in_module != NULL) {
+    in_module->hDllInstance = NULL; // i.e. nothing to unload
+    wire_input_module(in_module, main_window, output_module);
+  }
+  return in_module;
+}
+
 In_Module *load_input_module(const char *filename, HWND main_window,
                              Out_Module *output_module) {
+  if (strncmp(filename, INPUT_PLUGIN_BUILTIN_PREFIX,
+              strlen(INPUT_PLUGIN_BUILTIN_PREFIX)) == 0) {
+    return load_builtin_input_module(
+        filename + strlen(INPUT_PLUGIN_BUILTIN_PREFIX), main_window,
+        output_module);
+  }
+
   const HMODULE dll_handle = LoadLibraryA(filename);
   if (dll_handle == NULL) {
     log_error("LoadLibraryA failed for file \"%s\".", filename);
@@ -112,29 +175,18 @@ In_Module *load_input_module(const char *filename, HWND main_window,
   }
 
   in_module->hDllInstance = dll_handle;
-  in_module->hMainWindow = main_window;
+  wire_input_module(in_module, main_window, output_module);
 
-  in_module->SAVSAInit = SAVSAInit;
-  in_module->SAVSADeInit = SAVSADeInit;
-  in_module->SAAddPCMData = SAAddPCMData;
-  in_module->SAGetMode = SAGetMode;
-  in_module->SAAdd = SAAdd;
-  in_module->VSAAddPCMData = VSAAddPCMData;
-  in_module->VSAGetMode = VSAGetMode;
-  in_module->VSAAdd = VSAAdd;
-  in_module->VSASetInfo = VSASetInfo;
-
-  in_module->dsp_dosamples = dsp_dosamples;
-  in_module->dsp_isactive = dsp_isactive;
-
-  in_module->SetInfo = SetInfo;
-
-  in_module->outMod = output_module;
+  module_registry_add(filename, dll_handle);
 
   return in_module;
 }
 
 void unload_input_module(In_Module *in_module) {
   in_module->Quit();
+  if (in_module->hDllInstance == NULL) {
+    return; // i.e. built-in, e.g. wav_input_module
+  }
+  module_registry_remove(in_module->hDllInstance);
   FreeLibrary(in_module->hDllInstance);
 }
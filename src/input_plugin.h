@@ -23,8 +23,13 @@
 
 #include <winamp/in2.h>
 
+#define INPUT_PLUGIN_BUILTIN_PREFIX "builtin:"
+
 bool can_play_file(In_Module *in_module, const char *filename);
 
+// Also takes "builtin:NAME?PARAMETERS" for input plug-ins built into
+// visdriver, i.e. "builtin:wav" (see wav_input.h), "builtin:pcm" (see
+// pcm_input.h) and "builtin:gen" (see gen_input.h)
 In_Module *load_input_module(const char *filename, HWND main_window,
                              Out_Module *output_module);
 
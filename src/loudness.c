@@ -0,0 +1,337 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#if defined(_MSC_VER)
+#define _USE_MATH_DEFINES // for M_PI from math.h
+#else
+#define _GNU_SOURCE // for M_PI from math.h
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "loudness.h"
+#include "pcm.h"
+
+#define LOUDNESS_CHANNELS_MAX 8
+#define LOUDNESS_ABSOLUTE_GATE_LUFS -70.0
+#define LOUDNESS_RELATIVE_GATE_LU -10.0
+
+typedef struct _k_filter_t {
+  double b[3];
+  double a[3]; // a[0] is 1
+} k_filter_t;
+
+// K-weighting: a high shelf, then a high pass
+static k_filter_t g_shelf;
+static k_filter_t g_high_pass;
+static double g_state[LOUDNESS_CHANNELS_MAX][2][2]; // per channel, filter
+
+static int g_sample_rate = 0; // i.e. not measuring
+static int g_channels = 0;
+static int g_bits_per_sample = 0;
+
+// Mean squares are summed per 100ms; gating blocks are 400ms, overlapping
+// by 75%, i.e. made of four consecutive sums
+static int g_subblock_frames = 0;
+static int g_subblock_count = 0; // frames in the current one
+static double g_subblock_sum[LOUDNESS_CHANNELS_MAX];
+static double g_recent_sums[4][LOUDNESS_CHANNELS_MAX];
+static int g_recent_count = 0;
+static double g_peak = 0;
+
+// Loudness of every gating block of the track, for gating at the end
+static double *g_blocks = NULL;
+static size_t g_block_count = 0;
+static size_t g_block_capacity = 0;
+
+static volatile LONG g_gain_millibel = 0; // i.e. 1/100 dB, read in DSP
+static bool g_bps_logged = false;
+
+// Coefficients as derived by libebur128, for any sample rate
+static void prepare_k_filters(int sample_rate) {
+  double f0 = 1681.974450955533;
+  const double gain_db = 3.999843853973347;
+  double q = 0.7071752369554196;
+  double k = tan(M_PI * f0 / sample_rate);
+  const double vh = pow(10.0, gain_db / 20.0);
+  const double vb = pow(vh, 0.4996667741545416);
+  double a0 = 1.0 + k / q + k * k;
+  g_shelf.b[0] = (vh + vb * k / q + k * k) / a0;
+  g_shelf.b[1] = 2.0 * (k * k - vh) / a0;
+  g_shelf.b[2] = (vh - vb * k / q + k * k) / a0;
+  g_shelf.a[0] = 1.0;
+  g_shelf.a[1] = 2.0 * (k * k - 1.0) / a0;
+  g_shelf.a[2] = (1.0 - k / q + k * k) / a0;
+
+  f0 = 38.13547087602444;
+  q = 0.5003270373238773;
+  k = tan(M_PI * f0 / sample_rate);
+  a0 = 1.0 + k / q + k * k;
+  g_high_pass.b[0] = 1.0;
+  g_high_pass.b[1] = -2.0;
+  g_high_pass.b[2] = 1.0;
+  g_high_pass.a[0] = 1.0;
+  g_high_pass.a[1] = 2.0 * (k * k - 1.0) / a0;
+  g_high_pass.a[2] = (1.0 - k / q + k * k) / a0;
+}
+
+static double run_k_filter(const k_filter_t *filter, double *state,
+                           double x) {
+  const double y = filter->b[0] * x + state[0];
+  state[0] = filter->b[1] * x - filter->a[1] * y + state[1];
+  state[1] = filter->b[2] * x - filter->a[2] * y;
+  return y;
+}
+
+// Surround channels of 5.1 count more, the LFE channel not at all
+static double channel_weight(int channel) {
+  if (g_channels == 6 && channel == 3) {
+    return 0.0;
+  }
+  return (g_channels == 6 && channel >= 4) ? 1.41 : 1.0;
+}
+
+static void add_block() {
+  double power = 0;
+  for (int c = 0; c < g_channels; c++) {
+    double sum = 0;
+    for (int i = 0; i < 4; i++) {
+      sum += g_recent_sums[i][c];
+    }
+    power += channel_weight(c) * sum / (4.0 * g_subblock_frames);
+  }
+  if (power <= 0) {
+    return; // i.e. digital silence, below any gate
+  }
+
+  if (g_block_count == g_block_capacity) {
+    const size_t capacity = (g_block_capacity > 0) ? 2 * g_block_capacity
+                                                   : 1024;
+    double *const blocks = realloc(g_blocks, capacity * sizeof(double));
+    if (blocks == NULL) {
+      return;
+    }
+    g_blocks = blocks;
+    g_block_capacity = capacity;
+  }
+  g_blocks[g_block_count++] = -0.691 + 10.0 * log10(power);
+}
+
+static void finish_subblock() {
+  memmove(g_recent_sums[0], g_recent_sums[1],
+          3 * sizeof(g_recent_sums[0]));
+  memcpy(g_recent_sums[3], g_subblock_sum, sizeof(g_subblock_sum));
+  memset(g_subblock_sum, 0, sizeof(g_subblock_sum));
+  g_subblock_count = 0;
+
+  if (g_recent_count < 4) {
+    g_recent_count++;
+  }
+  if (g_recent_count == 4) {
+    add_block();
+  }
+}
+
+static void add_samples(const char *buf, int frames) {
+  for (int i = 0; i < frames; i++) {
+    for (int c = 0; c < g_channels; c++) {
+      const double x =
+          pcm_sample_to_16_bit(buf, g_bits_per_sample, i * g_channels + c) /
+          32768.0;
+      if (fabs(x) > g_peak) {
+        g_peak = fabs(x);
+      }
+      if (c >= LOUDNESS_CHANNELS_MAX) {
+        continue;
+      }
+      const double y = run_k_filter(
+          &g_high_pass, g_state[c][1],
+          run_k_filter(&g_shelf, g_state[c][0], x));
+      g_subblock_sum[c] += y * y;
+    }
+    if (++g_subblock_count == g_subblock_frames) {
+      finish_subblock();
+    }
+  }
+}
+
+bool loudness_scan_finish(double *integrated_lufs, double *peak) {
+  double sum = 0;
+  size_t count = 0;
+  for (size_t i = 0; i < g_block_count; i++) {
+    if (g_blocks[i] > LOUDNESS_ABSOLUTE_GATE_LUFS) {
+      sum += pow(10.0, (g_blocks[i] + 0.691) / 10.0);
+      count++;
+    }
+  }
+  if (count == 0) {
+    g_block_count = 0;
+    return false;
+  }
+  const double relative_gate_lufs =
+      -0.691 + 10.0 * log10(sum / count) + LOUDNESS_RELATIVE_GATE_LU;
+
+  sum = 0;
+  count = 0;
+  for (size_t i = 0; i < g_block_count; i++) {
+    if (g_blocks[i] > LOUDNESS_ABSOLUTE_GATE_LUFS &&
+        g_blocks[i] > relative_gate_lufs) {
+      sum += pow(10.0, (g_blocks[i] + 0.691) / 10.0);
+      count++;
+    }
+  }
+  g_block_count = 0;
+
+  *integrated_lufs = -0.691 + 10.0 * log10(sum / count);
+  *peak = g_peak;
+  return true;
+}
+
+static void __cdecl scan_config(HWND hwndParent) {}
+
+static void __cdecl scan_about(HWND hwndParent) {}
+
+static void __cdecl scan_init() {}
+
+static void __cdecl scan_quit() {
+  free(g_blocks);
+  g_blocks = NULL;
+  g_block_count = 0;
+  g_block_capacity = 0;
+}
+
+static int __cdecl scan_open(int samplerate, int numchannels,
+                             int bitspersamp, int bufferlenms,
+                             int prebufferms) {
+  if (samplerate <= 0 || numchannels <= 0 ||
+      !pcm_bits_supported(bitspersamp)) {
+    log_error("Cannot measure %d Hz, %d channels at %d bits.", samplerate,
+              numchannels, bitspersamp);
+    return -1;
+  }
+  g_sample_rate = samplerate;
+  g_channels = numchannels;
+  g_bits_per_sample = bitspersamp;
+
+  prepare_k_filters(samplerate);
+  memset(g_state, 0, sizeof(g_state));
+  g_subblock_frames = samplerate / 10;
+  g_subblock_count = 0;
+  memset(g_subblock_sum, 0, sizeof(g_subblock_sum));
+  g_recent_count = 0;
+  g_block_count = 0;
+  g_peak = 0;
+  return 0; // i.e. no latency, like a disk writer
+}
+
+static void __cdecl scan_close() { g_sample_rate = 0; }
+
+static int __cdecl scan_write(char *buf, int len) {
+  if (g_sample_rate != 0) {
+    add_samples(buf, len / (g_channels * g_bits_per_sample / 8));
+  }
+  return 0;
+}
+
+static int __cdecl scan_can_write() {
+  return 65536; // i.e. never have the decoder wait
+}
+
+static int __cdecl scan_is_playing() {
+  return 0; // i.e. nothing is left to play after Write
+}
+
+static int __cdecl scan_pause(int pause) { return 0; }
+
+static void __cdecl scan_set_volume(int volume) {}
+
+static void __cdecl scan_set_pan(int pan) {}
+
+static void __cdecl scan_flush(int t) {}
+
+static int __cdecl scan_get_time() { return 0; }
+
+Out_Module *loudness_scan_output_module() {
+  static Out_Module out_module = {
+      OUT_VER,
+      "visdriver loudness scanner",
+      65537,
+      NULL,
+      NULL,
+      scan_config,
+      scan_about,
+      scan_init,
+      scan_quit,
+      scan_open,
+      scan_close,
+      scan_write,
+      scan_can_write,
+      scan_is_playing,
+      scan_pause,
+      scan_set_volume,
+      scan_set_pan,
+      scan_flush,
+      scan_get_time,
+      scan_get_time,
+  };
+  return &out_module;
+}
+
+double loudness_gain_db(double integrated_lufs, double peak) {
+  double gain_db = LOUDNESS_TARGET_LUFS - integrated_lufs;
+  if (peak > 0) {
+    const double headroom_db = -20.0 * log10(peak);
+    if (gain_db > headroom_db) {
+      gain_db = headroom_db;
+    }
+  }
+  return gain_db;
+}
+
+void loudness_set_gain_db(double gain_db) {
+  InterlockedExchange(&g_gain_millibel, (LONG)lround(gain_db * 100));
+}
+
+bool loudness_gain_active() { return g_gain_millibel != 0; }
+
+void loudness_apply_gain(short int *samples, int numsamples, int bps,
+                         int nch) {
+  const LONG gain_millibel = g_gain_millibel;
+  if (gain_millibel == 0) {
+    return;
+  }
+  if (bps != 16) {
+    if (!g_bps_logged) {
+      log_error("Loudness gain needs 16 bit samples, got %d bits, skipping.",
+                bps);
+      g_bps_logged = true;
+    }
+    return;
+  }
+
+  const float factor = powf(10.0f, gain_millibel / 2000.0f);
+  const int count = numsamples * nch;
+  for (int i = 0; i < count; i++) {
+    const float value = samples[i] * factor;
+    samples[i] = (value >= 32767.0f)    ? 32767
+                 : (value <= -32768.0f) ? -32768
+                                        : (short int)lrintf(value);
+  }
+}
@@ -0,0 +1,53 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <stdbool.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <winamp/out.h>
+
+#define LOUDNESS_TARGET_LUFS -18.0 // as with ReplayGain 2.0
+
+// A non-realtime output plug-in measuring the integrated loudness (EBU
+// R128, ITU-R BS.1770) and sample peak of what the input plug-in decodes,
+// as fast as it can decode it
+Out_Module *loudness_scan_output_module();
+
+// Ends the measurement of the current track; false if there was not enough
+// audio (or only silence) to tell
+bool loudness_scan_finish(double *integrated_lufs, double *peak);
+
+// Returns the gain bringing audio of the given loudness to
+// LOUDNESS_TARGET_LUFS, limited so that the peak does not clip
+double loudness_gain_db(double integrated_lufs, double peak);
+
+// Sets the gain that dsp_dosamples applies from now on, 0 for none
+void loudness_set_gain_db(double gain_db);
+
+bool loudness_gain_active();
+
+// Applies the gain to 16 bit samples in place, other sample sizes are left
+// alone
+void loudness_apply_gain(short int *samples, int numsamples, int bps,
+                         int nch);
+
+#endif // ifndef LOUDNESS_H
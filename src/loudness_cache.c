@@ -0,0 +1,228 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "log.h"
+#include "loudness_cache.h"
+
+typedef struct _loudness_entry_t {
+  char *path;
+  ULONGLONG size;
+  ULONGLONG mtime; // i.e. a FILETIME
+  double integrated_lufs;
+  double peak;
+} loudness_entry_t;
+
+static char g_filename[MAX_PATH] = "";
+static loudness_entry_t *g_entries = NULL;
+static size_t g_entry_count = 0;
+static size_t g_entry_capacity = 0;
+
+static bool add_entry(const char *path, ULONGLONG size, ULONGLONG mtime,
+                      double integrated_lufs, double peak) {
+  if (g_entry_count == g_entry_capacity) {
+    const size_t capacity =
+        (g_entry_capacity > 0) ? 2 * g_entry_capacity : 64;
+    loudness_entry_t *const entries =
+        realloc(g_entries, capacity * sizeof(loudness_entry_t));
+    if (entries == NULL) {
+      return false;
+    }
+    g_entries = entries;
+    g_entry_capacity = capacity;
+  }
+
+  const size_t path_size = strlen(path) + 1;
+  char *const path_copy = malloc(path_size);
+  if (path_copy == NULL) {
+    return false;
+  }
+  memcpy(path_copy, path, path_size);
+
+  loudness_entry_t *const entry = &g_entries[g_entry_count++];
+  entry->path = path_copy;
+  entry->size = size;
+  entry->mtime = mtime;
+  entry->integrated_lufs = integrated_lufs;
+  entry->peak = peak;
+  return true;
+}
+
+// Fills in the key of a track, false for what is not a file
+static bool get_key(const char *track, char *full_path, ULONGLONG *size,
+                    ULONGLONG *mtime) {
+  WIN32_FILE_ATTRIBUTE_DATA attributes;
+  if (!GetFileAttributesExA(track, GetFileExInfoStandard, &attributes) ||
+      (attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+    return false;
+  }
+  const DWORD length = GetFullPathNameA(track, MAX_PATH, full_path, NULL);
+  if (length == 0 || length >= MAX_PATH) {
+    return false;
+  }
+  *size = ((ULONGLONG)attributes.nFileSizeHigh << 32) |
+          attributes.nFileSizeLow;
+  *mtime = ((ULONGLONG)attributes.ftLastWriteTime.dwHighDateTime << 32) |
+           attributes.ftLastWriteTime.dwLowDateTime;
+  return true;
+}
+
+static loudness_entry_t *find_entry(const char *full_path) {
+  for (size_t i = 0; i < g_entry_count; i++) {
+    if (_stricmp(g_entries[i].path, full_path) == 0) {
+      return &g_entries[i];
+    }
+  }
+  return NULL;
+}
+
+static bool update_entry(const char *path, ULONGLONG size, ULONGLONG mtime,
+                         double integrated_lufs, double peak) {
+  loudness_entry_t *const entry = find_entry(path);
+  if (entry == NULL) {
+    return add_entry(path, size, mtime, integrated_lufs, peak);
+  }
+  entry->size = size;
+  entry->mtime = mtime;
+  entry->integrated_lufs = integrated_lufs;
+  entry->peak = peak;
+  return true;
+}
+
+// With merging, entries of the file replace those of the same path
+static bool read_entries(const char *filename, bool merging) {
+  FILE *const file = fopen(filename, "r");
+  if (file == NULL) {
+    return true; // i.e. nothing scanned yet
+  }
+
+  char line[MAX_PATH + 128];
+  int line_number = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file) != NULL) {
+    line_number++;
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0' || line[0] == '#') {
+      continue;
+    }
+
+    unsigned long long size;
+    unsigned long long mtime;
+    double integrated_lufs;
+    double peak;
+    int path_offset = 0;
+    if (sscanf(line, "%llu %llu %lf %lf %n", &size, &mtime, &integrated_lufs,
+               &peak, &path_offset) != 4 ||
+        path_offset == 0 || line[path_offset] == '\0') {
+      log_error("Line %d of \"%s\" is malformed, ignoring.", line_number,
+                filename);
+      continue;
+    }
+    const char *const path = line + path_offset;
+    ok = merging ? update_entry(path, size, mtime, integrated_lufs, peak)
+                 : add_entry(path, size, mtime, integrated_lufs, peak);
+  }
+  fclose(file);
+  return ok;
+}
+
+bool loudness_cache_load(const char *filename) {
+  snprintf(g_filename, sizeof(g_filename), "%s", filename);
+
+  const bool ok = read_entries(filename, false);
+  log_info("Loudness cache \"%s\" has %u tracks.", filename,
+           (unsigned)g_entry_count);
+  return ok;
+}
+
+bool loudness_cache_merge(const char *filename) {
+  return read_entries(filename, true);
+}
+
+bool loudness_cache_lookup(const char *track, double *integrated_lufs,
+                           double *peak) {
+  char full_path[MAX_PATH];
+  ULONGLONG size;
+  ULONGLONG mtime;
+  if (!get_key(track, full_path, &size, &mtime)) {
+    return false;
+  }
+
+  const loudness_entry_t *const entry = find_entry(full_path);
+  if (entry == NULL || entry->size != size || entry->mtime != mtime) {
+    return false;
+  }
+  *integrated_lufs = entry->integrated_lufs;
+  *peak = entry->peak;
+  return true;
+}
+
+bool loudness_cache_store(const char *track, double integrated_lufs,
+                          double peak) {
+  char full_path[MAX_PATH];
+  ULONGLONG size;
+  ULONGLONG mtime;
+  if (!get_key(track, full_path, &size, &mtime)) {
+    return false;
+  }
+
+  return update_entry(full_path, size, mtime, integrated_lufs, peak);
+}
+
+bool loudness_cache_save() {
+  char temporary_filename[MAX_PATH + 8];
+  snprintf(temporary_filename, sizeof(temporary_filename), "%s.tmp",
+           g_filename);
+
+  FILE *const file = fopen(temporary_filename, "w");
+  if (file == NULL) {
+    log_error("Could not open \"%s\" for writing.", temporary_filename);
+    return false;
+  }
+  fprintf(file, "# visdriver loudness cache: SIZE MTIME LUFS PEAK PATH\n");
+  for (size_t i = 0; i < g_entry_count; i++) {
+    const loudness_entry_t *const entry = &g_entries[i];
+    fprintf(file, "%llu %llu %.2f %.6f %s\n", (unsigned long long)entry->size,
+            (unsigned long long)entry->mtime, entry->integrated_lufs,
+            entry->peak, entry->path);
+  }
+  const bool written = !ferror(file);
+  if (fclose(file) != 0 || !written ||
+      !MoveFileExA(temporary_filename, g_filename,
+                   MOVEFILE_REPLACE_EXISTING)) {
+    log_error("Could not write \"%s\".", g_filename);
+    DeleteFileA(temporary_filename);
+    return false;
+  }
+  return true;
+}
+
+void loudness_cache_free() {
+  for (size_t i = 0; i < g_entry_count; i++) {
+    free(g_entries[i].path);
+  }
+  free(g_entries);
+  g_entries = NULL;
+  g_entry_count = 0;
+  g_entry_capacity = 0;
+}
@@ -0,0 +1,44 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef LOUDNESS_CACHE_H
+#define LOUDNESS_CACHE_H
+
+#include <stdbool.h>
+
+// Reads the cache from a text file of lines "SIZE MTIME LUFS PEAK PATH";
+// a file that does not exist yet makes for an empty cache
+bool loudness_cache_load(const char *filename);
+
+// Adds the tracks of another cache file, e.g. as written by a scan job
+bool loudness_cache_merge(const char *filename);
+
+// Entries are keyed by full path, size and modification time, so tracks
+// that changed since (or are no files at all) are not found
+bool loudness_cache_lookup(const char *track, double *integrated_lufs,
+                           double *peak);
+
+bool loudness_cache_store(const char *track, double integrated_lufs,
+                          double peak);
+
+// Replaces the file given to loudness_cache_load, by way of a temporary
+// file next to it
+bool loudness_cache_save();
+
+void loudness_cache_free();
+
+#endif // ifndef LOUDNESS_CACHE_H
@@ -0,0 +1,128 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "log.h"
+#include "loudness_jobs.h"
+
+#define LOUDNESS_JOBS_COMMAND_LINE_MAX 32768 // i.e. that of CreateProcessA
+
+static HANDLE spawn_job(const char *executable, const char *arguments,
+                        HANDLE job_object, int index) {
+  char *const command_line = malloc(LOUDNESS_JOBS_COMMAND_LINE_MAX);
+  if (command_line == NULL) {
+    return NULL;
+  }
+  const int length = snprintf(command_line, LOUDNESS_JOBS_COMMAND_LINE_MAX,
+                              "\"%s\"%s", executable, arguments);
+  if (length < 0 || length >= LOUDNESS_JOBS_COMMAND_LINE_MAX) {
+    log_error("Command line of scan job %d is too long.", index + 1);
+    free(command_line);
+    return NULL;
+  }
+
+  STARTUPINFOA startup_info;
+  memset(&startup_info, 0, sizeof(startup_info));
+  startup_info.cb = sizeof(startup_info);
+  PROCESS_INFORMATION process_information;
+  if (!CreateProcessA(NULL, command_line, NULL, NULL, FALSE, CREATE_SUSPENDED,
+                      NULL, NULL, &startup_info, &process_information)) {
+    log_error("Could not start scan job %d (error %u).", index + 1,
+              (unsigned)GetLastError());
+    free(command_line);
+    return NULL;
+  }
+  free(command_line);
+
+  // So that jobs cannot outlive us, not even if we crash
+  if (job_object != NULL &&
+      !AssignProcessToJobObject(job_object, process_information.hProcess)) {
+    log_debug("Could not add scan job %d to job object (error %u).", index + 1,
+              (unsigned)GetLastError());
+  }
+  ResumeThread(process_information.hThread);
+  CloseHandle(process_information.hThread);
+
+  log_info("Started scan job %d as process %u.", index + 1,
+           (unsigned)process_information.dwProcessId);
+  return process_information.hProcess;
+}
+
+bool loudness_jobs_run(const char *const *arguments, int count) {
+  if (count <= 0) {
+    return true;
+  }
+  if (count > MAXIMUM_WAIT_OBJECTS) {
+    log_error("Cannot run more than %d scan jobs.", MAXIMUM_WAIT_OBJECTS);
+    return false;
+  }
+
+  char executable[MAX_PATH];
+  if (GetModuleFileNameA(NULL, executable, sizeof(executable)) == 0) {
+    log_error("Could not determine own executable.");
+    return false;
+  }
+
+  const HANDLE job_object = CreateJobObjectA(NULL, NULL);
+  if (job_object != NULL) {
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits;
+    memset(&limits, 0, sizeof(limits));
+    limits.BasicLimitInformation.LimitFlags =
+        JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+    SetInformationJobObject(job_object, JobObjectExtendedLimitInformation,
+                            &limits, sizeof(limits));
+  }
+
+  HANDLE processes[MAXIMUM_WAIT_OBJECTS];
+  int indices[MAXIMUM_WAIT_OBJECTS]; // i.e. of the arguments
+  int process_count = 0;
+  bool ok = true;
+  for (int i = 0; i < count; i++) {
+    const HANDLE process = spawn_job(executable, arguments[i], job_object, i);
+    if (process == NULL) {
+      ok = false;
+      continue;
+    }
+    processes[process_count] = process;
+    indices[process_count++] = i;
+  }
+
+  if (process_count > 0) {
+    WaitForMultipleObjects(process_count, processes, TRUE, INFINITE);
+  }
+  for (int i = 0; i < process_count; i++) {
+    DWORD exit_code = 0;
+    GetExitCodeProcess(processes[i], &exit_code);
+    CloseHandle(processes[i]);
+    if (exit_code != 0) {
+      log_error("Scan job %d failed (exit code %u).", indices[i] + 1,
+                (unsigned)exit_code);
+      ok = false;
+    }
+  }
+
+  if (job_object != NULL) {
+    CloseHandle(job_object);
+  }
+  return ok;
+}
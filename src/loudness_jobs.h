@@ -0,0 +1,28 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef LOUDNESS_JOBS_H
+#define LOUDNESS_JOBS_H
+
+#include <stdbool.h>
+
+// Runs a process of our own per list of arguments (as in "--scan-loudness
+// ..."), all at the same time, and waits for all of them to finish; false
+// if any of them could not be started or failed
+bool loudness_jobs_run(const char *const *arguments, int count);
+
+#endif // ifndef LOUDNESS_JOBS_H
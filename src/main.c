@@ -17,18 +17,43 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #if !defined(_MSC_VER)
 #include <unistd.h> // usleep
 #endif
 
 #include <winamp/wa_ipc.h>
 
+#include <mmsystem.h> // timeBeginPeriod, after windows.h
+
+#include "analysis_bus.h"
+#include "audio_dsp.h"
+#include "audio_recorder.h"
 #include "config.h"
+#include "equalizer.h"
+#include "frame_capture.h"
 #include "input_plugin.h"
 #include "log.h"
+#include "loudness.h"
+#include "loudness_cache.h"
+#include "loudness_jobs.h"
 #include "main_window.h"
+#include "metrics.h"
+#include "offline_render.h"
+#include "output_buffer.h"
 #include "output_plugin.h"
+#include "output_tap.h"
+#include "plugin_proxy.h"
+#include "profiler.h"
+#include "render_watchdog.h"
+#include "resource_monitor.h"
+#include "timing.h"
+#include "virtual_clock.h"
+#include "vis_host.h"
+#include "vis_isolation.h"
 #include "vis_plugin.h"
+#include "vis_rotation.h"
 #include "visualization.h"
 
 static void sleep_milliseconds(int milliseconds) {
@@ -40,23 +65,330 @@ static void sleep_milliseconds(int milliseconds) {
 #endif
 }
 
+typedef struct _vis_plugins_t {
+  winampVisHeader *headers[CONFIG_VIS_PLUGINS_MAX];
+  HMODULE dll_handles[CONFIG_VIS_PLUGINS_MAX];
+  int count;
+} vis_plugins_t;
+
+static void unload_vis_headers(vis_plugins_t *vis_plugins) {
+  for (int i = vis_plugins->count - 1; i >= 0; i--) {
+    unload_vis_header(vis_plugins->headers[i], vis_plugins->dll_handles[i]);
+  }
+  vis_plugins->count = 0;
+}
+
+static bool start_vis_rotation(const visdriver_config_t *config,
+                               HWND main_window) {
+  if (config->rotate_schedule_filename != NULL) {
+    if (!vis_rotation_load_schedule(config->rotate_schedule_filename)) {
+      return false;
+    }
+  } else {
+    for (int i = 0; i < config->vis_plugin_count; i++) {
+      if (!vis_rotation_add(config->vis_plugin_filenames[i], 0)) {
+        return false;
+      }
+    }
+  }
+  return vis_rotation_start(main_window, config->vis_modules,
+                            config->rotate_seconds, config->trace_plugins);
+}
+
+// Loads, configures and initializes all vis plug-ins, each of them to
+// render on a thread of its own (unless taking turns, see --rotate);
+// returns 0 on success or an exit code otherwise
+static int start_vis_plugins(const visdriver_config_t *config,
+                             HWND main_window, vis_plugins_t *vis_plugins) {
+  if (config->rotate) {
+    if (!start_vis_rotation(config, main_window)) {
+      vis_rotation_stop();
+      return 6;
+    }
+    return 0;
+  }
+
+  int vis_window_count = 0;
+  for (int p = 0; p < config->vis_plugin_count; p++) {
+    const char *const vis_plugin_filename = config->vis_plugin_filenames[p];
+    log_info("Loading vis plugin \"%s\"...", vis_plugin_filename);
+    HMODULE vis_dll_handle = 0;
+    winampVisHeader *const vis_header =
+        load_vis_header(vis_plugin_filename, &vis_dll_handle);
+    if (vis_header == NULL) {
+      log_error("Vis plugin could not be loaded.");
+      unload_vis_headers(vis_plugins);
+      return 1;
+    }
+    vis_plugins->headers[vis_plugins->count] = vis_header;
+    vis_plugins->dll_handles[vis_plugins->count] = vis_dll_handle;
+    vis_plugins->count++;
+    log_info("Vis plugin is \"%s\" (API 0x%X).", vis_header->description,
+             vis_header->version);
+
+    int vis_module_indices[VIS_HOST_MODULES_MAX];
+    const int vis_module_count =
+        parse_vis_module_indices(config->vis_modules, vis_header,
+                                 vis_module_indices, VIS_HOST_MODULES_MAX);
+    if (vis_module_count <= 0) {
+      log_error("Vis module selection \"%s\" does not match any modules of "
+                "vis plugin \"%s\".",
+                config->vis_modules, vis_plugin_filename);
+      unload_vis_headers(vis_plugins);
+      return 4;
+    }
+
+    // Every module after the very first gets a window of its own
+    for (int i = 0; i < vis_module_count; i++) {
+      const int index = vis_module_indices[i];
+      const HWND container = (vis_window_count == 0)
+                                 ? main_window
+                                 : create_vis_window(vis_window_count);
+      vis_window_count++;
+      winampVisModule *const vis_module =
+          (container == NULL)
+              ? NULL
+              : load_vis_module(vis_header, index, container, vis_dll_handle);
+      if (vis_module == NULL) {
+        log_error("Vis plugin \"%s\" has no module %d.", vis_plugin_filename,
+                  index);
+      }
+      if (vis_module == NULL || !vis_host_add(vis_module, index, p)) {
+        unload_vis_headers(vis_plugins);
+        return 4;
+      }
+      log_info("Vis module %d is \"%s\".", index, vis_module->description);
+
+      if (config->trace_plugins) {
+        proxy_vis_module(vis_module);
+      }
+    }
+  }
+
+  if (!vis_host_start()) {
+    unload_vis_headers(vis_plugins);
+    return 6;
+  }
+  return 0;
+}
+
+static void stop_vis_plugins(const visdriver_config_t *config,
+                             vis_plugins_t *vis_plugins) {
+  if (config->rotate) {
+    vis_rotation_stop();
+  } else {
+    vis_host_stop();
+    unload_vis_headers(vis_plugins);
+  }
+}
+
+// Quotes every value, paths may contain spaces
+static bool append_argument(char *arguments, size_t size, const char *name,
+                            const char *value) {
+  const size_t used = strlen(arguments);
+  const int length =
+      (value == NULL)
+          ? snprintf(arguments + used, size - used, " %s", name)
+          : snprintf(arguments + used, size - used, " %s \"%s\"", name, value);
+  return length >= 0 && (size_t)length < size - used;
+}
+
+// Quotes the value, for positional arguments like tracks
+static bool append_quoted(char *arguments, size_t size, const char *value) {
+  const size_t used = strlen(arguments);
+  const int length = snprintf(arguments + used, size - used, " \"%s\"", value);
+  return length >= 0 && (size_t)length < size - used;
+}
+
+// Forwards all vis related options to the vis host process
+static bool make_vis_host_arguments(const visdriver_config_t *config,
+                                    char *arguments, size_t size) {
+  arguments[0] = '\0';
+  bool fits = append_argument(arguments, size, "--vis-host",
+                              config->analysis_bus_name) &&
+              append_argument(arguments, size, "--vis-modules",
+                              config->vis_modules);
+  for (int i = 0; fits && i < config->vis_plugin_count; i++) {
+    fits = append_argument(arguments, size, "--vis",
+                           config->vis_plugin_filenames[i]);
+  }
+  if (fits && config->rotate) {
+    char seconds[16];
+    snprintf(seconds, sizeof(seconds), "%d", config->rotate_seconds);
+    fits = append_argument(arguments, size, "--rotate", NULL) &&
+           append_argument(arguments, size, "--rotate-seconds", seconds);
+  }
+  if (fits && config->rotate_schedule_filename != NULL) {
+    fits = append_argument(arguments, size, "--rotate-schedule",
+                           config->rotate_schedule_filename);
+  }
+  if (fits && config->render_watchdog_ms > 0) {
+    char milliseconds[16];
+    snprintf(milliseconds, sizeof(milliseconds), "%d",
+             config->render_watchdog_ms);
+    fits = append_argument(arguments, size, "--render-watchdog", milliseconds);
+  }
+  if (fits && config->vis_internal_size != NULL) {
+    fits = append_argument(arguments, size, "--vis-internal-size",
+                           config->vis_internal_size);
+  }
+  if (fits && config->capture_filename != NULL) {
+    fits = append_argument(arguments, size, "--capture",
+                           config->capture_filename);
+  }
+  if (fits && config->trace_plugins) {
+    fits = append_argument(arguments, size, "--trace-plugins", NULL);
+  }
+  if (!fits) {
+    log_error("Vis host command line is too long.");
+  }
+  return fits;
+}
+
+// The vis host side of --vis-isolated (and of --vis-host in general)
+static int run_vis_host(const visdriver_config_t *config, HWND main_window) {
+  analysis_bus_t bus = {NULL, NULL, NULL};
+  if (!analysis_bus_open(&bus, config->vis_host_bus_name)) {
+    log_error("Could not open analysis bus \"%s\".",
+              config->vis_host_bus_name);
+    return 5;
+  }
+
+  vis_plugins_t vis_plugins = {{NULL}};
+  const int error = start_vis_plugins(config, main_window, &vis_plugins);
+  if (error != 0) {
+    analysis_bus_close(&bus);
+    return error;
+  }
+
+  const HANDLE quit_event =
+      vis_isolation_open_quit_event(config->vis_host_bus_name);
+  HANDLE handles[2];
+  DWORD handle_count = 0;
+  if (bus.frame_event != NULL) {
+    handles[handle_count++] = bus.frame_event;
+  }
+  if (quit_event != NULL) {
+    handles[handle_count++] = quit_event;
+  }
+  // Without an event to wait for, poll for new frames
+  const DWORD idle_timeout_ms = (bus.frame_event != NULL) ? 100 : 5;
+
+  // Frames stamped by a --wall-leader are due at a precise time, which
+  // the default timer resolution of ~15.6ms would miss by about a frame
+  timeBeginPeriod(1);
+
+  static analysis_frame_t frame; // too large for the stack
+  LONG last_frame_number = 0;
+  LONGLONG next_due_us = 0;
+  bool stamped = false; // i.e. following a --wall-leader
+  int sample_rate = 0;
+  bool running = true;
+  while (running) {
+    // The auto-reset frame event wakes only one of several followers
+    DWORD timeout_ms = stamped ? 5 : idle_timeout_ms;
+    if (next_due_us != 0) {
+      const LONGLONG wait_us = next_due_us - timing_now_us();
+      const DWORD due_in_ms =
+          (wait_us <= 0) ? 0 : (DWORD)((wait_us + 999) / 1000);
+      if (due_in_ms < timeout_ms) {
+        timeout_ms = due_in_ms;
+      }
+    }
+    MsgWaitForMultipleObjects(handle_count, handles, FALSE, timeout_ms,
+                              QS_ALLINPUT);
+
+    MSG message;
+    while (PeekMessageA(&message, NULL, 0, 0, PM_REMOVE)) {
+      TranslateMessage(&message);
+      DispatchMessage(&message);
+
+      if (message.message == WM_HOTKEY &&
+          message.wParam == VIS_ROTATION_HOTKEY_ID) {
+        vis_rotation_request_next();
+      }
+
+      if (message.message == WM_QUIT) {
+        log_debug("Window has been closed, shutting down...");
+        running = false;
+      }
+    }
+
+    if (quit_event != NULL &&
+        WaitForSingleObject(quit_event, 0) == WAIT_OBJECT_0) {
+      log_debug("Asked to quit, shutting down...");
+      running = false;
+    }
+
+    const LONG frame_number =
+        analysis_bus_read_due(&bus, timing_now_us(), &frame, &next_due_us);
+    if (frame_number != 0 && frame_number != last_frame_number) {
+      stamped = (frame.present_at_us != 0);
+      if (frame.sample_rate != sample_rate) {
+        sample_rate = frame.sample_rate;
+        vis_host_set_sample_rate(sample_rate);
+      }
+      vis_host_submit_frame(&frame);
+      last_frame_number = frame_number;
+    }
+
+    if (config->rotate) {
+      vis_rotation_tick();
+    } else {
+      vis_host_tick();
+    }
+  }
+
+  timeEndPeriod(1);
+  stop_vis_plugins(config, &vis_plugins);
+  if (quit_event != NULL) {
+    CloseHandle(quit_event);
+  }
+  analysis_bus_close(&bus);
+
+  if (config->trace_plugins) {
+    log_plugin_proxy_summary();
+  }
+  return 0;
+}
+
 static bool is_track_finished_message(const MSG *message, HWND main_window) {
   return message->hwnd == main_window && message->message == WM_WA_MPEG_EOF;
 }
 
 static void display_playback_status(In_Module *input_module,
-                                    int current_track_index, int track_count) {
+                                    int current_track_index, int track_count,
+                                    HWND main_window) {
   const int ms_current = input_module->GetOutputTime();
   const int ms_total = input_module->GetLength();
+  char position[128];
   if (ms_total <= 0) {
-    log_info("[%d/%d] At %dms of stream", current_track_index + 1, track_count,
-             ms_current);
+    snprintf(position, sizeof(position), "At %dms of stream", ms_current);
   } else {
     const int progress_percent =
         ms_total ? (int)(ms_current * 100.0 / ms_total) : 0;
-    log_info("[%d/%d] At %dms of %dms total (%d%%)", current_track_index + 1,
-             track_count, ms_current, ms_total, progress_percent);
+    snprintf(position, sizeof(position), "At %dms of %dms total (%d%%)",
+             ms_current, ms_total, progress_percent);
+  }
+
+  if (!metrics_enabled()) {
+    log_info("[%d/%d] %s", current_track_index + 1, track_count, position);
+    return;
   }
+
+  metrics_sample_t sample;
+  metrics_collect(&sample);
+
+  char line[512];
+  metrics_format_line(&sample, line, sizeof(line));
+  log_info("[%d/%d] %s; %s", current_track_index + 1, track_count, position,
+           line);
+
+  char title[128];
+  metrics_format_title(&sample, title, sizeof(title));
+  SetWindowTextA(main_window, title);
+
+  metrics_export_sample(&sample, current_track_index, ms_current, ms_total);
 }
 
 static bool start_playback(In_Module *input_module, const char *current_track,
@@ -84,6 +416,121 @@ static bool start_playback(In_Module *input_module, const char *current_track,
   return true;
 }
 
+// Stores the loudness of a track that has just been scanned to the end
+static void store_loudness(const char *track) {
+  double integrated_lufs;
+  double peak;
+  if (!loudness_scan_finish(&integrated_lufs, &peak)) {
+    log_info("\"%s\" is too short or too quiet to measure loudness.", track);
+    return;
+  }
+  log_info("\"%s\" is at %.1f LUFS with a peak of %.3f (gain %+.1f dB).",
+           track, integrated_lufs, peak,
+           loudness_gain_db(integrated_lufs, peak));
+  if (!loudness_cache_store(track, integrated_lufs, peak)) {
+    log_error("Loudness of \"%s\" cannot be cached, it is not a file.",
+              track);
+    return;
+  }
+  loudness_cache_save(); // after every track, in case of interruption
+}
+
+// Input plug-ins play one track at a time per process, so scanning in
+// parallel takes processes of our own: each scans a share of the tracks not
+// in the cache yet into a cache file of its own, merged into ours in the end
+static int run_loudness_scan_jobs(const visdriver_config_t *config) {
+  const size_t size = 32768; // i.e. the limit of CreateProcessA
+  char *arguments[CONFIG_SCAN_JOBS_MAX] = {NULL};
+  char cache_filenames[CONFIG_SCAN_JOBS_MAX][MAX_PATH];
+  bool fits = true;
+  for (int j = 0; fits && j < config->scan_jobs; j++) {
+    snprintf(cache_filenames[j], sizeof(cache_filenames[j]), "%s.%u-%d",
+             config->loudness_cache_filename, (unsigned)GetCurrentProcessId(),
+             j + 1);
+    arguments[j] = malloc(size);
+    fits = (arguments[j] != NULL);
+    if (fits) {
+      arguments[j][0] = '\0';
+      fits = append_argument(arguments[j], size, "--in",
+                             config->input_plugin_filename) &&
+             append_argument(arguments[j], size, "--scan-loudness", NULL) &&
+             append_argument(arguments[j], size, "--loudness-cache",
+                             cache_filenames[j]) &&
+             append_argument(arguments[j], size, "--", NULL);
+    }
+  }
+
+  // Round robin, so that long and short tracks spread evenly
+  int pending_count = 0;
+  for (int i = 0; fits && i < config->track_count; i++) {
+    double integrated_lufs;
+    double peak;
+    if (loudness_cache_lookup(config->tracks[i], &integrated_lufs, &peak)) {
+      continue;
+    }
+    fits = append_quoted(arguments[pending_count % config->scan_jobs], size,
+                         config->tracks[i]);
+    pending_count++;
+  }
+  const int job_count =
+      (pending_count < config->scan_jobs) ? pending_count : config->scan_jobs;
+
+  bool ok = fits;
+  if (!fits) {
+    log_error("Scan job command lines are too long.");
+  } else if (job_count > 0) {
+    log_info("Scanning %d tracks with %d jobs...", pending_count, job_count);
+    ok = loudness_jobs_run((const char *const *)arguments, job_count);
+
+    // What got scanned is kept, even if some of the jobs failed
+    for (int j = 0; j < job_count; j++) {
+      ok = loudness_cache_merge(cache_filenames[j]) && ok;
+      DeleteFileA(cache_filenames[j]);
+    }
+    ok = loudness_cache_save() && ok;
+  }
+
+  for (int j = 0; j < config->scan_jobs; j++) {
+    free(arguments[j]);
+  }
+  if (!ok) {
+    return 2;
+  }
+  log_info("Done scanning loudness.");
+  return 0;
+}
+
+// Sets the gain for a track about to be played, from the loudness cache;
+// returns false for tracks that need no scanning anymore
+static bool apply_cached_loudness(const visdriver_config_t *config,
+                                  const In_Module *input_module,
+                                  const char *current_track,
+                                  int current_track_index, int track_count) {
+  double integrated_lufs;
+  double peak;
+  const bool known =
+      loudness_cache_lookup(current_track, &integrated_lufs, &peak);
+  if (config->scan_loudness) {
+    if (known) {
+      log_info("[%d/%d] Loudness of \"%s\" is known already, skipping.",
+               current_track_index + 1, track_count, current_track);
+    }
+    return !known;
+  }
+
+  // Input plug-ins applying ReplayGain level loudness themselves
+  const bool leveling =
+      known && !(input_module->UsesOutputPlug & IN_MODULE_FLAG_REPLAYGAIN);
+  const double gain_db =
+      leveling ? loudness_gain_db(integrated_lufs, peak) : 0;
+  if (leveling) {
+    log_info("[%d/%d] Playing at %+.1f dB for %.1f LUFS.",
+             current_track_index + 1, track_count, gain_db, integrated_lufs);
+  }
+  loudness_set_gain_db(gain_db);
+  return true;
+}
+
 void self_identify() {
   log_info("==================================================================="
            "=============");
@@ -124,64 +571,184 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  // Load output plugin
-  log_info("Loading output plugin \"%s\"...", config.output_plugin_filename);
+  if (config.vis_internal_size != NULL) {
+    set_vis_internal_size(config.vis_internal_width,
+                          config.vis_internal_height);
+  }
+
+  if (config.render_watchdog_ms > 0 && !config.vis_isolated) {
+    render_watchdog_start(config.render_watchdog_ms);
+  }
+
+  // With --vis-isolated, capturing is up to the vis host
+  if (config.capture_filename != NULL && !config.vis_isolated &&
+      !frame_capture_start(config.capture_filename)) {
+    return 1;
+  }
+
+  if (config.vis_host_bus_name != NULL) {
+    const int exit_code = run_vis_host(&config, main_window);
+    frame_capture_stop();
+    render_watchdog_stop();
+    return exit_code;
+  }
+
+  if (config.profile) {
+    profiler_start();
+  }
+
+  // Vis host and we need to agree on a bus name
+  static char isolated_bus_name[64];
+  if (config.vis_isolated && config.analysis_bus_name == NULL) {
+    snprintf(isolated_bus_name, sizeof(isolated_bus_name),
+             "Local\\visdriver-%u", (unsigned)GetCurrentProcessId());
+    config.analysis_bus_name = isolated_bus_name;
+  }
+
+  if (config.loudness_cache_filename != NULL &&
+      !loudness_cache_load(config.loudness_cache_filename)) {
+    return 2;
+  }
+  if (config.scan_loudness && config.scan_jobs > 1) {
+    const int exit_code = run_loudness_scan_jobs(&config);
+    loudness_cache_free();
+    frame_capture_stop();
+    render_watchdog_stop();
+    return exit_code;
+  }
+
+  // Load output plugin (or render offline, or scan loudness)
+  if (config.scan_loudness) {
+    log_info("Scanning loudness into \"%s\"...",
+             config.loudness_cache_filename);
+  } else if (config.offline_fps > 0) {
+    take_pcm_from_elsewhere(); // i.e. from offline_render.c
+    virtual_clock_start(); // before any vis plug-in is loaded
+    vis_host_set_offline(true);
+    frame_capture_set_lossless(true);
+  } else {
+    log_info("Loading output plugin \"%s\"...",
+             config.output_plugin_filename);
+  }
   Out_Module *const output_module =
-      load_output_module(config.output_plugin_filename, main_window);
+      config.scan_loudness ? loudness_scan_output_module()
+      : (config.offline_fps > 0)
+          ? offline_render_output_module(config.offline_fps,
+                                         config.offline_audio_filename)
+          : load_output_module(config.output_plugin_filename, main_window);
   if (output_module == NULL) {
     log_error("Output plugin could not be loaded, aborting.");
     return 2;
   }
   log_info("Output plugin is \"%s\" (API 0x%x).", output_module->description,
            output_module->version, config.output_plugin_filename);
+  if (config.trace_plugins || config.metrics) {
+    proxy_output_module(output_module); // also needed for metrics
+  }
+  if (config.out_buffer_ms > 0) {
+    // After the proxy, so that tracing and metrics see the real device
+    buffer_output_module(output_module, config.out_buffer_ms);
+  }
+  if (config.tap_output) {
+    take_pcm_from_elsewhere();
+    tap_output_module(output_module); // i.e. where the input plug-in writes
+  }
+  if (config.record_filename != NULL) {
+    record_output_module(output_module, config.record_filename);
+  }
   output_module->Init();
 
+  if (config.metrics &&
+      !metrics_init(config.metrics_filename, output_module)) {
+    unload_output_module(output_module);
+    return 2;
+  }
+
+  // Load DSP plugins, used by the input plugin
+  if (!load_dsp_plugins(config.dsp_plugin_filenames, config.dsp_plugin_count,
+                        main_window)) {
+    log_error("DSP plugin could not be loaded, aborting.");
+    unload_output_module(output_module);
+    return 7;
+  }
+
   // Load input plugin
   log_info("Loading input plugin \"%s\"...", config.input_plugin_filename);
   In_Module *const input_module = load_input_module(
       config.input_plugin_filename, main_window, output_module);
   if (input_module == NULL) {
     log_error("Input plugin could not be loaded, aborting.");
+    unload_dsp_plugins();
     unload_output_module(output_module);
     return 3;
   }
   log_info("Input plugin is \"%s\" (API 0x%x, flags 0x%x).",
            input_module->description, (unsigned)input_module->version,
            (unsigned)input_module->UsesOutputPlug);
+  if (config.trace_plugins) {
+    proxy_input_module(input_module);
+  }
   input_module->Init();
 
-  // Load vis plugin
-  log_info("Loading vis plugin \"%s\"...", config.vis_plugin_filename);
-  HMODULE vis_dll_handle = 0;
-  winampVisHeader *const vis_header =
-      load_vis_header(config.vis_plugin_filename, &vis_dll_handle);
-  if (vis_header == NULL) {
-    log_error("Vis plugin could not be loaded.");
-    unload_input_module(input_module);
-    unload_output_module(output_module);
-    return 1;
+  if (config.eq != NULL || config.eq_preamp_db != 0) {
+    equalizer_configure(config.eq_gains_db, config.eq_preamp_db);
+    if ((input_module->UsesOutputPlug & IN_MODULE_FLAG_EQ) &&
+        input_module->EQSet != NULL) {
+      char data[EQUALIZER_BANDS];
+      int preamp;
+      equalizer_to_winamp(data, &preamp);
+      input_module->EQSet(1, data, preamp); // i.e. it equalizes itself
+    } else {
+      equalizer_enable(true); // i.e. in dsp_dosamples
+    }
   }
-  log_info("Vis plugin is \"%s\" (API 0x%X).", vis_header->description,
-           vis_header->version);
-  winampVisModule *const vis_module =
-      load_vis_module(vis_header, 0, main_window, vis_dll_handle);
-  if (vis_module == NULL) {
-    log_error("Vis plugin \"%s\" has no modules.", config.vis_plugin_filename);
-    unload_vis_header(vis_header, vis_dll_handle);
+
+  if (config.loudness_cache_filename != NULL && !config.scan_loudness &&
+      (input_module->UsesOutputPlug & IN_MODULE_FLAG_REPLAYGAIN)) {
+    log_info("Input plugin applies ReplayGain, leaving loudness to it.");
+  }
+
+  if (config.analysis_bus_name != NULL &&
+      !open_analysis_bus(config.analysis_bus_name)) {
     unload_input_module(input_module);
+    unload_dsp_plugins();
     unload_output_module(output_module);
-    return 4;
+    return 5;
+  }
+  if (config.wall_leader) {
+    set_playback_clock(input_module->GetOutputTime);
   }
 
-  // Configure vis plugin
-  g_active_vis_module = vis_module;
-  vis_module->Config(vis_module);
-  vis_module->Init(vis_module);
+  // Load vis plugins (or have a separate process take care of them)
+  vis_plugins_t vis_plugins = {{NULL}};
+  if (config.vis_isolated) {
+    char arguments[2048];
+    if (!make_vis_host_arguments(&config, arguments, sizeof(arguments)) ||
+        !vis_isolation_start(config.analysis_bus_name, arguments)) {
+      close_analysis_bus();
+      unload_input_module(input_module);
+      unload_dsp_plugins();
+      unload_output_module(output_module);
+      return 6;
+    }
+  } else if (!config.wall_leader && // i.e. a leader without a screen
+             !config.scan_loudness) {
+    const int error = start_vis_plugins(&config, main_window, &vis_plugins);
+    if (error != 0) {
+      close_analysis_bus();
+      unload_input_module(input_module);
+      unload_dsp_plugins();
+      unload_output_module(output_module);
+      return error;
+    }
+  }
 
   // Main loop
   MSG message = {NULL};
   bool running = true;
   ULONGLONG last_stat_dump_at_ms = 0;
+  ULONGLONG last_trace_dump_at_ms = GetTickCount64();
+  ULONGLONG last_resource_sample_at_ms = 0;
 
   while (running) {
     bool needs_playback_action = !playing;
@@ -195,6 +762,11 @@ int main(int argc, char **argv) {
         needs_playback_action = true;
       }
 
+      if (message.message == WM_HOTKEY &&
+          message.wParam == VIS_ROTATION_HOTKEY_ID) {
+        vis_rotation_request_next();
+      }
+
       if (message.message == WM_QUIT) {
         log_debug("Window has been closed, shutting down...");
         running = false;
@@ -203,13 +775,31 @@ int main(int argc, char **argv) {
 
     // Start to play (at all or the next track)
     if (needs_playback_action) {
+      if (config.scan_loudness && playing) {
+        store_loudness(config.tracks[current_track_index]);
+        playing = false;
+      }
+
       current_track_index++;
+      if (current_track_index >= config.track_count &&
+          (config.offline_fps > 0 || config.scan_loudness)) {
+        log_info(config.scan_loudness ? "Done scanning loudness."
+                                      : "Done rendering offline.");
+        running = false;
+        continue;
+      }
       if (current_track_index >= config.track_count) {
         current_track_index = 0; // i.e. loop the playlist
       }
 
       const char *const current_track = config.tracks[current_track_index];
 
+      if (config.loudness_cache_filename != NULL &&
+          !apply_cached_loudness(&config, input_module, current_track,
+                                 current_track_index, config.track_count)) {
+        continue; // i.e. scanned already, on to the next track
+      }
+
       if (start_playback(input_module, current_track, current_track_index,
                          config.track_count)) {
         playing = true;
@@ -224,11 +814,45 @@ int main(int argc, char **argv) {
       const ULONGLONG time_elapsed_ms = (now_ms - last_stat_dump_at_ms);
       if (time_elapsed_ms >= 1000) {
         display_playback_status(input_module, current_track_index,
-                                config.track_count);
+                                config.track_count, main_window);
         last_stat_dump_at_ms = now_ms;
       }
     }
 
+    // Display plug-in call statistics and profile roughly once per ten
+    // seconds
+    if (config.trace_plugins || config.profile) {
+      const ULONGLONG now_ms = GetTickCount64();
+      if (now_ms - last_trace_dump_at_ms >= 10000) {
+        if (config.trace_plugins) {
+          log_plugin_proxy_summary();
+        }
+        if (config.profile) {
+          log_profiler_summary();
+        }
+        last_trace_dump_at_ms = now_ms;
+      }
+    }
+
+    // Sample resource usage roughly once per ten seconds
+    if (config.monitor_resources) {
+      const ULONGLONG now_ms = GetTickCount64();
+      if (now_ms - last_resource_sample_at_ms >= 10000) {
+        resource_monitor_sample();
+        last_resource_sample_at_ms = now_ms;
+      }
+    }
+
+    if (config.vis_isolated) {
+      if (!vis_isolation_tick()) {
+        running = false;
+      }
+    } else if (config.rotate) {
+      vis_rotation_tick();
+    } else {
+      vis_host_tick();
+    }
+
     sleep_milliseconds(1); // to avoid 100% CPU usage
   }
 
@@ -239,10 +863,31 @@ int main(int argc, char **argv) {
     playing = false;
   }
 
-  unload_vis_module(vis_module);
-  unload_vis_header(vis_header, vis_dll_handle);
+  if (config.profile) {
+    // Before unloading, so that addresses can still be attributed
+    profiler_stop();
+    log_profiler_summary();
+  }
+
+  if (config.vis_isolated) {
+    vis_isolation_stop();
+  } else {
+    stop_vis_plugins(&config, &vis_plugins);
+  }
+  frame_capture_stop();
+  render_watchdog_stop();
   unload_input_module(input_module);
+  unload_dsp_plugins();
   unload_output_module(output_module);
 
+  close_analysis_bus();
+  loudness_cache_free();
+
+  if (config.trace_plugins) {
+    log_plugin_proxy_summary();
+  }
+
+  metrics_shutdown();
+
   return 0;
 }
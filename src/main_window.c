@@ -15,15 +15,38 @@
 // You should have received a copy of the GNU General Public License along
 // with visdriver. If not, see <https://www.gnu.org/licenses/>.
 
+#include <stdbool.h>
 #include <stdio.h>
+#include <string.h> // memset
 
 #include <winamp/wa_ipc.h>
 
 #include "log.h"
 #include "main_window.h"
 
+#ifndef PW_RENDERFULLCONTENT
+#define PW_RENDERFULLCONTENT 0x00000002 // Windows >=8.1, also captures DirectX
+#endif
+
+#define VIS_STAGES_MAX 16
+
+// With an internal size, plug-ins render into a stage window of that size
+// that is (almost) transparent, and every frame is scaled up into the
+// window that the plug-in was given, the presenter
+typedef struct _vis_stage_t {
+  HWND presenter; // NULL for a free entry, see release_stage
+  HWND stage;
+  HDC capture_dc; // only used by the presenting render thread
+  HBITMAP capture_bitmap;
+} vis_stage_t;
+
 HWND g_main_window;
-static HWND g_vis_window = NULL;
+static HWND g_embed_target = NULL;
+static const char *const g_window_class_name = "hello";
+static int g_internal_width = 0; // i.e. render at full size
+static int g_internal_height = 0;
+static vis_stage_t g_stages[VIS_STAGES_MAX];
+static volatile LONG g_stage_count = 0; // i.e. entries ever used
 
 #define MESSAGE_CASE(hex, dec, name)                                           \
   case name:                                                                   \
@@ -296,14 +319,140 @@ static void log_window_proc_message(HWND window, UINT message, WPARAM wparam,
               message_name_of(message), message, wparam, lparam);
 }
 
-static HWND embed_window(embedWindowState *state) { return g_main_window; }
+static HWND embed_window(embedWindowState *state) { return g_embed_target; }
+
+// Every container window remembers the vis window embedded into it
+static HWND get_embedded_window(HWND container) {
+  return (HWND)GetWindowLongPtrA(container, GWLP_USERDATA);
+}
+
+// Returns NULL for windows presenting at full size
+static vis_stage_t *find_stage(HWND presenter) {
+  const LONG stage_count = g_stage_count;
+  MemoryBarrier(); // i.e. read the count before the entries
+  for (LONG i = 0; i < stage_count; i++) {
+    if (g_stages[i].presenter == presenter) {
+      return &g_stages[i];
+    }
+  }
+  return NULL;
+}
+
+// Called from the main thread only
+static vis_stage_t *find_free_stage() {
+  for (LONG i = 0; i < g_stage_count; i++) {
+    if (g_stages[i].presenter == NULL) {
+      return &g_stages[i];
+    }
+  }
+  return NULL;
+}
+
+static HWND create_stage_window(HWND presenter) {
+  POINT origin = {0, 0};
+  ClientToScreen(presenter, &origin);
+
+  const HWND window = CreateWindowExA(
+      WS_EX_LAYERED | WS_EX_TRANSPARENT | WS_EX_TOOLWINDOW | WS_EX_NOACTIVATE,
+      g_window_class_name, NULL, WS_POPUP | WS_CLIPCHILDREN, origin.x,
+      origin.y, g_internal_width, g_internal_height,
+      GetAncestor(presenter, GA_ROOT), 0, 0, NULL);
+  if (window == 0) {
+    log_error("CreateWindowExA failed.");
+    return 0;
+  }
+
+  // Not fully transparent, so that it keeps being composited
+  SetLayeredWindowAttributes(window, 0, 1, LWA_ALPHA);
+  ShowWindow(window, SW_SHOWNOACTIVATE);
+  return window;
+}
+
+// Called from the main thread only
+static HWND get_or_create_stage_window(HWND presenter) {
+  const vis_stage_t *const existing = find_stage(presenter);
+  if (existing != NULL) {
+    return existing->stage;
+  }
+
+  // Entries of destroyed presenters are re-used, see release_stage
+  vis_stage_t *entry = find_free_stage();
+  if (entry == NULL && g_stage_count >= VIS_STAGES_MAX) {
+    log_error("Too many vis windows to render at internal size.");
+    return presenter;
+  }
+
+  const HWND stage = create_stage_window(presenter);
+  if (stage == 0) {
+    return presenter;
+  }
+  const bool appending = (entry == NULL);
+  if (appending) {
+    entry = &g_stages[g_stage_count];
+  }
+  entry->stage = stage;
+  entry->capture_dc = NULL;
+  entry->capture_bitmap = NULL;
+  MemoryBarrier(); // i.e. publish the entry before its presenter
+  entry->presenter = presenter;
+  if (appending) {
+    MemoryBarrier(); // i.e. publish the entry before the count
+    InterlockedIncrement(&g_stage_count);
+  }
+  return stage;
+}
+
+// Called from the main thread only, once the presenter is being destroyed
+// (e.g. by vis rotation), i.e. once no render thread presents to it anymore
+static void release_stage(HWND presenter) {
+  vis_stage_t *const entry = find_stage(presenter);
+  if (entry == NULL) {
+    return;
+  }
+  entry->presenter = NULL;
+  MemoryBarrier(); // i.e. unpublish the entry before tearing it down
+  DestroyWindow(entry->stage);
+  entry->stage = NULL;
+  if (entry->capture_bitmap != NULL) {
+    DeleteObject(entry->capture_bitmap);
+    entry->capture_bitmap = NULL;
+  }
+  if (entry->capture_dc != NULL) {
+    DeleteDC(entry->capture_dc);
+    entry->capture_dc = NULL;
+  }
+}
+
+// Called from the main thread only; stages are popups of their own, so they
+// need to follow their presenters whenever the top-level window moves
+static void move_stage_windows(HWND root) {
+  for (LONG i = 0; i < g_stage_count; i++) {
+    const vis_stage_t *const entry = &g_stages[i];
+    if (entry->presenter == NULL ||
+        GetAncestor(entry->presenter, GA_ROOT) != root) {
+      continue;
+    }
+    POINT origin = {0, 0};
+    ClientToScreen(entry->presenter, &origin);
+    SetWindowPos(entry->stage, NULL, origin.x, origin.y, 0, 0,
+                 SWP_NOSIZE | SWP_NOZORDER | SWP_NOACTIVATE);
+  }
+}
 
 static void resize_embedded_window(HWND embedded, HWND container) {
+  if (find_stage(container) != NULL) {
+    // The embedded window lives in the stage, at internal size
+    SetWindowPos(embedded, NULL, 0, 0, g_internal_width, g_internal_height,
+                 SWP_ASYNCWINDOWPOS);
+    return;
+  }
+
   RECT rect;
   if (GetClientRect(container, &rect)) {
     const LONG width = rect.right - rect.left;
     const LONG height = rect.bottom - rect.top;
-    SetWindowPos(embedded, NULL, 0, 0, width, height, 0);
+    // Asynchronous, the embedded window's thread may be busy (or hung)
+    SetWindowPos(embedded, NULL, 0, 0, width, height, SWP_ASYNCWINDOWPOS);
   }
 }
 
@@ -312,19 +461,33 @@ static LRESULT __stdcall main_window_proc(HWND window, UINT message,
   log_window_proc_message(window, message, wparam, lparam);
 
   switch (message) {
-  case WM_DESTROY:
-    PostQuitMessage(0);
+  case WM_CLOSE:
+    // Additional vis windows must outlive their modules, only hide them
+    if (window != g_main_window) {
+      ShowWindow(window, SW_HIDE);
+      return 0;
+    }
     break;
 
-  case WM_SIZING:
-    if (window == g_main_window && g_vis_window != NULL) {
-      resize_embedded_window(g_vis_window, g_main_window);
+  case WM_DESTROY:
+    if (window == g_main_window) {
+      PostQuitMessage(0);
     }
+    release_stage(window);
     break;
 
+  case WM_MOVE:
+    move_stage_windows(GetAncestor(window, GA_ROOT));
+    break;
+
+  case WM_SIZING:
   case WM_SIZE: {
-    if (g_vis_window != NULL) {
-      resize_embedded_window(g_vis_window, g_main_window);
+    const HWND embedded = get_embedded_window(window);
+    if (embedded != NULL) {
+      resize_embedded_window(embedded, window);
+    }
+    if (message == WM_SIZE) {
+      move_stage_windows(GetAncestor(window, GA_ROOT));
     }
     break;
   }
@@ -355,7 +518,12 @@ static LRESULT __stdcall main_window_proc(HWND window, UINT message,
       return (LRESULT)ini_path;
     }
     case IPC_GET_EMBEDIF: // == 505
-      ShowWindow(g_main_window, SW_SHOW);
+      // Plug-ins ask the window they were given as parent (hwndParent), so
+      // that is where their embedded window belongs
+      g_embed_target = (g_internal_width > 0)
+                           ? get_or_create_stage_window(window)
+                           : window;
+      ShowWindow(GetAncestor(window, GA_ROOT), SW_SHOW);
       if (wparam == 0) {
         return (LRESULT)embed_window;
       } else {
@@ -364,8 +532,8 @@ static LRESULT __stdcall main_window_proc(HWND window, UINT message,
       break;
 
     case IPC_SETVISWND: // == 611
-      g_vis_window = (HWND)wparam;
-      resize_embedded_window(g_vis_window, g_main_window);
+      SetWindowLongPtrA(window, GWLP_USERDATA, (LONG_PTR)wparam);
+      resize_embedded_window((HWND)wparam, window);
       break;
     }
   }
@@ -373,9 +541,41 @@ static LRESULT __stdcall main_window_proc(HWND window, UINT message,
   return DefWindowProcA(window, message, wparam, lparam);
 }
 
-HWND create_main_window() {
-  static const char *const window_class_name = "hello";
+static HWND create_container_window(int cascade_index) {
+  // Center the window on the primary screen, cascading additional ones
+  const int window_width = 320;
+  const int window_height = 240;
+  const int primary_screen_width = GetSystemMetrics(SM_CXSCREEN);
+  const int primary_screen_height = GetSystemMetrics(SM_CYSCREEN);
+  const int cascade_offset = 32 * cascade_index;
+  const int window_left =
+      (primary_screen_width - window_width) / 2 + cascade_offset;
+  const int window_top =
+      (primary_screen_height - window_height) / 2 + cascade_offset;
+
+  const HWND window =
+      CreateWindowExA(0,                   // [in]           DWORD    dwExStyle,
+                      g_window_class_name, // [in, optional] LPCSTR lpClassName,
+                      NULL,           // [in, optional] LPCSTR    lpWindowName,
+                      WS_TILEDWINDOW, // [in]           DWORD     dwStyle,
+                      window_left,    // [in]           int       X,
+                      window_top,     // [in]           int       Y,
+                      window_width,   // [in]           int       nWidth,
+                      window_height,  // [in]           int       nHeight,
+                      0,              // [in, optional] HWND      hWndParent,
+                      0,              // [in, optional] HMENU     hMenu,
+                      0,              // [in, optional] HINSTANCE hInstance,
+                      NULL            // [in, optional] LPVOID    lpParam
+      );
+  if (window == 0) {
+    log_error("CreateWindowExA failed.");
+    return 0;
+  }
+
+  return window;
+}
 
+HWND create_main_window() {
   WNDCLASSEXA window_class_ex = {
       sizeof(WNDCLASSEXA), // UINT      cbSize;
       0,                   // UINT      style;
@@ -387,7 +587,7 @@ HWND create_main_window() {
       0,                   // HCURSOR   hCursor;
       0,                   // HBRUSH    hbrBackground;
       NULL,                // LPCSTR    lpszMenuName;
-      window_class_name,   // LPCSTR    lpszClassName;
+      g_window_class_name, // LPCSTR    lpszClassName;
       0,                   // HICON     hIconSm;
   };
 
@@ -397,30 +597,8 @@ HWND create_main_window() {
     return 0;
   }
 
-  // Center the window on the primary screen
-  const int window_width = 320;
-  const int window_height = 240;
-  const int primary_screen_width = GetSystemMetrics(SM_CXSCREEN);
-  const int primary_screen_height = GetSystemMetrics(SM_CYSCREEN);
-  const int window_left = (primary_screen_width - window_width) / 2;
-  const int window_top = (primary_screen_height - window_height) / 2;
-
-  const HWND window =
-      CreateWindowExA(0,                 // [in]           DWORD    dwExStyle,
-                      window_class_name, // [in, optional] LPCSTR lpClassName,
-                      NULL,           // [in, optional] LPCSTR    lpWindowName,
-                      WS_TILEDWINDOW, // [in]           DWORD     dwStyle,
-                      window_left,    // [in]           int       X,
-                      window_top,     // [in]           int       Y,
-                      window_width,   // [in]           int       nWidth,
-                      window_height,  // [in]           int       nHeight,
-                      0,              // [in, optional] HWND      hWndParent,
-                      0,              // [in, optional] HMENU     hMenu,
-                      0,              // [in, optional] HINSTANCE hInstance,
-                      NULL            // [in, optional] LPVOID    lpParam
-      );
+  const HWND window = create_container_window(0);
   if (window == 0) {
-    log_error("CreateWindowExA failed.");
     return 0;
   }
 
@@ -430,3 +608,96 @@ HWND create_main_window() {
 
   return window;
 }
+
+HWND create_vis_window(int index) { return create_container_window(index); }
+
+HWND create_vis_slot_window(HWND parent) {
+  RECT rect = {0, 0, 0, 0};
+  GetClientRect(parent, &rect);
+
+  const HWND window = CreateWindowExA(
+      0, g_window_class_name, NULL, WS_CHILD | WS_CLIPCHILDREN, 0, 0,
+      rect.right - rect.left, rect.bottom - rect.top, parent, 0, 0, NULL);
+  if (window == 0) {
+    log_error("CreateWindowExA failed.");
+    return 0;
+  }
+  return window;
+}
+
+void activate_vis_slot_window(HWND slot) {
+  const HWND parent = GetParent(slot);
+  const HWND previous = get_embedded_window(parent);
+
+  SetWindowLongPtrA(parent, GWLP_USERDATA, (LONG_PTR)slot);
+  resize_embedded_window(slot, parent);
+  ShowWindow(slot, SW_SHOW);
+  if (previous != NULL && previous != slot) {
+    ShowWindowAsync(previous, SW_HIDE);
+  }
+}
+
+void set_vis_internal_size(int width, int height) {
+  g_internal_width = width;
+  g_internal_height = height;
+}
+
+static bool create_capture_bitmap(vis_stage_t *stage) {
+  BITMAPINFO info;
+  memset(&info, 0, sizeof(info));
+  info.bmiHeader.biSize = sizeof(info.bmiHeader);
+  info.bmiHeader.biWidth = g_internal_width;
+  info.bmiHeader.biHeight = -g_internal_height; // i.e. top-down
+  info.bmiHeader.biPlanes = 1;
+  info.bmiHeader.biBitCount = 32;
+  info.bmiHeader.biCompression = BI_RGB;
+
+  void *pixels = NULL;
+  stage->capture_dc = CreateCompatibleDC(NULL);
+  stage->capture_bitmap =
+      CreateDIBSection(NULL, &info, DIB_RGB_COLORS, &pixels, NULL, 0);
+  if (stage->capture_dc == NULL || stage->capture_bitmap == NULL) {
+    log_error("Could not create %dx%d capture bitmap.", g_internal_width,
+              g_internal_height);
+    if (stage->capture_bitmap != NULL) {
+      DeleteObject(stage->capture_bitmap);
+      stage->capture_bitmap = NULL;
+    }
+    if (stage->capture_dc != NULL) {
+      DeleteDC(stage->capture_dc);
+      stage->capture_dc = NULL;
+    }
+    return false;
+  }
+  SelectObject(stage->capture_dc, stage->capture_bitmap);
+  return true;
+}
+
+void present_vis_window(HWND presenter) {
+  vis_stage_t *const stage = find_stage(presenter);
+  if (stage == NULL) {
+    return;
+  }
+  if (stage->capture_dc == NULL && !create_capture_bitmap(stage)) {
+    return;
+  }
+
+  if (!PrintWindow(stage->stage, stage->capture_dc,
+                   PW_CLIENTONLY | PW_RENDERFULLCONTENT)) {
+    return;
+  }
+
+  RECT rect;
+  if (!GetClientRect(presenter, &rect)) {
+    return;
+  }
+  const HDC dc = GetDC(presenter);
+  if (dc == NULL) {
+    return;
+  }
+  SetStretchBltMode(dc, COLORONCOLOR); // i.e. speed over quality
+  StretchBlt(dc, 0, 0, rect.right - rect.left, rect.bottom - rect.top,
+             stage->capture_dc, 0, 0, g_internal_width, g_internal_height,
+             SRCCOPY);
+  ReleaseDC(presenter, dc);
+}
@@ -25,4 +25,23 @@ extern HWND g_main_window;
 
 HWND create_main_window();
 
+// Creates an additional container window for hosting one more vis module;
+// requires a prior call to create_main_window
+HWND create_vis_window(int index);
+
+// Creates a hidden child window that a vis plug-in can embed into while
+// another one is still showing, see activate_vis_slot_window
+HWND create_vis_slot_window(HWND parent);
+
+// Shows the slot window (filling its parent) and hides the previous one
+void activate_vis_slot_window(HWND slot);
+
+// Has vis plug-ins embedding from now on render at this size rather than
+// that of their window, see present_vis_window
+void set_vis_internal_size(int width, int height);
+
+// Scales the latest frame rendered at internal size up into the window
+// given to the vis plug-in as hwndParent; no-op without an internal size
+void present_vis_window(HWND presenter);
+
 #endif // ifndef MAIN_WINDOW_H
@@ -0,0 +1,224 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+
+#include "histogram.h"
+#include "log.h"
+#include "metrics.h"
+#include "timing.h"
+
+static bool g_metrics_enabled = false;
+static FILE *g_json_file = NULL;
+static Out_Module *g_output_module = NULL;
+
+static histogram_t g_pcm_interval_us;
+static histogram_t g_analysis_us;
+static histogram_t g_render_us;
+static LONGLONG g_last_pcm_block_at_us = 0;
+static volatile LONG g_av_drift_ms = 0;
+static volatile LONG g_renders = 0;
+static volatile LONG g_dropped_frames = 0;
+static LONGLONG g_last_collect_at_us = 0;
+static LONGLONG g_started_at_us = 0;
+
+// For detection of the output buffer running dry
+static volatile LONG g_underruns = 0;
+static volatile LONG g_max_can_write = 0;
+static volatile LONG g_written_since_reset = 0;
+static volatile LONG g_starving = 0;
+
+bool metrics_init(const char *json_filename, Out_Module *output_module) {
+  if (json_filename != NULL) {
+    g_json_file = fopen(json_filename, "a");
+    if (g_json_file == NULL) {
+      log_error("Could not open metrics file \"%s\" for appending.",
+                json_filename);
+      return false;
+    }
+  }
+
+  g_output_module = output_module;
+  g_started_at_us = timing_now_us();
+  g_last_collect_at_us = g_started_at_us;
+  g_metrics_enabled = true;
+  return true;
+}
+
+void metrics_shutdown() {
+  g_metrics_enabled = false;
+  if (g_json_file != NULL) {
+    fclose(g_json_file);
+    g_json_file = NULL;
+  }
+}
+
+bool metrics_enabled() { return g_metrics_enabled; }
+
+LONGLONG metrics_uptime_ms() {
+  return (timing_now_us() - g_started_at_us) / 1000;
+}
+
+void metrics_note_pcm_block(int timestamp_ms) {
+  if (!g_metrics_enabled) {
+    return;
+  }
+
+  const LONGLONG now_us = timing_now_us();
+  if (g_last_pcm_block_at_us != 0) {
+    histogram_add(&g_pcm_interval_us, now_us - g_last_pcm_block_at_us);
+  }
+  g_last_pcm_block_at_us = now_us;
+
+  if (g_output_module != NULL) {
+    InterlockedExchange(&g_av_drift_ms,
+                        timestamp_ms - g_output_module->GetOutputTime());
+  }
+}
+
+void metrics_note_analysis(LONGLONG duration_us) {
+  if (g_metrics_enabled) {
+    histogram_add(&g_analysis_us, duration_us);
+  }
+}
+
+void metrics_note_render(LONGLONG duration_us) {
+  if (g_metrics_enabled) {
+    histogram_add(&g_render_us, duration_us);
+    InterlockedIncrement(&g_renders);
+  }
+}
+
+void metrics_note_dropped_frame() {
+  if (g_metrics_enabled) {
+    InterlockedIncrement(&g_dropped_frames);
+  }
+}
+
+void metrics_note_output_reset() {
+  // Open and Flush leave us with an empty buffer for good reasons
+  InterlockedExchange(&g_max_can_write, 0);
+  InterlockedExchange(&g_written_since_reset, 0);
+  InterlockedExchange(&g_starving, 0);
+}
+
+void metrics_note_can_write(int bytes_free) {
+  if (!g_metrics_enabled) {
+    return;
+  }
+
+  if (bytes_free > g_max_can_write) {
+    InterlockedExchange(&g_max_can_write, bytes_free);
+  }
+  if (!g_written_since_reset) {
+    return;
+  }
+
+  // With all of the buffer writable again, the output must have drained
+  // completely before the input plug-in got to refill it.
+  const LONG starving = (bytes_free >= g_max_can_write) ? 1 : 0;
+  if (starving && !g_starving) {
+    InterlockedIncrement(&g_underruns);
+  }
+  InterlockedExchange(&g_starving, starving);
+}
+
+void metrics_note_write() {
+  if (g_metrics_enabled) {
+    InterlockedExchange(&g_written_since_reset, 1);
+  }
+}
+
+void metrics_collect(metrics_sample_t *sample) {
+  const LONGLONG now_us = timing_now_us();
+  const LONGLONG elapsed_us = now_us - g_last_collect_at_us;
+  g_last_collect_at_us = now_us;
+
+  sample->buffer_depth_ms = 0;
+  if (g_output_module != NULL) {
+    sample->buffer_depth_ms =
+        g_output_module->GetWrittenTime() - g_output_module->GetOutputTime();
+  }
+  sample->av_drift_ms = g_av_drift_ms;
+  sample->underruns = g_underruns;
+  sample->dropped_frames = g_dropped_frames;
+
+  // Decode and render threads keep adding while we look
+  histogram_t pcm_interval_us;
+  histogram_t analysis_us;
+  histogram_t render_us;
+  histogram_drain(&g_pcm_interval_us, &pcm_interval_us);
+  histogram_drain(&g_analysis_us, &analysis_us);
+  histogram_drain(&g_render_us, &render_us);
+  sample->pcm_interval_p50_us = (int)histogram_percentile(&pcm_interval_us, 50);
+  sample->pcm_interval_p99_us = (int)histogram_percentile(&pcm_interval_us, 99);
+  sample->analysis_p50_us = (int)histogram_percentile(&analysis_us, 50);
+  sample->analysis_p99_us = (int)histogram_percentile(&analysis_us, 99);
+  sample->render_p50_us = (int)histogram_percentile(&render_us, 50);
+  sample->render_p99_us = (int)histogram_percentile(&render_us, 99);
+
+  const LONG renders = InterlockedExchange(&g_renders, 0);
+  sample->render_fps =
+      (elapsed_us > 0) ? (renders * 1000000.0 / elapsed_us) : 0.0;
+}
+
+void metrics_format_line(const metrics_sample_t *sample, char *text,
+                         size_t size) {
+  snprintf(text, size,
+           "buffer %dms, %ld underruns, drift %+dms, PCM every %d/%dus, "
+           "analysis %d/%dus, render %d/%dus, %.1f fps, %ld dropped",
+           sample->buffer_depth_ms, sample->underruns, sample->av_drift_ms,
+           sample->pcm_interval_p50_us, sample->pcm_interval_p99_us,
+           sample->analysis_p50_us, sample->analysis_p99_us,
+           sample->render_p50_us, sample->render_p99_us, sample->render_fps,
+           sample->dropped_frames);
+}
+
+void metrics_format_title(const metrics_sample_t *sample, char *text,
+                          size_t size) {
+  snprintf(text, size, "visdriver - %.0f fps - %dms buffer - %ld dropped",
+           sample->render_fps, sample->buffer_depth_ms,
+           sample->dropped_frames);
+}
+
+void metrics_export_line(const char *json_object) {
+  if (g_json_file == NULL) {
+    return;
+  }
+  fprintf(g_json_file, "%s\n", json_object);
+  fflush(g_json_file);
+}
+
+void metrics_export_sample(const metrics_sample_t *sample, int track_index,
+                           int position_ms, int length_ms) {
+  char line[1024];
+  snprintf(line, sizeof(line),
+           "{\"type\": \"pipeline\", \"uptime_ms\": %.0f, \"track\": %d, "
+           "\"position_ms\": %d, \"length_ms\": %d, \"buffer_depth_ms\": %d, "
+           "\"underruns\": %ld, \"av_drift_ms\": %d, "
+           "\"pcm_interval_us\": {\"p50\": %d, \"p99\": %d}, "
+           "\"analysis_us\": {\"p50\": %d, \"p99\": %d}, "
+           "\"render_us\": {\"p50\": %d, \"p99\": %d}, "
+           "\"render_fps\": %.2f, \"dropped_frames\": %ld}",
+           (double)metrics_uptime_ms(), track_index + 1, position_ms,
+           length_ms, sample->buffer_depth_ms, sample->underruns,
+           sample->av_drift_ms, sample->pcm_interval_p50_us,
+           sample->pcm_interval_p99_us, sample->analysis_p50_us,
+           sample->analysis_p99_us, sample->render_p50_us,
+           sample->render_p99_us, sample->render_fps, sample->dropped_frames);
+  metrics_export_line(line);
+}
@@ -0,0 +1,75 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <winamp/out.h>
+
+typedef struct _metrics_sample_t {
+  int buffer_depth_ms; // i.e. GetWrittenTime() - GetOutputTime()
+  int av_drift_ms;     // i.e. vis timestamps ahead of what is audible
+  LONG underruns;      // total since start
+  LONG dropped_frames; // total since start
+  int pcm_interval_p50_us;
+  int pcm_interval_p99_us;
+  int analysis_p50_us;
+  int analysis_p99_us;
+  int render_p50_us;
+  int render_p99_us;
+  double render_fps;
+} metrics_sample_t;
+
+bool metrics_init(const char *json_filename, Out_Module *output_module);
+
+void metrics_shutdown();
+
+bool metrics_enabled();
+
+// Milliseconds since metrics_init, for JSON lines
+LONGLONG metrics_uptime_ms();
+
+// These are called from plug-in threads
+void metrics_note_pcm_block(int timestamp_ms);
+void metrics_note_analysis(LONGLONG duration_us);
+void metrics_note_render(LONGLONG duration_us);
+void metrics_note_dropped_frame();
+void metrics_note_output_reset();
+void metrics_note_can_write(int bytes_free);
+void metrics_note_write();
+
+// Takes a sample of everything seen since the previous call
+void metrics_collect(metrics_sample_t *sample);
+
+void metrics_format_line(const metrics_sample_t *sample, char *text,
+                         size_t size);
+
+void metrics_format_title(const metrics_sample_t *sample, char *text,
+                          size_t size);
+
+void metrics_export_line(const char *json_object);
+
+void metrics_export_sample(const metrics_sample_t *sample, int track_index,
+                           int position_ms, int length_ms);
+
+#endif // ifndef METRICS_H
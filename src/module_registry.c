@@ -0,0 +1,125 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "module_registry.h"
+#include "pe_image.h"
+
+#define REGISTERED_MODULES_MAX 32
+
+typedef struct _registered_module_t {
+  char name[MAX_PATH];
+  HMODULE handle;
+  ULONG_PTR begin;
+  ULONG_PTR end;
+} registered_module_t;
+
+static SRWLOCK g_registry_lock = SRWLOCK_INIT;
+static registered_module_t g_modules[REGISTERED_MODULES_MAX];
+static size_t g_module_count = 0;
+
+static const char *basename_of(const char *filename) {
+  const char *basename = filename;
+  for (const char *p = filename; *p != '\0'; p++) {
+    if (*p == '\\' || *p == '/') {
+      basename = p + 1;
+    }
+  }
+  return basename;
+}
+
+void module_registry_add(const char *filename, HMODULE handle) {
+  AcquireSRWLockExclusive(&g_registry_lock);
+  if (g_module_count < REGISTERED_MODULES_MAX) {
+    registered_module_t *const module = &g_modules[g_module_count++];
+    snprintf(module->name, sizeof(module->name), "%s", basename_of(filename));
+    module->handle = handle;
+    module->begin = (ULONG_PTR)handle;
+    module->end = module->begin + pe_image_size(handle);
+  } else {
+    log_error("Too many modules to track, not tracking \"%s\".", filename);
+  }
+  ReleaseSRWLockExclusive(&g_registry_lock);
+}
+
+void module_registry_remove(HMODULE handle) {
+  AcquireSRWLockExclusive(&g_registry_lock);
+  for (size_t i = 0; i < g_module_count; i++) {
+    if (g_modules[i].handle == handle) {
+      g_modules[i] = g_modules[--g_module_count];
+      break;
+    }
+  }
+  ReleaseSRWLockExclusive(&g_registry_lock);
+}
+
+static HMODULE find_registered(ULONG_PTR address, char *module_name,
+                               size_t module_name_size) {
+  HMODULE handle = NULL;
+  AcquireSRWLockShared(&g_registry_lock);
+  for (size_t i = 0; i < g_module_count; i++) {
+    if (address >= g_modules[i].begin && address < g_modules[i].end) {
+      handle = g_modules[i].handle;
+      snprintf(module_name, module_name_size, "%s", g_modules[i].name);
+      break;
+    }
+  }
+  ReleaseSRWLockShared(&g_registry_lock);
+  return handle;
+}
+
+static HMODULE find_unregistered(ULONG_PTR address, char *module_name,
+                                 size_t module_name_size) {
+  HMODULE handle = NULL;
+  if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                              GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                          (LPCSTR)address, &handle)) {
+    return NULL;
+  }
+
+  char filename[MAX_PATH] = "";
+  GetModuleFileNameA(handle, filename, sizeof(filename));
+  snprintf(module_name, module_name_size, "%s", basename_of(filename));
+  return handle;
+}
+
+HMODULE module_registry_describe(ULONG_PTR address, char *text, size_t size,
+                                 char *module_name, size_t module_name_size) {
+  HMODULE handle = find_registered(address, module_name, module_name_size);
+  if (handle == NULL) {
+    handle = find_unregistered(address, module_name, module_name_size);
+  }
+  if (handle == NULL) {
+    snprintf(module_name, module_name_size, "%s", "???");
+    snprintf(text, size, "0x%llx", (unsigned long long)address);
+    return NULL;
+  }
+
+  ULONG_PTR offset = 0;
+  const char *const export_name = pe_nearest_export(handle, address, &offset);
+  if (export_name != NULL) {
+    snprintf(text, size, "%s!%s+0x%llx", module_name, export_name,
+             (unsigned long long)offset);
+  } else {
+    snprintf(text, size, "%s+0x%llx", module_name,
+             (unsigned long long)(address - (ULONG_PTR)handle));
+  }
+  return handle;
+}
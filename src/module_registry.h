@@ -0,0 +1,37 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef MODULE_REGISTRY_H
+#define MODULE_REGISTRY_H
+
+#include <stddef.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+// Keeps track of the plug-in DLLs we loaded, so that addresses
+// (e.g. instruction pointers) can be attributed to them.
+void module_registry_add(const char *filename, HMODULE handle);
+
+void module_registry_remove(HMODULE handle);
+
+// Writes e.g. "vis_avs.dll!winampVisGetHeader+0x1a2b" or "vis_avs.dll+0x1a2b"
+// and returns the module the address belongs to, or NULL if unknown.
+HMODULE module_registry_describe(ULONG_PTR address, char *text, size_t size,
+                                 char *module_name, size_t module_name_size);
+
+#endif // ifndef MODULE_REGISTRY_H
@@ -0,0 +1,193 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "null_output.h"
+#include "timing.h"
+
+static bool g_free_running = false;
+static int g_buffer_ms = NULL_OUTPUT_BUFFER_MS_DEFAULT;
+
+// Input plug-ins write from a thread of their own
+static CRITICAL_SECTION g_lock;
+static int g_bytes_per_second = 0;
+static int g_offset_ms = 0; // i.e. where the last Flush started over
+static LONGLONG g_written_us = 0;
+static LONGLONG g_played_us = 0;           // as of g_clock_started_at_us
+static LONGLONG g_clock_started_at_us = 0; // 0 while paused
+static bool g_paused = false;
+
+static void __cdecl null_config(HWND hwndParent) {}
+
+static void __cdecl null_about(HWND hwndParent) {}
+
+static void __cdecl null_init() { InitializeCriticalSection(&g_lock); }
+
+static void __cdecl null_quit() { DeleteCriticalSection(&g_lock); }
+
+// Audio is played as real time passes, as long as there is some, i.e. the
+// emulated device stalls rather than running ahead of what was written
+static LONGLONG played_us_locked() {
+  if (g_free_running) {
+    return g_written_us;
+  }
+  if (g_clock_started_at_us != 0) {
+    const LONGLONG now_us = timing_now_us();
+    g_played_us += now_us - g_clock_started_at_us;
+    g_clock_started_at_us = now_us;
+  }
+  if (g_played_us > g_written_us) {
+    g_played_us = g_written_us;
+  }
+  return g_played_us;
+}
+
+static void restart_locked(int offset_ms) {
+  g_offset_ms = offset_ms;
+  g_written_us = 0;
+  g_played_us = 0;
+  g_clock_started_at_us = g_paused ? 0 : timing_now_us();
+}
+
+static int __cdecl null_open(int samplerate, int numchannels, int bitspersamp,
+                             int bufferlenms, int prebufferms) {
+  if (samplerate <= 0 || numchannels <= 0 || bitspersamp <= 0) {
+    return -1;
+  }
+  EnterCriticalSection(&g_lock);
+  g_bytes_per_second = samplerate * numchannels * (bitspersamp / 8);
+  g_paused = false;
+  restart_locked(0);
+  LeaveCriticalSection(&g_lock);
+  return g_free_running ? 0 : g_buffer_ms;
+}
+
+static void __cdecl null_close() {}
+
+static int __cdecl null_write(char *buf, int len) {
+  EnterCriticalSection(&g_lock);
+  if (g_bytes_per_second != 0) {
+    g_written_us += len * 1000000LL / g_bytes_per_second;
+  }
+  LeaveCriticalSection(&g_lock);
+  return 0;
+}
+
+static int __cdecl null_can_write() {
+  if (g_free_running) {
+    return 65536;
+  }
+  EnterCriticalSection(&g_lock);
+  const LONGLONG buffered_us = g_written_us - played_us_locked();
+  const LONGLONG free_us = g_buffer_ms * 1000LL - buffered_us;
+  const int bytes = (free_us <= 0 || g_paused)
+                        ? 0
+                        : (int)(free_us * g_bytes_per_second / 1000000);
+  LeaveCriticalSection(&g_lock);
+  return bytes;
+}
+
+static int __cdecl null_is_playing() {
+  EnterCriticalSection(&g_lock);
+  const bool playing = played_us_locked() < g_written_us;
+  LeaveCriticalSection(&g_lock);
+  return playing ? 1 : 0;
+}
+
+static int __cdecl null_pause(int pause) {
+  EnterCriticalSection(&g_lock);
+  const bool previous = g_paused;
+  played_us_locked(); // i.e. account for the time until now
+  g_paused = (pause != 0);
+  g_clock_started_at_us = g_paused ? 0 : timing_now_us();
+  LeaveCriticalSection(&g_lock);
+  return previous ? 1 : 0;
+}
+
+static void __cdecl null_set_volume(int volume) {}
+
+static void __cdecl null_set_pan(int pan) {}
+
+static void __cdecl null_flush(int t) {
+  EnterCriticalSection(&g_lock);
+  restart_locked(t);
+  LeaveCriticalSection(&g_lock);
+}
+
+static int __cdecl null_get_output_time() {
+  EnterCriticalSection(&g_lock);
+  const int ms = g_offset_ms + (int)(played_us_locked() / 1000);
+  LeaveCriticalSection(&g_lock);
+  return ms;
+}
+
+static int __cdecl null_get_written_time() {
+  EnterCriticalSection(&g_lock);
+  const int ms = g_offset_ms + (int)(g_written_us / 1000);
+  LeaveCriticalSection(&g_lock);
+  return ms;
+}
+
+static bool parse_parameters(const char *parameters) {
+  if (parameters[0] == '\0') {
+    return true;
+  }
+  if (strcmp(parameters, "free") == 0) {
+    g_free_running = true;
+    return true;
+  }
+  char trailing;
+  return sscanf(parameters, "buffer=%d%c", &g_buffer_ms, &trailing) == 1 &&
+         g_buffer_ms > 0;
+}
+
+Out_Module *null_output_module(const char *parameters) {
+  static Out_Module out_module = {
+      OUT_VER,
+      "visdriver null output",
+      65,
+      NULL,
+      NULL,
+      null_config,
+      null_about,
+      null_init,
+      null_quit,
+      null_open,
+      null_close,
+      null_write,
+      null_can_write,
+      null_is_playing,
+      null_pause,
+      null_set_volume,
+      null_set_pan,
+      null_flush,
+      null_get_output_time,
+      null_get_written_time,
+  };
+
+  if (!parse_parameters(parameters)) {
+    log_error("Invalid null output parameters \"%s\", expected \"free\" or "
+              "\"buffer=MS\".",
+              parameters);
+    return NULL;
+  }
+  return &out_module;
+}
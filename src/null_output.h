@@ -0,0 +1,34 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef NULL_OUTPUT_H
+#define NULL_OUTPUT_H
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <winamp/out.h>
+
+#define NULL_OUTPUT_BUFFER_MS_DEFAULT 500
+
+// An output plug-in without an audio device, for headless machines.
+// Parameters are "" or "buffer=MS" for a device clock emulated in real
+// time (with a buffer of that many milliseconds), or "free" for taking
+// audio as fast as it is written.  Returns NULL for invalid parameters.
+Out_Module *null_output_module(const char *parameters);
+
+#endif // ifndef NULL_OUTPUT_H
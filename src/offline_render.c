@@ -0,0 +1,259 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "analysis_frame.h"
+#include "log.h"
+#include "offline_render.h"
+#include "pcm.h"
+#include "virtual_clock.h"
+#include "vis_host.h"
+#include "visualization.h"
+#include "wav_writer.h"
+
+// In stereo samples, enough for any Write of at most 8192 bytes plus the
+// remainder of a frame
+#define OFFLINE_BUFFER_SAMPLES 16384
+
+static int g_fps = 0;
+static const char *g_wav_filename = NULL;
+static wav_writer_t g_wav_writer = {NULL, 0, false};
+static bool g_wav_failed = false;
+static int g_wav_sample_rate = 0;
+static int g_wav_channels = 0;
+static int g_wav_bits_per_sample = 0;
+
+static int g_sample_rate = 0;
+static int g_channels = 0;
+static int g_bits_per_sample = 0;
+static int g_paused = 0;
+
+// Frames rendered across all tracks, for virtual time
+static LONGLONG g_frames_rendered = 0;
+
+// Absolute sample positions within the stream
+static LONGLONG g_written_samples = 0;
+static LONGLONG g_frame_number = 0;
+static LONGLONG g_next_frame_start = 0;
+
+// 16 bit stereo, starting at stream position g_buffer_start
+static int16_t g_buffer[OFFLINE_BUFFER_SAMPLES * 2];
+static LONGLONG g_buffer_start = 0;
+static int g_buffer_count = 0;
+
+static void __cdecl offline_config(HWND hwndParent) {}
+
+static void __cdecl offline_about(HWND hwndParent) {}
+
+static void __cdecl offline_init() {}
+
+static void __cdecl offline_quit() { wav_writer_close(&g_wav_writer); }
+
+static LONGLONG frame_start_of(LONGLONG frame_number) {
+  return frame_number * g_sample_rate / g_fps;
+}
+
+// Starts over at stream position t (in milliseconds)
+static void restart_at(int t) {
+  g_written_samples = (LONGLONG)t * g_sample_rate / 1000;
+  g_frame_number = (g_written_samples * g_fps + g_sample_rate - 1) /
+                   g_sample_rate; // i.e. rounded up
+  g_next_frame_start = frame_start_of(g_frame_number);
+  g_buffer_start = g_written_samples;
+  g_buffer_count = 0;
+}
+
+static void open_wav_writer() {
+  if (g_wav_filename == NULL || g_wav_failed) {
+    return;
+  }
+  if (g_wav_writer.file == NULL) {
+    g_wav_failed = !wav_writer_open(&g_wav_writer, g_wav_filename,
+                                    g_sample_rate, g_channels,
+                                    g_bits_per_sample);
+    g_wav_sample_rate = g_sample_rate;
+    g_wav_channels = g_channels;
+    g_wav_bits_per_sample = g_bits_per_sample;
+    return;
+  }
+
+  // A WAV file has a single format, so a playlist needs to agree on it
+  if (g_sample_rate != g_wav_sample_rate || g_channels != g_wav_channels ||
+      g_bits_per_sample != g_wav_bits_per_sample) {
+    log_error("Track format differs from that of \"%s\", stopped writing "
+              "audio.",
+              g_wav_filename);
+    wav_writer_close(&g_wav_writer);
+    g_wav_failed = true;
+  }
+}
+
+static int __cdecl offline_open(int samplerate, int numchannels,
+                                int bitspersamp, int bufferlenms,
+                                int prebufferms) {
+  if (samplerate <= 0 || numchannels <= 0 ||
+      !pcm_bits_supported(bitspersamp)) {
+    log_error("Cannot render %d Hz, %d channels at %d bits offline.",
+              samplerate, numchannels, bitspersamp);
+    return -1;
+  }
+  g_sample_rate = samplerate;
+  g_channels = numchannels;
+  g_bits_per_sample = bitspersamp;
+  g_paused = 0;
+  restart_at(0);
+  open_wav_writer();
+  return 0; // i.e. no latency, like a disk writer
+}
+
+static void __cdecl offline_close() {}
+
+static void render_due_frames() {
+  while (g_next_frame_start >= g_buffer_start &&
+         g_next_frame_start + ANALYSIS_FRAME_SAMPLES <=
+             g_buffer_start + g_buffer_count) {
+    const int16_t *const interleaved =
+        g_buffer + 2 * (g_next_frame_start - g_buffer_start);
+    const int timestamp_ms = (int)(g_frame_number * 1000 / g_fps);
+    virtual_clock_set_elapsed_us(g_frames_rendered * 1000000 / g_fps);
+    vis_host_render_frame(
+        analyze_pcm(interleaved, g_sample_rate, timestamp_ms));
+    g_frames_rendered++;
+
+    g_frame_number++;
+    g_next_frame_start = frame_start_of(g_frame_number);
+  }
+
+  // Drop what no frame needs anymore
+  LONGLONG unneeded = g_next_frame_start - g_buffer_start;
+  if (unneeded > g_buffer_count) {
+    unneeded = g_buffer_count;
+  }
+  if (unneeded > 0) {
+    g_buffer_count -= (int)unneeded;
+    memmove(g_buffer, g_buffer + 2 * unneeded,
+            g_buffer_count * 2 * sizeof(g_buffer[0]));
+    g_buffer_start += unneeded;
+  }
+}
+
+static void add_samples(const char *buf, int count) {
+  int index = 0;
+  while (index < count) {
+    // Skip samples before the next frame, e.g. at low frame rates
+    if (g_buffer_count == 0 && g_buffer_start < g_next_frame_start) {
+      LONGLONG skip = g_next_frame_start - g_buffer_start;
+      if (skip > count - index) {
+        skip = count - index;
+      }
+      index += (int)skip;
+      g_buffer_start += skip;
+      continue;
+    }
+
+    while (index < count && g_buffer_count < OFFLINE_BUFFER_SAMPLES) {
+      const int first = index * g_channels;
+      const int second = (g_channels >= 2) ? first + 1 : first;
+      g_buffer[2 * g_buffer_count] =
+          pcm_sample_to_16_bit(buf, g_bits_per_sample, first);
+      g_buffer[2 * g_buffer_count + 1] =
+          pcm_sample_to_16_bit(buf, g_bits_per_sample, second);
+      g_buffer_count++;
+      index++;
+    }
+    render_due_frames();
+  }
+}
+
+static int __cdecl offline_write(char *buf, int len) {
+  if (g_sample_rate == 0) {
+    return 0;
+  }
+  if (g_wav_writer.file != NULL &&
+      !wav_writer_write(&g_wav_writer, buf, (DWORD)len)) {
+    log_error("Could not write to \"%s\", stopped writing audio.",
+              g_wav_filename);
+    wav_writer_close(&g_wav_writer);
+    g_wav_failed = true;
+  }
+
+  const int count = len / (g_channels * g_bits_per_sample / 8);
+  add_samples(buf, count);
+  g_written_samples += count;
+  return 0;
+}
+
+static int __cdecl offline_can_write() {
+  return g_paused ? 0 : 65536; // i.e. never have the decoder wait
+}
+
+static int __cdecl offline_is_playing() {
+  return 0; // i.e. nothing is left to play after Write
+}
+
+static int __cdecl offline_pause(int pause) {
+  const int previous = g_paused;
+  g_paused = pause;
+  return previous;
+}
+
+static void __cdecl offline_set_volume(int volume) {}
+
+static void __cdecl offline_set_pan(int pan) {}
+
+static void __cdecl offline_flush(int t) {
+  if (g_sample_rate != 0) {
+    restart_at(t);
+  }
+}
+
+static int __cdecl offline_get_written_time() {
+  return (g_sample_rate == 0)
+             ? 0
+             : (int)(g_written_samples * 1000 / g_sample_rate);
+}
+
+Out_Module *offline_render_output_module(int fps, const char *wav_filename) {
+  static Out_Module out_module = {
+      OUT_VER,
+      "visdriver offline renderer",
+      65536,
+      NULL,
+      NULL,
+      offline_config,
+      offline_about,
+      offline_init,
+      offline_quit,
+      offline_open,
+      offline_close,
+      offline_write,
+      offline_can_write,
+      offline_is_playing,
+      offline_pause,
+      offline_set_volume,
+      offline_set_pan,
+      offline_flush,
+      offline_get_written_time, // i.e. heard as soon as written
+      offline_get_written_time,
+  };
+  g_fps = fps;
+  g_wav_filename = wav_filename;
+  return &out_module;
+}
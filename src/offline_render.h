@@ -0,0 +1,34 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef OFFLINE_RENDER_H
+#define OFFLINE_RENDER_H
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <winamp/out.h>
+
+// A non-realtime output plug-in for rendering videos: it takes audio as
+// fast as the input plug-in can decode it, cuts it into analysis frames at
+// exact multiples of 1/fps of stream time, and has every single frame
+// rendered (see vis_host_render_frame) before taking more.  Plug-ins see
+// time pass by 1/fps per frame, see virtual_clock.  The audio can be
+// written to a WAV file (or NULL for none) on the way.
+Out_Module *offline_render_output_module(int fps, const char *wav_filename);
+
+#endif // ifndef OFFLINE_RENDER_H
@@ -0,0 +1,288 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "output_buffer.h"
+
+// Output plug-ins take at most this much per Write
+#define OUTPUT_BUFFER_CHUNK_BYTES 8192
+
+static Out_Module g_real_output_module;
+static int g_buffer_ms = 0;
+
+// A single-producer single-consumer ring: the input plug-in thread writes
+// at g_write_offset, the feeder thread reads at g_read_offset, and the
+// difference of the (wrapping) counts is what is buffered.  The capacity is
+// a multiple of the frame size, so that sample frames never wrap around.
+static char *g_ring = NULL;
+static ULONG g_capacity = 0;
+static volatile LONG g_write_count = 0;
+static volatile LONG g_read_count = 0;
+static ULONG g_write_offset = 0; // owned by the input plug-in thread
+static ULONG g_read_offset = 0;  // owned by the feeder, see Flush
+static int g_bytes_per_second = 0;
+static ULONG g_frame_bytes = 0;
+
+static HANDLE g_feeder_thread = NULL;
+static HANDLE g_written_event = NULL;
+static volatile LONG g_stop_requested = 0;
+static CRITICAL_SECTION g_feeder_lock; // held while feeding, see Flush
+
+// For GetWrittenTime, what the input plug-in wrote since the last Flush
+static int g_offset_ms = 0;
+static LONGLONG g_written_bytes = 0;
+
+static ULONG buffered_bytes() {
+  return (ULONG)g_write_count - (ULONG)g_read_count;
+}
+
+// Returns false if there was nothing to feed, or no room for it
+static bool feed_chunk() {
+  EnterCriticalSection(&g_feeder_lock);
+  const ULONG available = buffered_bytes();
+  int room = g_real_output_module.CanWrite();
+  bool fed = false;
+  if (available > 0 && room > 0) {
+    const ULONG offset = g_read_offset;
+    ULONG size = g_capacity - offset; // i.e. contiguous only
+    if (size > available) {
+      size = available;
+    }
+    if (size > (ULONG)room) {
+      size = (ULONG)room;
+    }
+    if (size > OUTPUT_BUFFER_CHUNK_BYTES) {
+      size = OUTPUT_BUFFER_CHUNK_BYTES;
+    }
+    size -= size % g_frame_bytes; // i.e. whole sample frames only
+    if (size > 0 &&
+        g_real_output_module.Write(g_ring + offset, (int)size) == 0) {
+      g_read_offset = (offset + size) % g_capacity;
+      MemoryBarrier(); // i.e. done reading before handing the bytes back
+      InterlockedExchangeAdd(&g_read_count, (LONG)size);
+      fed = true;
+    }
+  }
+  LeaveCriticalSection(&g_feeder_lock);
+  return fed;
+}
+
+static DWORD WINAPI feeder_thread_main(LPVOID parameter) {
+  while (!g_stop_requested) {
+    if (!feed_chunk()) {
+      // Output plug-ins do not tell when they have room again
+      WaitForSingleObject(g_written_event, 5);
+    }
+  }
+  return 0;
+}
+
+static void stop_feeder() {
+  if (g_feeder_thread == NULL) {
+    return;
+  }
+  InterlockedExchange(&g_stop_requested, 1);
+  SetEvent(g_written_event);
+  WaitForSingleObject(g_feeder_thread, INFINITE);
+  CloseHandle(g_feeder_thread);
+  g_feeder_thread = NULL;
+  CloseHandle(g_written_event);
+  g_written_event = NULL;
+  DeleteCriticalSection(&g_feeder_lock);
+
+  free(g_ring);
+  g_ring = NULL;
+  g_capacity = 0;
+}
+
+static void __cdecl buffered_config(HWND hwndParent) {
+  g_real_output_module.Config(hwndParent);
+}
+
+static void __cdecl buffered_about(HWND hwndParent) {
+  g_real_output_module.About(hwndParent);
+}
+
+static void __cdecl buffered_init() { g_real_output_module.Init(); }
+
+static void __cdecl buffered_quit() {
+  stop_feeder();
+  g_real_output_module.Quit();
+}
+
+static int __cdecl buffered_open(int samplerate, int numchannels,
+                                 int bitspersamp, int bufferlenms,
+                                 int prebufferms) {
+  stop_feeder(); // i.e. in case of a missing Close
+
+  const int latency_ms = g_real_output_module.Open(
+      samplerate, numchannels, bitspersamp, bufferlenms, prebufferms);
+  if (latency_ms < 0) {
+    return latency_ms;
+  }
+
+  g_frame_bytes = (ULONG)(numchannels * (bitspersamp / 8));
+  if (g_frame_bytes == 0) {
+    g_frame_bytes = 1;
+  }
+  g_bytes_per_second = samplerate * (int)g_frame_bytes;
+  ULONGLONG wanted_bytes = (ULONGLONG)g_buffer_ms * g_bytes_per_second / 1000;
+  if (wanted_bytes < OUTPUT_BUFFER_CHUNK_BYTES) {
+    wanted_bytes = OUTPUT_BUFFER_CHUNK_BYTES;
+  } else if (wanted_bytes > 0x40000000) {
+    wanted_bytes = 0x40000000;
+  }
+  g_capacity = (ULONG)(wanted_bytes + g_frame_bytes - 1) / g_frame_bytes *
+               g_frame_bytes;
+  g_ring = malloc(g_capacity);
+  g_written_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+  if (g_ring == NULL || g_written_event == NULL) {
+    log_error("Could not allocate %lu bytes of output buffer.",
+              (unsigned long)g_capacity);
+    free(g_ring);
+    g_ring = NULL;
+    if (g_written_event != NULL) {
+      CloseHandle(g_written_event);
+      g_written_event = NULL;
+    }
+    g_real_output_module.Close();
+    return -1;
+  }
+  g_write_count = 0;
+  g_read_count = 0;
+  g_write_offset = 0;
+  g_read_offset = 0;
+  g_offset_ms = 0;
+  g_written_bytes = 0;
+
+  InitializeCriticalSection(&g_feeder_lock);
+  g_stop_requested = 0;
+  g_feeder_thread = CreateThread(NULL, 0, feeder_thread_main, NULL, 0, NULL);
+  if (g_feeder_thread == NULL) {
+    log_error("Could not start output buffer thread.");
+    DeleteCriticalSection(&g_feeder_lock);
+    free(g_ring);
+    g_ring = NULL;
+    CloseHandle(g_written_event);
+    g_written_event = NULL;
+    g_real_output_module.Close();
+    return -1;
+  }
+  SetThreadPriority(g_feeder_thread, THREAD_PRIORITY_ABOVE_NORMAL);
+
+  return latency_ms + g_buffer_ms;
+}
+
+static void __cdecl buffered_close() {
+  stop_feeder();
+  g_real_output_module.Close();
+}
+
+static int __cdecl buffered_write(char *buf, int len) {
+  if (g_ring == NULL || len < 0 ||
+      (ULONG)len > g_capacity - buffered_bytes()) {
+    return 1; // i.e. not able to write (yet)
+  }
+
+  const ULONG offset = g_write_offset;
+  const ULONG first = ((ULONG)len < g_capacity - offset)
+                          ? (ULONG)len
+                          : g_capacity - offset;
+  memcpy(g_ring + offset, buf, first);
+  memcpy(g_ring, buf + first, len - first); // i.e. after wrapping around
+  g_write_offset = (offset + (ULONG)len) % g_capacity;
+  MemoryBarrier(); // i.e. done copying before handing the bytes over
+  InterlockedExchangeAdd(&g_write_count, len);
+  g_written_bytes += len;
+
+  SetEvent(g_written_event);
+  return 0;
+}
+
+static int __cdecl buffered_can_write() {
+  if (g_ring == NULL) {
+    return 0;
+  }
+  return (int)(g_capacity - buffered_bytes());
+}
+
+static int __cdecl buffered_is_playing() {
+  return (g_ring != NULL && buffered_bytes() > 0) ||
+         g_real_output_module.IsPlaying();
+}
+
+static int __cdecl buffered_pause(int pause) {
+  return g_real_output_module.Pause(pause);
+}
+
+static void __cdecl buffered_set_volume(int volume) {
+  g_real_output_module.SetVolume(volume);
+}
+
+static void __cdecl buffered_set_pan(int pan) {
+  g_real_output_module.SetPan(pan);
+}
+
+static void __cdecl buffered_flush(int t) {
+  if (g_ring != NULL) {
+    EnterCriticalSection(&g_feeder_lock); // i.e. the feeder is not feeding
+    g_read_offset = g_write_offset;
+    InterlockedExchange(&g_read_count, g_write_count);
+    g_real_output_module.Flush(t);
+    LeaveCriticalSection(&g_feeder_lock);
+  } else {
+    g_real_output_module.Flush(t);
+  }
+  g_offset_ms = t;
+  g_written_bytes = 0;
+}
+
+static int __cdecl buffered_get_output_time() {
+  return g_real_output_module.GetOutputTime(); // i.e. what is heard
+}
+
+static int __cdecl buffered_get_written_time() {
+  if (g_bytes_per_second == 0) {
+    return g_real_output_module.GetWrittenTime();
+  }
+  return g_offset_ms + (int)(g_written_bytes * 1000 / g_bytes_per_second);
+}
+
+void buffer_output_module(Out_Module *out_module, int buffer_ms) {
+  g_real_output_module = *out_module;
+  g_buffer_ms = buffer_ms;
+
+  out_module->Config = buffered_config;
+  out_module->About = buffered_about;
+  out_module->Init = buffered_init;
+  out_module->Quit = buffered_quit;
+  out_module->Open = buffered_open;
+  out_module->Close = buffered_close;
+  out_module->Write = buffered_write;
+  out_module->CanWrite = buffered_can_write;
+  out_module->IsPlaying = buffered_is_playing;
+  out_module->Pause = buffered_pause;
+  out_module->SetVolume = buffered_set_volume;
+  out_module->SetPan = buffered_set_pan;
+  out_module->Flush = buffered_flush;
+  out_module->GetOutputTime = buffered_get_output_time;
+  out_module->GetWrittenTime = buffered_get_written_time;
+}
@@ -15,12 +15,44 @@
 // You should have received a copy of the GNU General Public License along
 // with visdriver. If not, see <https://www.gnu.org/licenses/>.
 
+#include <string.h>
+
 #include "output_plugin.h"
 #include "log.h"
+#include "module_registry.h"
+#include "null_output.h"
 
 typedef Out_Module *(__cdecl *winamp_get_out_module_func)(void);
 
+static Out_Module *load_builtin_output_module(const char *name,
+                                              HWND main_window) {
+  Out_Module *out_module = NULL;
+  const char *const parameters = strchr(name, '?');
+  const size_t name_len =
+      (parameters != NULL) ? (size_t)(parameters - name) : strlen(name);
+
+  if (name_len == strlen("null") && strncmp(name, "null", name_len) == 0) {
+    out_module =
+        null_output_module((parameters != NULL) ? parameters + 1 : "");
+  } else {
+    log_error("There is no built-in output plug-in \"%.*s\".", (int)name_len,
+              name);
+  }
+
+  if (out_module != NULL) {
+    out_module->hDllInstance = NULL; // i.e. nothing to unload
+    out_module->hMainWindow = main_window;
+  }
+  return out_module;
+}
+
 Out_Module *load_output_module(const char *filename, HWND main_window) {
+  if (strncmp(filename, OUTPUT_PLUGIN_BUILTIN_PREFIX,
+              strlen(OUTPUT_PLUGIN_BUILTIN_PREFIX)) == 0) {
+    return load_builtin_output_module(
+        filename + strlen(OUTPUT_PLUGIN_BUILTIN_PREFIX), main_window);
+  }
+
   const HMODULE dll_handle = LoadLibraryA(filename);
   if (dll_handle == NULL) {
     log_error("LoadLibraryA failed for file \"%s\".", filename);
@@ -51,10 +83,16 @@ Out_Module *load_output_module(const char *filename, HWND main_window) {
   out_module->hDllInstance = dll_handle;
   out_module->hMainWindow = main_window;
 
+  module_registry_add(filename, dll_handle);
+
   return out_module;
 }
 
 void unload_output_module(Out_Module *out_module) {
   out_module->Quit();
+  if (out_module->hDllInstance == NULL) {
+    return; // i.e. built-in, e.g. null_output_module
+  }
+  module_registry_remove(out_module->hDllInstance);
   FreeLibrary(out_module->hDllInstance);
 }
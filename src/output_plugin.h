@@ -23,6 +23,10 @@
 
 #include <winamp/out.h>
 
+#define OUTPUT_PLUGIN_BUILTIN_PREFIX "builtin:"
+
+// Also takes "builtin:NAME?PARAMETERS" for output plug-ins built into
+// visdriver, e.g. "builtin:null" (see null_output.h)
 Out_Module *load_output_module(const char *filename, HWND main_window);
 
 void unload_output_module(Out_Module *out_module);
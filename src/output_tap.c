@@ -0,0 +1,129 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "analysis_frame.h"
+#include "log.h"
+#include "metrics.h"
+#include "output_tap.h"
+#include "pcm.h"
+#include "vis_host.h"
+#include "visualization.h"
+
+static Out_Module g_real_output_module;
+
+static int g_sample_rate = 0; // i.e. not tapping
+static int g_channels = 0;
+static int g_bits_per_sample = 0;
+
+// 16 bit stereo of a frame that does not lie within a single Write as is
+static int16_t g_pending[ANALYSIS_FRAME_SAMPLES * 2];
+static int g_pending_count = 0;
+
+static int __cdecl tapped_open(int samplerate, int numchannels,
+                               int bitspersamp, int bufferlenms,
+                               int prebufferms) {
+  const int latency_ms = g_real_output_module.Open(
+      samplerate, numchannels, bitspersamp, bufferlenms, prebufferms);
+  if (latency_ms < 0) {
+    return latency_ms;
+  }
+
+  g_pending_count = 0;
+  if (samplerate <= 0 || numchannels <= 0 ||
+      !pcm_bits_supported(bitspersamp)) {
+    log_error("Cannot analyze %d Hz, %d channels at %d bits, skipping.",
+              samplerate, numchannels, bitspersamp);
+    g_sample_rate = 0;
+    return latency_ms;
+  }
+  g_sample_rate = samplerate;
+  g_channels = numchannels;
+  g_bits_per_sample = bitspersamp;
+  return latency_ms;
+}
+
+static void __cdecl tapped_close() {
+  g_real_output_module.Close();
+  g_sample_rate = 0;
+}
+
+// Where 16 bit stereo comes in, frames are analyzed right from the buffer
+// passed to Write; only frames spanning two Writes, or audio of any other
+// format, go through g_pending.
+static void analyze_written(const char *buf, int count) {
+  const bool as_is = (g_bits_per_sample == 16 && g_channels == 2);
+  const int written_ms = g_real_output_module.GetWrittenTime();
+
+  int index = 0;
+  while (index < count) {
+    const int16_t *interleaved;
+    if (as_is && g_pending_count == 0 &&
+        count - index >= ANALYSIS_FRAME_SAMPLES) {
+      interleaved = (const int16_t *)buf + 2 * index;
+      index += ANALYSIS_FRAME_SAMPLES;
+    } else {
+      while (index < count && g_pending_count < ANALYSIS_FRAME_SAMPLES) {
+        const int first = index * g_channels;
+        const int second = (g_channels >= 2) ? first + 1 : first;
+        g_pending[2 * g_pending_count] =
+            pcm_sample_to_16_bit(buf, g_bits_per_sample, first);
+        g_pending[2 * g_pending_count + 1] =
+            pcm_sample_to_16_bit(buf, g_bits_per_sample, second);
+        g_pending_count++;
+        index++;
+      }
+      if (g_pending_count < ANALYSIS_FRAME_SAMPLES) {
+        return; // i.e. wait for the next Write
+      }
+      interleaved = g_pending;
+      g_pending_count = 0;
+    }
+
+    // The frame started this many samples before the end of the Write
+    const LONGLONG samples_ago = count - index + ANALYSIS_FRAME_SAMPLES;
+    const int timestamp_ms =
+        written_ms - (int)(samples_ago * 1000 / g_sample_rate);
+    metrics_note_pcm_block(timestamp_ms);
+    vis_host_submit_frame(
+        analyze_pcm(interleaved, g_sample_rate, timestamp_ms));
+  }
+}
+
+static int __cdecl tapped_write(char *buf, int len) {
+  const int result = g_real_output_module.Write(buf, len);
+  if (result == 0 && g_sample_rate != 0) {
+    analyze_written(buf, len / (g_channels * g_bits_per_sample / 8));
+  }
+  return result;
+}
+
+static void __cdecl tapped_flush(int t) {
+  g_real_output_module.Flush(t);
+  g_pending_count = 0;
+}
+
+void tap_output_module(Out_Module *out_module) {
+  g_real_output_module = *out_module;
+
+  out_module->Open = tapped_open;
+  out_module->Close = tapped_close;
+  out_module->Write = tapped_write;
+  out_module->Flush = tapped_flush;
+}
@@ -0,0 +1,33 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef OUTPUT_TAP_H
+#define OUTPUT_TAP_H
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <winamp/out.h>
+
+// Has the audio that the input plug-in writes to the output plug-in
+// analyzed, in place of what it passes to SAAddPCMData (if anything, see
+// take_pcm_from_elsewhere).  So vis plug-ins see what is heard, after any
+// DSP, with any input plug-in.  Like proxy_output_module, this replaces the
+// module's functions in place.
+void tap_output_module(Out_Module *out_module);
+
+#endif // ifndef OUTPUT_TAP_H
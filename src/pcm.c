@@ -0,0 +1,84 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include "pcm.h"
+
+bool pcm_bits_supported(int bits_per_sample) {
+  return bits_per_sample == 8 || bits_per_sample == 16 ||
+         bits_per_sample == 24 || bits_per_sample == 32;
+}
+
+int16_t pcm_sample_to_16_bit(const char *buf, int bits_per_sample,
+                             int index) {
+  switch (bits_per_sample) {
+  case 8:
+    return (int16_t)(((int)(unsigned char)buf[index] - 128) * 256);
+  case 16:
+    return ((const int16_t *)buf)[index];
+  case 24: {
+    const unsigned char *const bytes = (const unsigned char *)buf + 3 * index;
+    return (int16_t)(bytes[1] | (bytes[2] << 8));
+  }
+  default: // i.e. 32
+    return (int16_t)(((const int32_t *)buf)[index] >> 16);
+  }
+}
+
+void pcm_store_sample(char *buf, int bits_per_sample, int index,
+                      float value) {
+  if (value > 1.0f) {
+    value = 1.0f;
+  } else if (value < -1.0f) {
+    value = -1.0f;
+  }
+
+  switch (bits_per_sample) {
+  case 8:
+    ((unsigned char *)buf)[index] = (unsigned char)(128 + (int)(value * 127));
+    break;
+  case 16:
+    ((int16_t *)buf)[index] = (int16_t)(value * 32767);
+    break;
+  case 24: {
+    const int32_t sample = (int32_t)(value * 8388607);
+    unsigned char *const bytes = (unsigned char *)buf + 3 * index;
+    bytes[0] = (unsigned char)(sample & 0xff);
+    bytes[1] = (unsigned char)((sample >> 8) & 0xff);
+    bytes[2] = (unsigned char)((sample >> 16) & 0xff);
+    break;
+  }
+  default: // i.e. 32
+    ((int32_t *)buf)[index] = (int32_t)((double)value * 2147483647.0);
+    break;
+  }
+}
+
+const int16_t *pcm_to_16_bit_stereo(const char *buf, int bits_per_sample,
+                                    int channels, int frames,
+                                    int16_t *target) {
+  if (bits_per_sample == 16 && channels == 2) {
+    return (const int16_t *)buf;
+  }
+
+  for (int i = 0; i < frames; i++) {
+    const int first = i * channels;
+    const int second = (channels >= 2) ? first + 1 : first;
+    target[2 * i] = pcm_sample_to_16_bit(buf, bits_per_sample, first);
+    target[2 * i + 1] = pcm_sample_to_16_bit(buf, bits_per_sample, second);
+  }
+  return target;
+}
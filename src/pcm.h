@@ -0,0 +1,44 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef PCM_H
+#define PCM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Whether interleaved integer PCM of this sample size can be converted,
+// i.e. 8 bit unsigned or 16, 24 or 32 bit signed little endian
+bool pcm_bits_supported(int bits_per_sample);
+
+// Returns the sample at the given index (counted across channels) as 16 bit
+int16_t pcm_sample_to_16_bit(const char *buf, int bits_per_sample,
+                             int index);
+
+// Stores value (from -1.0 to 1.0, clipped beyond) at the given index
+// (counted across channels)
+void pcm_store_sample(char *buf, int bits_per_sample, int index,
+                      float value);
+
+// Returns frames of interleaved PCM as 16 bit stereo, as taken by
+// SAAddPCMData: buf itself if that is what it is already, else target
+// filled with a conversion (dropping any channels beyond the first two)
+const int16_t *pcm_to_16_bit_stereo(const char *buf, int bits_per_sample,
+                                    int channels, int frames,
+                                    int16_t *target);
+
+#endif // ifndef PCM_H
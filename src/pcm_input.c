@@ -0,0 +1,236 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <winamp/wa_ipc.h>
+
+#include "builtin_input.h"
+#include "log.h"
+#include "pcm.h"
+#include "pcm_input.h"
+#include "stream_io.h"
+
+static In_Module g_in_module;
+
+static int g_sample_rate = 0;
+static int g_channels = 0;
+static int g_bits_per_sample = 0;
+static int g_block_align = 0;
+
+static char g_path[MAX_PATH] = "";
+static HANDLE g_reader_thread = NULL;
+static volatile LONG g_stop_requested = 0;
+
+// What was read but not written yet, less than a frame after each round
+static char g_block[PCM_INPUT_READ_BYTES];
+static int g_block_count = 0;
+
+static bool is_stdin_path(const char *path) { return strcmp(path, "-") == 0; }
+
+// Waits for named pipes to be created (or freed) by the writer
+static HANDLE open_source(const char *path) {
+  if (is_stdin_path(path)) {
+    return GetStdHandle(STD_INPUT_HANDLE);
+  }
+
+  for (;;) {
+    const HANDLE source =
+        CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                    NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (source != INVALID_HANDLE_VALUE || !stream_io_is_pipe_path(path) ||
+        g_stop_requested) {
+      return source;
+    }
+    const DWORD error = GetLastError();
+    if (error != ERROR_FILE_NOT_FOUND && error != ERROR_PIPE_BUSY) {
+      return source;
+    }
+    Sleep(100);
+  }
+}
+
+static void write_chunk(const char *chunk, int frames) {
+  while (!g_stop_requested && !builtin_input_can_write(frames)) {
+    Sleep(5);
+  }
+  if (!g_stop_requested) {
+    builtin_input_write(chunk, frames);
+  }
+}
+
+static DWORD WINAPI reader_thread_main(LPVOID parameter) {
+  Out_Module *const out = g_in_module.outMod;
+
+  const HANDLE source = open_source(g_path);
+  if (source == INVALID_HANDLE_VALUE) {
+    if (!g_stop_requested) {
+      log_error("Could not open \"%s\" for reading (error %lu).", g_path,
+                (unsigned long)GetLastError());
+      Sleep(1000); // i.e. do not spin on a playlist of missing tracks
+      PostMessageA(g_in_module.hMainWindow, WM_WA_MPEG_EOF, 0, 0);
+    }
+    return 1;
+  }
+
+  g_block_count = 0;
+  LONGLONG total_bytes_read = 0;
+  while (!g_stop_requested) {
+    DWORD bytes_read = 0;
+    if (!ReadFile(source, g_block + g_block_count,
+                  sizeof(g_block) - g_block_count, &bytes_read, NULL) ||
+        bytes_read == 0) {
+      break; // i.e. the writer is done, or Stop cancelled the read
+    }
+    g_block_count += (int)bytes_read;
+    total_bytes_read += bytes_read;
+
+    const int frames = g_block_count / g_block_align;
+    for (int done = 0; done < frames && !g_stop_requested;) {
+      const int chunk_frames = (frames - done < BUILTIN_INPUT_CHUNK_FRAMES)
+                                   ? frames - done
+                                   : BUILTIN_INPUT_CHUNK_FRAMES;
+      write_chunk(g_block + done * g_block_align, chunk_frames);
+      done += chunk_frames;
+    }
+    const int used = frames * g_block_align;
+    g_block_count -= used;
+    memmove(g_block, g_block + used, g_block_count);
+  }
+
+  if (!is_stdin_path(g_path)) {
+    CloseHandle(source);
+  }
+  if (g_stop_requested) {
+    return 0;
+  }
+
+  while (!g_stop_requested && out->IsPlaying()) {
+    Sleep(10);
+  }
+  if (g_stop_requested) {
+    return 0;
+  }
+
+  // Stdin cannot be played again, so its end is the end of playback
+  if (is_stdin_path(g_path)) {
+    log_info("Standard input has ended, quitting.");
+    PostMessageA(g_in_module.hMainWindow, WM_CLOSE, 0, 0);
+    return 0;
+  }
+  if (total_bytes_read == 0) {
+    Sleep(1000); // i.e. do not spin on a FIFO that has no writer anymore
+  }
+  PostMessageA(g_in_module.hMainWindow, WM_WA_MPEG_EOF, 0, 0);
+  return 0;
+}
+
+static void pcm_get_file_info(const char *file, char *title,
+                              int *length_in_ms) {
+  if (title != NULL) {
+    snprintf(title, GETFILEINFO_TITLE_LENGTH, "%s (%d Hz, %d channels)",
+             (file == NULL || file[0] == '\0') ? g_path : file,
+             g_sample_rate, g_channels);
+  }
+  if (length_in_ms != NULL) {
+    *length_in_ms = 0; // i.e. unknown, a stream
+  }
+}
+
+static int __cdecl pcm_is_our_file(const char *fn) {
+  return 1; // i.e. anything is raw PCM to us
+}
+
+static void __cdecl pcm_stop();
+
+static int __cdecl pcm_play(const char *fn) {
+  pcm_stop(); // i.e. in case of a track that just finished
+
+  snprintf(g_path, sizeof(g_path), "%s", fn);
+
+  if (!builtin_input_open(g_sample_rate, g_channels, g_bits_per_sample)) {
+    return 1;
+  }
+
+  g_stop_requested = 0;
+  g_reader_thread = CreateThread(NULL, 0, reader_thread_main, NULL, 0, NULL);
+  if (g_reader_thread == NULL) {
+    log_error("Could not start reader thread.");
+    builtin_input_close();
+    return 1;
+  }
+  return 0;
+}
+
+static void __cdecl pcm_stop() {
+  if (g_reader_thread == NULL) {
+    return;
+  }
+  InterlockedExchange(&g_stop_requested, 1);
+  // The reader may be blocked opening (e.g. a FIFO without a writer), or
+  // reading from a writer that has nothing to say
+  stream_io_join_thread(g_reader_thread, NULL);
+  g_reader_thread = NULL;
+
+  builtin_input_close();
+}
+
+static int __cdecl pcm_get_length() {
+  return -1000; // i.e. unknown, a stream
+}
+
+static void __cdecl pcm_set_output_time(int time_in_ms) {}
+
+In_Module *pcm_input_module(const char *parameters) {
+  int sample_rate = 44100;
+  int channels = 2;
+  int bits_per_sample = 16;
+  char trailing;
+  if (parameters[0] != '\0' &&
+      sscanf(parameters, "%d,%d,%d%c", &sample_rate, &channels,
+             &bits_per_sample, &trailing) != 3) {
+    log_error("Built-in PCM input needs parameters like \"44100,2,16\", "
+              "got \"%s\".",
+              parameters);
+    return NULL;
+  }
+  if (sample_rate <= 0 || channels <= 0 ||
+      channels > BUILTIN_INPUT_CHANNELS_MAX ||
+      !pcm_bits_supported(bits_per_sample)) {
+    log_error("Cannot play %d Hz, %d channels at %d bits.", sample_rate,
+              channels, bits_per_sample);
+    return NULL;
+  }
+  g_sample_rate = sample_rate;
+  g_channels = channels;
+  g_bits_per_sample = bits_per_sample;
+  g_block_align = channels * bits_per_sample / 8;
+
+  builtin_input_init(&g_in_module);
+  g_in_module.description = "visdriver raw PCM input";
+  g_in_module.FileExtensions = "PCM;RAW\0Raw PCM Audio (*.PCM)\0";
+  g_in_module.is_seekable = 0;
+  g_in_module.GetFileInfo = pcm_get_file_info;
+  g_in_module.IsOurFile = pcm_is_our_file;
+  g_in_module.Play = pcm_play;
+  g_in_module.Stop = pcm_stop;
+  g_in_module.GetLength = pcm_get_length;
+  g_in_module.SetOutputTime = pcm_set_output_time;
+  return &g_in_module;
+}
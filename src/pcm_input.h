@@ -0,0 +1,38 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef PCM_INPUT_H
+#define PCM_INPUT_H
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <winamp/in2.h>
+
+#define PCM_INPUT_READ_BYTES 32768
+
+// A built-in input plug-in for raw interleaved PCM (little endian, 8 bit
+// unsigned or 16/24/32 bit signed) of the format given as parameters
+// "RATE,CHANNELS,BITS" (default: "44100,2,16").  Tracks are paths to read
+// from: files, FIFOs (e.g. on drive Z: under Wine), named pipes like
+// "\\.\pipe\NAME" created by the writer, or "-" for stdin (whose end
+// ends playback).  Reads return whatever is there already, so audio is
+// passed on without waiting for blocks to fill.  Returns NULL for bad
+// parameters.
+In_Module *pcm_input_module(const char *parameters);
+
+#endif // ifndef PCM_INPUT_H
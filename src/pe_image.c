@@ -0,0 +1,149 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "pe_image.h"
+
+static const IMAGE_NT_HEADERS *nt_headers_of(HMODULE module) {
+  const BYTE *const base = (const BYTE *)module;
+  if (base == NULL) {
+    return NULL;
+  }
+
+  const IMAGE_DOS_HEADER *const dos_header = (const IMAGE_DOS_HEADER *)base;
+  if (dos_header->e_magic != IMAGE_DOS_SIGNATURE) {
+    return NULL;
+  }
+
+  const IMAGE_NT_HEADERS *const nt_headers =
+      (const IMAGE_NT_HEADERS *)(base + dos_header->e_lfanew);
+  if (nt_headers->Signature != IMAGE_NT_SIGNATURE) {
+    return NULL;
+  }
+
+  return nt_headers;
+}
+
+SIZE_T pe_image_size(HMODULE module) {
+  const IMAGE_NT_HEADERS *const nt_headers = nt_headers_of(module);
+  return (nt_headers == NULL) ? 0 : nt_headers->OptionalHeader.SizeOfImage;
+}
+
+const char *pe_nearest_export(HMODULE module, ULONG_PTR address,
+                              ULONG_PTR *p_offset) {
+  const IMAGE_NT_HEADERS *const nt_headers = nt_headers_of(module);
+  if (nt_headers == NULL) {
+    return NULL;
+  }
+
+  const IMAGE_DATA_DIRECTORY *const directory =
+      &nt_headers->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT];
+  if (directory->VirtualAddress == 0 || directory->Size == 0) {
+    return NULL;
+  }
+
+  const BYTE *const base = (const BYTE *)module;
+  const IMAGE_EXPORT_DIRECTORY *const exports =
+      (const IMAGE_EXPORT_DIRECTORY *)(base + directory->VirtualAddress);
+  const DWORD *const function_rvas =
+      (const DWORD *)(base + exports->AddressOfFunctions);
+  const DWORD *const name_rvas =
+      (const DWORD *)(base + exports->AddressOfNames);
+  const WORD *const name_ordinals =
+      (const WORD *)(base + exports->AddressOfNameOrdinals);
+
+  const ULONG_PTR wanted_rva = address - (ULONG_PTR)base;
+  const char *best_name = NULL;
+  DWORD best_rva = 0;
+
+  for (DWORD i = 0; i < exports->NumberOfNames; i++) {
+    const DWORD function_rva = function_rvas[name_ordinals[i]];
+
+    // Forwarders point into the export directory rather than to code
+    const bool is_forwarder =
+        function_rva >= directory->VirtualAddress &&
+        function_rva < directory->VirtualAddress + directory->Size;
+    if (is_forwarder || function_rva > wanted_rva) {
+      continue;
+    }
+
+    if (best_name == NULL || function_rva > best_rva) {
+      best_name = (const char *)(base + name_rvas[i]);
+      best_rva = function_rva;
+    }
+  }
+
+  if (best_name != NULL) {
+    *p_offset = wanted_rva - best_rva;
+  }
+  return best_name;
+}
+
+static void patch_pointer(ULONG_PTR *target, ULONG_PTR value) {
+  DWORD previous_protection;
+  if (!VirtualProtect(target, sizeof(*target), PAGE_READWRITE,
+                      &previous_protection)) {
+    return;
+  }
+  *target = value;
+  VirtualProtect(target, sizeof(*target), previous_protection,
+                 &previous_protection);
+}
+
+int pe_hook_imports(HMODULE module, const char *function_name,
+                    const void *replacement) {
+  const IMAGE_NT_HEADERS *const nt_headers = nt_headers_of(module);
+  if (nt_headers == NULL) {
+    return 0;
+  }
+
+  const IMAGE_DATA_DIRECTORY *const directory =
+      &nt_headers->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+  if (directory->VirtualAddress == 0 || directory->Size == 0) {
+    return 0;
+  }
+
+  BYTE *const base = (BYTE *)module;
+  int count = 0;
+  for (const IMAGE_IMPORT_DESCRIPTOR *descriptor =
+           (const IMAGE_IMPORT_DESCRIPTOR *)(base + directory->VirtualAddress);
+       descriptor->Name != 0; descriptor++) {
+    // Without the original thunks, names are gone after binding
+    if (descriptor->OriginalFirstThunk == 0) {
+      continue;
+    }
+    const IMAGE_THUNK_DATA *const names =
+        (const IMAGE_THUNK_DATA *)(base + descriptor->OriginalFirstThunk);
+    IMAGE_THUNK_DATA *const addresses =
+        (IMAGE_THUNK_DATA *)(base + descriptor->FirstThunk);
+
+    for (int i = 0; names[i].u1.AddressOfData != 0; i++) {
+      if (IMAGE_SNAP_BY_ORDINAL(names[i].u1.Ordinal)) {
+        continue;
+      }
+      const IMAGE_IMPORT_BY_NAME *const by_name =
+          (const IMAGE_IMPORT_BY_NAME *)(base + names[i].u1.AddressOfData);
+      if (strcmp((const char *)by_name->Name, function_name) == 0) {
+        patch_pointer(&addresses[i].u1.Function, (ULONG_PTR)replacement);
+        count++;
+      }
+    }
+  }
+  return count;
+}
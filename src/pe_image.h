@@ -0,0 +1,36 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef PE_IMAGE_H
+#define PE_IMAGE_H
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+// Returns 0 for anything that does not look like a loaded PE image
+SIZE_T pe_image_size(HMODULE module);
+
+// Finds the closest export at or below the given address, if any
+const char *pe_nearest_export(HMODULE module, ULONG_PTR address,
+                              ULONG_PTR *p_offset);
+
+// Points all imports of the given function name (from whichever DLL) in
+// the module's import address table to the replacement, returns how many
+int pe_hook_imports(HMODULE module, const char *function_name,
+                    const void *replacement);
+
+#endif // ifndef PE_IMAGE_H
@@ -0,0 +1,530 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "histogram.h"
+#include "log.h"
+#include "metrics.h"
+#include "plugin_proxy.h"
+#include "timing.h"
+
+#define VIS_PROXY_MAX 16
+
+typedef struct _call_stats_t {
+  const char *name;
+  bool has_values; // i.e. argument sizes or results are worth recording
+  volatile LONG calls;
+  histogram_t latency_us;
+  histogram_t values;
+} call_stats_t;
+
+typedef struct _plugin_stats_t {
+  char title[256];
+  call_stats_t *functions;
+  size_t function_count;
+} plugin_stats_t;
+
+enum {
+  IN_CONFIG,
+  IN_ABOUT,
+  IN_INIT,
+  IN_QUIT,
+  IN_GET_FILE_INFO,
+  IN_INFO_BOX,
+  IN_IS_OUR_FILE,
+  IN_PLAY,
+  IN_PAUSE,
+  IN_UN_PAUSE,
+  IN_IS_PAUSED,
+  IN_STOP,
+  IN_GET_LENGTH,
+  IN_GET_OUTPUT_TIME,
+  IN_SET_OUTPUT_TIME,
+  IN_SET_VOLUME,
+  IN_SET_PAN,
+  IN_FUNCTION_COUNT
+};
+
+enum {
+  OUT_CONFIG,
+  OUT_ABOUT,
+  OUT_INIT,
+  OUT_QUIT,
+  OUT_OPEN,
+  OUT_CLOSE,
+  OUT_WRITE,
+  OUT_CAN_WRITE,
+  OUT_IS_PLAYING,
+  OUT_PAUSE,
+  OUT_SET_VOLUME,
+  OUT_SET_PAN,
+  OUT_FLUSH,
+  OUT_GET_OUTPUT_TIME,
+  OUT_GET_WRITTEN_TIME,
+  OUT_FUNCTION_COUNT
+};
+
+enum { VIS_CONFIG, VIS_INIT, VIS_RENDER, VIS_QUIT, VIS_FUNCTION_COUNT };
+
+typedef struct _vis_proxy_t {
+  winampVisModule *module;
+  HINSTANCE dll_handle;  // i.e. to tell apart DLLs loaded to the same address
+  char description[128]; // ditto
+  winampVisModule real; // holds the original function pointers
+  call_stats_t functions[VIS_FUNCTION_COUNT];
+  plugin_stats_t stats;
+} vis_proxy_t;
+
+static In_Module g_real_input_module; // holds the original function pointers
+static Out_Module g_real_output_module; // holds the original function pointers
+
+static call_stats_t g_input_functions[IN_FUNCTION_COUNT] = {
+    {"Config"},        {"About"},         {"Init"},      {"Quit"},
+    {"GetFileInfo"},   {"InfoBox"},       {"IsOurFile"}, {"Play"},
+    {"Pause"},         {"UnPause"},       {"IsPaused"},  {"Stop"},
+    {"GetLength"},     {"GetOutputTime"}, {"SetOutputTime", true},
+    {"SetVolume"},     {"SetPan"},
+};
+
+static call_stats_t g_output_functions[OUT_FUNCTION_COUNT] = {
+    {"Config"},        {"About"},          {"Init"},
+    {"Quit"},          {"Open", true},     {"Close"},
+    {"Write", true},   {"CanWrite", true}, {"IsPlaying"},
+    {"Pause"},         {"SetVolume"},      {"SetPan"},
+    {"Flush", true},   {"GetOutputTime"},  {"GetWrittenTime"},
+};
+
+static plugin_stats_t g_input_stats = {"", NULL, 0};
+static plugin_stats_t g_output_stats = {"", NULL, 0};
+static vis_proxy_t g_vis_proxies[VIS_PROXY_MAX];
+static volatile LONG g_vis_proxy_count = 0;
+
+static void record_call(call_stats_t *stats, LONGLONG started_at_us) {
+  histogram_add(&stats->latency_us, timing_now_us() - started_at_us);
+  InterlockedIncrement(&stats->calls);
+}
+
+static void record_value(call_stats_t *stats, LONGLONG value) {
+  histogram_add(&stats->values, (value < 0) ? 0 : value);
+}
+
+static void init_plugin_stats(plugin_stats_t *stats, const char *kind,
+                              const char *description,
+                              call_stats_t *functions, size_t count) {
+  snprintf(stats->title, sizeof(stats->title), "%s plug-in \"%s\"", kind,
+           description ? description : "???");
+  stats->functions = functions;
+  stats->function_count = count;
+}
+
+// Input plug-in wrappers
+
+static void __cdecl in_config(HWND hwndParent) {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_input_module.Config(hwndParent);
+  record_call(&g_input_functions[IN_CONFIG], started_at_us);
+}
+
+static void __cdecl in_about(HWND hwndParent) {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_input_module.About(hwndParent);
+  record_call(&g_input_functions[IN_ABOUT], started_at_us);
+}
+
+static int __cdecl in_init() {
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = g_real_input_module.Init();
+  record_call(&g_input_functions[IN_INIT], started_at_us);
+  return result;
+}
+
+static void __cdecl in_quit() {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_input_module.Quit();
+  record_call(&g_input_functions[IN_QUIT], started_at_us);
+}
+
+static void in_get_file_info(const in_char *file, in_char *title,
+                             int *length_in_ms) {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_input_module.GetFileInfo(file, title, length_in_ms);
+  record_call(&g_input_functions[IN_GET_FILE_INFO], started_at_us);
+}
+
+static int __cdecl in_info_box(const in_char *file, HWND hwndParent) {
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = g_real_input_module.InfoBox(file, hwndParent);
+  record_call(&g_input_functions[IN_INFO_BOX], started_at_us);
+  return result;
+}
+
+static int __cdecl in_is_our_file(const in_char *fn) {
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = g_real_input_module.IsOurFile(fn);
+  record_call(&g_input_functions[IN_IS_OUR_FILE], started_at_us);
+  return result;
+}
+
+static int __cdecl in_play(const in_char *fn) {
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = g_real_input_module.Play(fn);
+  record_call(&g_input_functions[IN_PLAY], started_at_us);
+  return result;
+}
+
+static void __cdecl in_pause() {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_input_module.Pause();
+  record_call(&g_input_functions[IN_PAUSE], started_at_us);
+}
+
+static void __cdecl in_un_pause() {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_input_module.UnPause();
+  record_call(&g_input_functions[IN_UN_PAUSE], started_at_us);
+}
+
+static int __cdecl in_is_paused() {
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = g_real_input_module.IsPaused();
+  record_call(&g_input_functions[IN_IS_PAUSED], started_at_us);
+  return result;
+}
+
+static void __cdecl in_stop() {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_input_module.Stop();
+  record_call(&g_input_functions[IN_STOP], started_at_us);
+}
+
+static int __cdecl in_get_length() {
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = g_real_input_module.GetLength();
+  record_call(&g_input_functions[IN_GET_LENGTH], started_at_us);
+  return result;
+}
+
+static int __cdecl in_get_output_time() {
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = g_real_input_module.GetOutputTime();
+  record_call(&g_input_functions[IN_GET_OUTPUT_TIME], started_at_us);
+  return result;
+}
+
+static void __cdecl in_set_output_time(int time_in_ms) {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_input_module.SetOutputTime(time_in_ms);
+  record_value(&g_input_functions[IN_SET_OUTPUT_TIME], time_in_ms);
+  record_call(&g_input_functions[IN_SET_OUTPUT_TIME], started_at_us);
+}
+
+static void __cdecl in_set_volume(int volume) {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_input_module.SetVolume(volume);
+  record_call(&g_input_functions[IN_SET_VOLUME], started_at_us);
+}
+
+static void __cdecl in_set_pan(int pan) {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_input_module.SetPan(pan);
+  record_call(&g_input_functions[IN_SET_PAN], started_at_us);
+}
+
+void proxy_input_module(In_Module *in_module) {
+  g_real_input_module = *in_module;
+  init_plugin_stats(&g_input_stats, "Input", in_module->description,
+                    g_input_functions, IN_FUNCTION_COUNT);
+
+  in_module->Config = in_config;
+  in_module->About = in_about;
+  in_module->Init = in_init;
+  in_module->Quit = in_quit;
+  in_module->GetFileInfo = in_get_file_info;
+  in_module->InfoBox = in_info_box;
+  in_module->IsOurFile = in_is_our_file;
+  in_module->Play = in_play;
+  in_module->Pause = in_pause;
+  in_module->UnPause = in_un_pause;
+  in_module->IsPaused = in_is_paused;
+  in_module->Stop = in_stop;
+  in_module->GetLength = in_get_length;
+  in_module->GetOutputTime = in_get_output_time;
+  in_module->SetOutputTime = in_set_output_time;
+  in_module->SetVolume = in_set_volume;
+  in_module->SetPan = in_set_pan;
+}
+
+// Output plug-in wrappers (as seen by both the input plug-in and us)
+
+static void __cdecl out_config(HWND hwndParent) {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_output_module.Config(hwndParent);
+  record_call(&g_output_functions[OUT_CONFIG], started_at_us);
+}
+
+static void __cdecl out_about(HWND hwndParent) {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_output_module.About(hwndParent);
+  record_call(&g_output_functions[OUT_ABOUT], started_at_us);
+}
+
+static void __cdecl out_init() {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_output_module.Init();
+  record_call(&g_output_functions[OUT_INIT], started_at_us);
+}
+
+static void __cdecl out_quit() {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_output_module.Quit();
+  record_call(&g_output_functions[OUT_QUIT], started_at_us);
+}
+
+static int __cdecl out_open(int samplerate, int numchannels, int bitspersamp,
+                            int bufferlenms, int prebufferms) {
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = g_real_output_module.Open(
+      samplerate, numchannels, bitspersamp, bufferlenms, prebufferms);
+  metrics_note_output_reset();
+  record_value(&g_output_functions[OUT_OPEN], result); // i.e. max latency
+  record_call(&g_output_functions[OUT_OPEN], started_at_us);
+  return result;
+}
+
+static void __cdecl out_close() {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_output_module.Close();
+  record_call(&g_output_functions[OUT_CLOSE], started_at_us);
+}
+
+static int __cdecl out_write(char *buf, int len) {
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = g_real_output_module.Write(buf, len);
+  metrics_note_write();
+  record_value(&g_output_functions[OUT_WRITE], len);
+  record_call(&g_output_functions[OUT_WRITE], started_at_us);
+  return result;
+}
+
+static int __cdecl out_can_write() {
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = g_real_output_module.CanWrite();
+  metrics_note_can_write(result);
+  record_value(&g_output_functions[OUT_CAN_WRITE], result);
+  record_call(&g_output_functions[OUT_CAN_WRITE], started_at_us);
+  return result;
+}
+
+static int __cdecl out_is_playing() {
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = g_real_output_module.IsPlaying();
+  record_call(&g_output_functions[OUT_IS_PLAYING], started_at_us);
+  return result;
+}
+
+static int __cdecl out_pause(int pause) {
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = g_real_output_module.Pause(pause);
+  record_call(&g_output_functions[OUT_PAUSE], started_at_us);
+  return result;
+}
+
+static void __cdecl out_set_volume(int volume) {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_output_module.SetVolume(volume);
+  record_call(&g_output_functions[OUT_SET_VOLUME], started_at_us);
+}
+
+static void __cdecl out_set_pan(int pan) {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_output_module.SetPan(pan);
+  record_call(&g_output_functions[OUT_SET_PAN], started_at_us);
+}
+
+static void __cdecl out_flush(int t) {
+  const LONGLONG started_at_us = timing_now_us();
+  g_real_output_module.Flush(t);
+  metrics_note_output_reset();
+  record_value(&g_output_functions[OUT_FLUSH], t);
+  record_call(&g_output_functions[OUT_FLUSH], started_at_us);
+}
+
+static int __cdecl out_get_output_time() {
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = g_real_output_module.GetOutputTime();
+  record_call(&g_output_functions[OUT_GET_OUTPUT_TIME], started_at_us);
+  return result;
+}
+
+static int __cdecl out_get_written_time() {
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = g_real_output_module.GetWrittenTime();
+  record_call(&g_output_functions[OUT_GET_WRITTEN_TIME], started_at_us);
+  return result;
+}
+
+void proxy_output_module(Out_Module *out_module) {
+  g_real_output_module = *out_module;
+  init_plugin_stats(&g_output_stats, "Output", out_module->description,
+                    g_output_functions, OUT_FUNCTION_COUNT);
+
+  out_module->Config = out_config;
+  out_module->About = out_about;
+  out_module->Init = out_init;
+  out_module->Quit = out_quit;
+  out_module->Open = out_open;
+  out_module->Close = out_close;
+  out_module->Write = out_write;
+  out_module->CanWrite = out_can_write;
+  out_module->IsPlaying = out_is_playing;
+  out_module->Pause = out_pause;
+  out_module->SetVolume = out_set_volume;
+  out_module->SetPan = out_set_pan;
+  out_module->Flush = out_flush;
+  out_module->GetOutputTime = out_get_output_time;
+  out_module->GetWrittenTime = out_get_written_time;
+}
+
+// Vis plug-in wrappers; these receive the module so we can tell them apart
+
+// The latest proxy wins, earlier ones of the same address are stale
+static vis_proxy_t *find_vis_proxy(const winampVisModule *this_mod) {
+  for (LONG i = g_vis_proxy_count - 1; i >= 0; i--) {
+    if (g_vis_proxies[i].module == this_mod) {
+      return &g_vis_proxies[i];
+    }
+  }
+  return NULL;
+}
+
+static void __cdecl vis_config(struct winampVisModule *this_mod) {
+  vis_proxy_t *const proxy = find_vis_proxy(this_mod);
+  const LONGLONG started_at_us = timing_now_us();
+  proxy->real.Config(this_mod);
+  record_call(&proxy->functions[VIS_CONFIG], started_at_us);
+}
+
+static int __cdecl vis_init(struct winampVisModule *this_mod) {
+  vis_proxy_t *const proxy = find_vis_proxy(this_mod);
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = proxy->real.Init(this_mod);
+  record_call(&proxy->functions[VIS_INIT], started_at_us);
+  return result;
+}
+
+static int __cdecl vis_render(struct winampVisModule *this_mod) {
+  vis_proxy_t *const proxy = find_vis_proxy(this_mod);
+  const LONGLONG started_at_us = timing_now_us();
+  const int result = proxy->real.Render(this_mod);
+  record_call(&proxy->functions[VIS_RENDER], started_at_us);
+  return result;
+}
+
+static void __cdecl vis_quit(struct winampVisModule *this_mod) {
+  vis_proxy_t *const proxy = find_vis_proxy(this_mod);
+  const LONGLONG started_at_us = timing_now_us();
+  proxy->real.Quit(this_mod);
+  record_call(&proxy->functions[VIS_QUIT], started_at_us);
+}
+
+static bool is_same_vis_plugin(const vis_proxy_t *proxy,
+                               const winampVisModule *vis_module) {
+  return proxy->dll_handle == vis_module->hDllInstance &&
+         strncmp(proxy->description,
+                 vis_module->description ? vis_module->description : "???",
+                 sizeof(proxy->description) - 1) == 0;
+}
+
+void proxy_vis_module(winampVisModule *vis_module) {
+  vis_proxy_t *const known_proxy = find_vis_proxy(vis_module);
+  if (known_proxy != NULL && is_same_vis_plugin(known_proxy, vis_module)) {
+    if (vis_module->Render == vis_render) {
+      return; // i.e. already wrapped
+    }
+    // The DLL was reloaded to the same address, keep counting
+    known_proxy->real = *vis_module;
+    vis_module->Config = vis_config;
+    vis_module->Init = vis_init;
+    vis_module->Render = vis_render;
+    vis_module->Quit = vis_quit;
+    return;
+  }
+  if (g_vis_proxy_count >= VIS_PROXY_MAX) {
+    log_error("Cannot trace more than %d vis modules, not tracing \"%s\".",
+              VIS_PROXY_MAX, vis_module->description);
+    return;
+  }
+
+  vis_proxy_t *const proxy = &g_vis_proxies[g_vis_proxy_count];
+  static const char *const function_names[VIS_FUNCTION_COUNT] = {
+      "Config", "Init", "Render", "Quit"};
+  for (int i = 0; i < VIS_FUNCTION_COUNT; i++) {
+    proxy->functions[i].name = function_names[i];
+  }
+  init_plugin_stats(&proxy->stats, "Vis", vis_module->description,
+                    proxy->functions, VIS_FUNCTION_COUNT);
+  proxy->module = vis_module;
+  proxy->dll_handle = vis_module->hDllInstance;
+  snprintf(proxy->description, sizeof(proxy->description), "%s",
+           vis_module->description ? vis_module->description : "???");
+  proxy->real = *vis_module;
+
+  // Publish only once fully set up, wrappers may run on other threads
+  InterlockedIncrement(&g_vis_proxy_count);
+
+  vis_module->Config = vis_config;
+  vis_module->Init = vis_init;
+  vis_module->Render = vis_render;
+  vis_module->Quit = vis_quit;
+}
+
+static void log_plugin_stats(const plugin_stats_t *stats) {
+  if (stats->functions == NULL) {
+    return; // i.e. not proxied
+  }
+
+  log_info("Calls into %s:", stats->title);
+  for (size_t i = 0; i < stats->function_count; i++) {
+    const call_stats_t *const function = &stats->functions[i];
+    if (function->calls == 0) {
+      continue;
+    }
+
+    char latency[128];
+    histogram_format_us(&function->latency_us, latency, sizeof(latency));
+    if (function->has_values) {
+      char values[128];
+      histogram_format(&function->values, values, sizeof(values));
+      log_info("  %-14s %8ld calls, latency %s, values %s", function->name,
+               function->calls, latency, values);
+    } else {
+      log_info("  %-14s %8ld calls, latency %s", function->name,
+               function->calls, latency);
+    }
+  }
+}
+
+void log_plugin_proxy_summary() {
+  log_plugin_stats(&g_input_stats);
+  log_plugin_stats(&g_output_stats);
+  for (LONG i = 0; i < g_vis_proxy_count; i++) {
+    log_plugin_stats(&g_vis_proxies[i].stats);
+  }
+}
@@ -0,0 +1,40 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef PLUGIN_PROXY_H
+#define PLUGIN_PROXY_H
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <winamp/in2.h>
+#include <winamp/out.h>
+#include <winamp/vis.h>
+
+// These replace the function pointers of a loaded plug-in by wrappers
+// that count and time all calls, in place so that everyone holding
+// a pointer to the module (e.g. the input plug-in for outMod) is covered.
+// The output module wrappers also feed the pipeline metrics.
+void proxy_input_module(In_Module *in_module);
+
+void proxy_output_module(Out_Module *out_module);
+
+void proxy_vis_module(winampVisModule *vis_module);
+
+void log_plugin_proxy_summary();
+
+#endif // ifndef PLUGIN_PROXY_H
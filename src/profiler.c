@@ -0,0 +1,310 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h> // qsort
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <tlhelp32.h>
+
+#include "log.h"
+#include "module_registry.h"
+#include "profiler.h"
+
+#define PROFILER_INTERVAL_MS 5
+#define PROFILER_THREAD_REFRESH_TICKS 100
+#define PROFILER_THREADS_MAX 128
+#define PROFILER_HOT_SPOTS_MAX 4096 // must be a power of two
+#define PROFILER_ADDRESS_GRANULARITY 16
+#define PROFILER_TOP_HOT_SPOTS 15
+#define PROFILER_MODULES_MAX 64
+
+typedef struct _sampled_thread_t {
+  DWORD id;
+  HANDLE handle;
+  ULONG64 cycles;
+  bool seen;
+} sampled_thread_t;
+
+typedef struct _hot_spot_t {
+  ULONG_PTR address;
+  LONG samples;
+} hot_spot_t;
+
+typedef struct _module_samples_t {
+  char name[MAX_PATH];
+  LONG samples;
+} module_samples_t;
+
+static HANDLE g_profiler_thread = NULL;
+static volatile LONG g_profiler_running = 0;
+static DWORD g_profiler_thread_id = 0;
+
+// Only touched by the profiler thread
+static sampled_thread_t g_threads[PROFILER_THREADS_MAX];
+static size_t g_thread_count = 0;
+
+// Shared with the thread writing summaries
+static SRWLOCK g_hot_spots_lock = SRWLOCK_INIT;
+static hot_spot_t g_hot_spots[PROFILER_HOT_SPOTS_MAX];
+static LONG g_samples = 0;
+static LONG g_samples_lost = 0;
+
+static ULONG_PTR instruction_pointer_of(const CONTEXT *context) {
+#if defined(_M_X64) || defined(__x86_64__)
+  return (ULONG_PTR)context->Rip;
+#else
+  return (ULONG_PTR)context->Eip;
+#endif
+}
+
+static void refresh_threads() {
+  const HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+  if (snapshot == INVALID_HANDLE_VALUE) {
+    return;
+  }
+
+  for (size_t i = 0; i < g_thread_count; i++) {
+    g_threads[i].seen = false;
+  }
+
+  const DWORD process_id = GetCurrentProcessId();
+  THREADENTRY32 entry;
+  entry.dwSize = sizeof(entry);
+  for (BOOL ok = Thread32First(snapshot, &entry); ok;
+       ok = Thread32Next(snapshot, &entry)) {
+    if (entry.th32OwnerProcessID != process_id ||
+        entry.th32ThreadID == g_profiler_thread_id) {
+      continue;
+    }
+
+    bool known = false;
+    for (size_t i = 0; i < g_thread_count; i++) {
+      if (g_threads[i].id == entry.th32ThreadID) {
+        g_threads[i].seen = true;
+        known = true;
+        break;
+      }
+    }
+    if (known || g_thread_count >= PROFILER_THREADS_MAX) {
+      continue;
+    }
+
+    const HANDLE handle =
+        OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT |
+                       THREAD_QUERY_INFORMATION,
+                   FALSE, entry.th32ThreadID);
+    if (handle == NULL) {
+      continue;
+    }
+
+    sampled_thread_t *const thread = &g_threads[g_thread_count++];
+    thread->id = entry.th32ThreadID;
+    thread->handle = handle;
+    thread->cycles = 0;
+    thread->seen = true;
+  }
+
+  CloseHandle(snapshot);
+
+  // Forget about threads that have exited
+  for (size_t i = 0; i < g_thread_count;) {
+    if (g_threads[i].seen) {
+      i++;
+      continue;
+    }
+    CloseHandle(g_threads[i].handle);
+    g_threads[i] = g_threads[--g_thread_count];
+  }
+}
+
+static void record_sample(ULONG_PTR address) {
+  address -= address % PROFILER_ADDRESS_GRANULARITY;
+
+  AcquireSRWLockExclusive(&g_hot_spots_lock);
+  size_t index = (size_t)((address / PROFILER_ADDRESS_GRANULARITY) *
+                          2654435761u) &
+                 (PROFILER_HOT_SPOTS_MAX - 1);
+  bool recorded = false;
+  for (size_t probe = 0; probe < PROFILER_HOT_SPOTS_MAX; probe++) {
+    hot_spot_t *const hot_spot = &g_hot_spots[index];
+    if (hot_spot->samples == 0 || hot_spot->address == address) {
+      hot_spot->address = address;
+      hot_spot->samples++;
+      recorded = true;
+      break;
+    }
+    index = (index + 1) & (PROFILER_HOT_SPOTS_MAX - 1);
+  }
+  g_samples++;
+  if (!recorded) {
+    g_samples_lost++;
+  }
+  ReleaseSRWLockExclusive(&g_hot_spots_lock);
+}
+
+static void sample_threads() {
+  for (size_t i = 0; i < g_thread_count; i++) {
+    sampled_thread_t *const thread = &g_threads[i];
+
+    // Skip threads that have not been running since the last tick,
+    // e.g. those blocked in a wait, to only count actual CPU usage.
+    ULONG64 cycles = 0;
+    if (!QueryThreadCycleTime(thread->handle, &cycles) ||
+        cycles == thread->cycles) {
+      continue;
+    }
+    thread->cycles = cycles;
+
+    // NOTE: Nothing in between suspend and resume must take locks
+    //       (e.g. of the heap) that the suspended thread could hold.
+    if (SuspendThread(thread->handle) == (DWORD)-1) {
+      continue;
+    }
+    CONTEXT context;
+    memset(&context, 0, sizeof(context));
+    context.ContextFlags = CONTEXT_CONTROL;
+    const BOOL got_context = GetThreadContext(thread->handle, &context);
+    ResumeThread(thread->handle);
+
+    if (got_context) {
+      record_sample(instruction_pointer_of(&context));
+    }
+  }
+}
+
+static DWORD WINAPI profiler_thread_main(LPVOID parameter) {
+  (void)parameter;
+  unsigned int ticks = 0;
+  while (g_profiler_running) {
+    if (ticks++ % PROFILER_THREAD_REFRESH_TICKS == 0) {
+      refresh_threads();
+    }
+    sample_threads();
+    Sleep(PROFILER_INTERVAL_MS);
+  }
+
+  for (size_t i = 0; i < g_thread_count; i++) {
+    CloseHandle(g_threads[i].handle);
+  }
+  g_thread_count = 0;
+  return 0;
+}
+
+bool profiler_start() {
+  InterlockedExchange(&g_profiler_running, 1);
+  g_profiler_thread = CreateThread(NULL, 0, profiler_thread_main, NULL, 0,
+                                   &g_profiler_thread_id);
+  if (g_profiler_thread == NULL) {
+    log_error("Could not start profiler thread.");
+    InterlockedExchange(&g_profiler_running, 0);
+    return false;
+  }
+  SetThreadPriority(g_profiler_thread, THREAD_PRIORITY_TIME_CRITICAL);
+  return true;
+}
+
+void profiler_stop() {
+  if (g_profiler_thread == NULL) {
+    return;
+  }
+  InterlockedExchange(&g_profiler_running, 0);
+  WaitForSingleObject(g_profiler_thread, INFINITE);
+  CloseHandle(g_profiler_thread);
+  g_profiler_thread = NULL;
+}
+
+static int compare_hot_spots(const void *a, const void *b) {
+  return ((const hot_spot_t *)b)->samples - ((const hot_spot_t *)a)->samples;
+}
+
+static int compare_module_samples(const void *a, const void *b) {
+  return ((const module_samples_t *)b)->samples -
+         ((const module_samples_t *)a)->samples;
+}
+
+void log_profiler_summary() {
+  static hot_spot_t hot_spots[PROFILER_HOT_SPOTS_MAX];
+  static module_samples_t modules[PROFILER_MODULES_MAX];
+
+  AcquireSRWLockShared(&g_hot_spots_lock);
+  memcpy(hot_spots, g_hot_spots, sizeof(hot_spots));
+  const LONG samples = g_samples;
+  const LONG samples_lost = g_samples_lost;
+  ReleaseSRWLockShared(&g_hot_spots_lock);
+
+  if (samples == 0) {
+    log_info("Profile: No samples taken, yet.");
+    return;
+  }
+
+  qsort(hot_spots, PROFILER_HOT_SPOTS_MAX, sizeof(hot_spot_t),
+        compare_hot_spots);
+
+  // Aggregate per DLL, remembering locations of the top hot spots
+  char locations[PROFILER_TOP_HOT_SPOTS][MAX_PATH + 64];
+  size_t module_count = 0;
+  for (size_t i = 0; i < PROFILER_HOT_SPOTS_MAX; i++) {
+    if (hot_spots[i].samples == 0) {
+      break;
+    }
+
+    char location[MAX_PATH + 64];
+    char module_name[MAX_PATH];
+    module_registry_describe(hot_spots[i].address, location, sizeof(location),
+                             module_name, sizeof(module_name));
+    if (i < PROFILER_TOP_HOT_SPOTS) {
+      snprintf(locations[i], sizeof(locations[i]), "%s", location);
+    }
+
+    size_t m = 0;
+    while (m < module_count && strcmp(modules[m].name, module_name) != 0) {
+      m++;
+    }
+    if (m == module_count) {
+      if (module_count >= PROFILER_MODULES_MAX) {
+        continue;
+      }
+      snprintf(modules[m].name, sizeof(modules[m].name), "%s", module_name);
+      modules[m].samples = 0;
+      module_count++;
+    }
+    modules[m].samples += hot_spots[i].samples;
+  }
+
+  qsort(modules, module_count, sizeof(module_samples_t),
+        compare_module_samples);
+
+  log_info("Profile of %ld samples (%ld not attributed) by DLL:", samples,
+           samples_lost);
+  for (size_t m = 0; m < module_count; m++) {
+    log_info("  %5.1f%%  %s", modules[m].samples * 100.0 / samples,
+             modules[m].name);
+  }
+
+  log_info("Profile hot spots by nearest export:");
+  for (size_t i = 0; i < PROFILER_TOP_HOT_SPOTS; i++) {
+    if (hot_spots[i].samples == 0) {
+      break;
+    }
+    log_info("  %5.1f%%  %s", hot_spots[i].samples * 100.0 / samples,
+             locations[i]);
+  }
+}
@@ -0,0 +1,186 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "module_registry.h"
+#include "render_watchdog.h"
+
+#define RENDER_WATCHDOG_STACK_DEPTH 16
+#define RENDER_WATCHDOG_INTERVAL_MIN_MS 10
+
+typedef struct _watched_render_t {
+  volatile LONG busy;
+  volatile LONG reported;
+  volatile LONG hung;
+  DWORD entered_at_ms;
+  HANDLE thread;
+  const char *description;
+} watched_render_t;
+
+static watched_render_t g_slots[RENDER_WATCHDOG_SLOTS];
+static HANDLE g_watchdog_thread = NULL;
+static volatile LONG g_watchdog_running = 0;
+static int g_stall_ms = 0;
+
+static ULONG_PTR instruction_pointer_of(const CONTEXT *context) {
+#if defined(_M_X64) || defined(__x86_64__)
+  return (ULONG_PTR)context->Rip;
+#else
+  return (ULONG_PTR)context->Eip;
+#endif
+}
+
+// Only collects addresses: the thread is suspended, so anything that could
+// take a lock it holds (e.g. the heap or logging) has to wait for later
+static int capture_stack(HANDLE thread, ULONG_PTR *addresses, int max_count) {
+  if (SuspendThread(thread) == (DWORD)-1) {
+    return 0;
+  }
+
+  int count = 0;
+  CONTEXT context;
+  memset(&context, 0, sizeof(context));
+  context.ContextFlags = CONTEXT_CONTROL;
+  if (GetThreadContext(thread, &context)) {
+    addresses[count++] = instruction_pointer_of(&context);
+
+#if !defined(_M_X64) && !defined(__x86_64__)
+    // Walk the chain of frame pointers, as far as it goes
+    const HANDLE process = GetCurrentProcess();
+    ULONG_PTR frame = (ULONG_PTR)context.Ebp;
+    while (count < max_count && frame != 0 && frame % sizeof(ULONG_PTR) == 0) {
+      ULONG_PTR pair[2]; // previous frame, return address
+      SIZE_T bytes_read = 0;
+      if (!ReadProcessMemory(process, (LPCVOID)frame, pair, sizeof(pair),
+                             &bytes_read) ||
+          bytes_read != sizeof(pair) || pair[1] == 0) {
+        break;
+      }
+      addresses[count++] = pair[1];
+      if (pair[0] <= frame) {
+        break; // i.e. not a stack frame further up
+      }
+      frame = pair[0];
+    }
+#endif
+  }
+
+  ResumeThread(thread);
+  return count;
+}
+
+static void report_stall(watched_render_t *watched, DWORD elapsed_ms) {
+  ULONG_PTR addresses[RENDER_WATCHDOG_STACK_DEPTH];
+  const int count =
+      capture_stack(watched->thread, addresses, RENDER_WATCHDOG_STACK_DEPTH);
+
+  log_error("Vis module \"%s\" has been stuck in Render for %ums:",
+            watched->description, (unsigned)elapsed_ms);
+  for (int i = 0; i < count; i++) {
+    char text[MAX_PATH + 64];
+    char module_name[MAX_PATH];
+    if (module_registry_describe(addresses[i], text, sizeof(text), module_name,
+                                 sizeof(module_name)) == NULL) {
+      snprintf(text, sizeof(text), "0x%p", (void *)addresses[i]);
+    }
+    log_error("  #%d %s", i, text);
+  }
+}
+
+static DWORD WINAPI watchdog_thread_main(LPVOID parameter) {
+  (void)parameter;
+  DWORD interval_ms = (DWORD)g_stall_ms / 4;
+  if (interval_ms < RENDER_WATCHDOG_INTERVAL_MIN_MS) {
+    interval_ms = RENDER_WATCHDOG_INTERVAL_MIN_MS;
+  }
+
+  while (g_watchdog_running) {
+    for (int i = 0; i < RENDER_WATCHDOG_SLOTS; i++) {
+      watched_render_t *const watched = &g_slots[i];
+      if (!watched->busy) {
+        continue;
+      }
+      const DWORD elapsed_ms = GetTickCount() - watched->entered_at_ms;
+      if (elapsed_ms >= (DWORD)g_stall_ms &&
+          InterlockedExchange(&watched->reported, 1) == 0) {
+        report_stall(watched, elapsed_ms);
+      }
+      if (elapsed_ms >= (DWORD)g_stall_ms * RENDER_WATCHDOG_HANG_FACTOR) {
+        InterlockedExchange(&watched->hung, 1);
+      }
+    }
+    Sleep(interval_ms);
+  }
+  return 0;
+}
+
+bool render_watchdog_start(int stall_ms) {
+  g_stall_ms = stall_ms;
+  InterlockedExchange(&g_watchdog_running, 1);
+  g_watchdog_thread =
+      CreateThread(NULL, 0, watchdog_thread_main, NULL, 0, NULL);
+  if (g_watchdog_thread == NULL) {
+    log_error("Could not start render watchdog thread.");
+    InterlockedExchange(&g_watchdog_running, 0);
+    g_stall_ms = 0;
+    return false;
+  }
+  SetThreadPriority(g_watchdog_thread, THREAD_PRIORITY_ABOVE_NORMAL);
+  return true;
+}
+
+void render_watchdog_stop() {
+  if (g_watchdog_thread == NULL) {
+    return;
+  }
+  InterlockedExchange(&g_watchdog_running, 0);
+  WaitForSingleObject(g_watchdog_thread, INFINITE);
+  CloseHandle(g_watchdog_thread);
+  g_watchdog_thread = NULL;
+  g_stall_ms = 0;
+}
+
+int render_watchdog_stall_ms() { return g_stall_ms; }
+
+void render_watchdog_enter(int slot, HANDLE thread, const char *description) {
+  watched_render_t *const watched = &g_slots[slot];
+  watched->thread = thread;
+  watched->description = description;
+  watched->entered_at_ms = GetTickCount();
+  InterlockedExchange(&watched->reported, 0);
+  InterlockedExchange(&watched->hung, 0); // i.e. from a call that returned
+  InterlockedExchange(&watched->busy, 1); // i.e. publish
+}
+
+void render_watchdog_leave(int slot) {
+  watched_render_t *const watched = &g_slots[slot];
+  InterlockedExchange(&watched->busy, 0);
+  InterlockedExchange(&watched->hung, 0);
+}
+
+bool render_watchdog_is_hung(int slot) {
+  return g_slots[slot].hung && g_slots[slot].busy;
+}
+
+void render_watchdog_forget(int slot) {
+  watched_render_t *const watched = &g_slots[slot];
+  InterlockedExchange(&watched->busy, 0);
+  InterlockedExchange(&watched->hung, 0);
+}
@@ -0,0 +1,50 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef RENDER_WATCHDOG_H
+#define RENDER_WATCHDOG_H
+
+#include <stdbool.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#define RENDER_WATCHDOG_SLOTS 16
+#define RENDER_WATCHDOG_HANG_FACTOR 10
+
+// Watches calls into Render (one slot per render thread): calls taking
+// longer than stall_ms are logged with the stack of the rendering thread,
+// calls taking RENDER_WATCHDOG_HANG_FACTOR times as long count as hung.
+bool render_watchdog_start(int stall_ms);
+
+void render_watchdog_stop();
+
+// Returns 0 while not started
+int render_watchdog_stall_ms();
+
+// The thread handle needs THREAD_SUSPEND_RESUME and THREAD_GET_CONTEXT
+// access, the description needs to outlive the call
+void render_watchdog_enter(int slot, HANDLE thread, const char *description);
+
+void render_watchdog_leave(int slot);
+
+bool render_watchdog_is_hung(int slot);
+
+// Clears a hung slot for re-use
+void render_watchdog_forget(int slot);
+
+#endif // ifndef RENDER_WATCHDOG_H
@@ -0,0 +1,310 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <psapi.h>
+#include <tlhelp32.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "module_registry.h"
+#include "resource_monitor.h"
+
+#define MONITORED_THREADS_MAX 128
+#define TREND_WINDOW 30         // samples
+#define TREND_MIN_CORRELATION 0.9
+
+// https://learn.microsoft.com/en-us/windows/win32/api/winternl/nf-winternl-ntqueryinformationthread
+#define THREAD_QUERY_SET_WIN32_START_ADDRESS 9
+
+typedef LONG(NTAPI *nt_query_information_thread_func)(HANDLE, int, PVOID,
+                                                      ULONG, PULONG);
+
+typedef struct _monitored_thread_t {
+  DWORD id;
+  ULONGLONG cpu_100ns; // kernel plus user time
+  bool seen;
+} monitored_thread_t;
+
+typedef enum _trended_resource_t {
+  TREND_WORKING_SET_KB,
+  TREND_PRIVATE_KB,
+  TREND_HANDLES,
+  TREND_GDI_OBJECTS,
+  TREND_USER_OBJECTS,
+  TREND_THREADS,
+  TREND_RESOURCE_COUNT
+} trended_resource_t;
+
+typedef struct _trend_t {
+  const char *name;
+  double min_growth_per_hour; // to not warn about noise
+  double values[TREND_WINDOW];
+  double seconds[TREND_WINDOW];
+} trend_t;
+
+static monitored_thread_t g_threads[MONITORED_THREADS_MAX];
+static size_t g_thread_count = 0;
+static ULONGLONG g_last_sample_at_ms = 0;
+
+static trend_t g_trends[TREND_RESOURCE_COUNT] = {
+    {"Working set (KiB)", 1024.0}, {"Private bytes (KiB)", 1024.0},
+    {"Handles", 10.0},             {"GDI objects", 10.0},
+    {"User objects", 10.0},        {"Threads", 2.0},
+};
+static size_t g_trend_samples = 0;
+
+static ULONGLONG to_100ns(const FILETIME *filetime) {
+  return ((ULONGLONG)filetime->dwHighDateTime << 32) |
+         filetime->dwLowDateTime;
+}
+
+static ULONG_PTR start_address_of(HANDLE thread) {
+  static nt_query_information_thread_func nt_query_information_thread = NULL;
+  if (nt_query_information_thread == NULL) {
+    nt_query_information_thread =
+        (nt_query_information_thread_func)GetProcAddress(
+            GetModuleHandleA("ntdll.dll"), "NtQueryInformationThread");
+    if (nt_query_information_thread == NULL) {
+      return 0;
+    }
+  }
+
+  ULONG_PTR start_address = 0;
+  if (nt_query_information_thread(thread, THREAD_QUERY_SET_WIN32_START_ADDRESS,
+                                  &start_address, sizeof(start_address),
+                                  NULL) != 0) {
+    return 0;
+  }
+  return start_address;
+}
+
+static monitored_thread_t *find_or_add_thread(DWORD id) {
+  for (size_t i = 0; i < g_thread_count; i++) {
+    if (g_threads[i].id == id) {
+      return &g_threads[i];
+    }
+  }
+  if (g_thread_count >= MONITORED_THREADS_MAX) {
+    return NULL;
+  }
+  monitored_thread_t *const thread = &g_threads[g_thread_count++];
+  thread->id = id;
+  thread->cpu_100ns = 0;
+  return thread;
+}
+
+static size_t sample_threads(ULONGLONG elapsed_ms, char *json, size_t size) {
+  size_t thread_count = 0;
+  size_t json_used = 0;
+  json[0] = '\0';
+
+  const HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+  if (snapshot == INVALID_HANDLE_VALUE) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < g_thread_count; i++) {
+    g_threads[i].seen = false;
+  }
+
+  const DWORD process_id = GetCurrentProcessId();
+  THREADENTRY32 entry;
+  entry.dwSize = sizeof(entry);
+  for (BOOL ok = Thread32First(snapshot, &entry); ok;
+       ok = Thread32Next(snapshot, &entry)) {
+    if (entry.th32OwnerProcessID != process_id) {
+      continue;
+    }
+    thread_count++;
+
+    const HANDLE handle =
+        OpenThread(THREAD_QUERY_INFORMATION, FALSE, entry.th32ThreadID);
+    if (handle == NULL) {
+      continue;
+    }
+
+    FILETIME creation;
+    FILETIME exit;
+    FILETIME kernel;
+    FILETIME user;
+    const BOOL got_times =
+        GetThreadTimes(handle, &creation, &exit, &kernel, &user);
+    const ULONG_PTR start_address = start_address_of(handle);
+    CloseHandle(handle);
+
+    monitored_thread_t *const thread = find_or_add_thread(entry.th32ThreadID);
+    if (!got_times || thread == NULL) {
+      continue;
+    }
+
+    const ULONGLONG cpu_100ns = to_100ns(&kernel) + to_100ns(&user);
+    const ULONGLONG delta_100ns = cpu_100ns - thread->cpu_100ns;
+    const bool is_new = (thread->cpu_100ns == 0);
+    thread->cpu_100ns = cpu_100ns;
+    thread->seen = true;
+
+    const double cpu_percent =
+        (is_new || elapsed_ms == 0) ? 0.0
+                                    : (delta_100ns / 100.0 / elapsed_ms);
+
+    char location[MAX_PATH + 64];
+    char module_name[MAX_PATH];
+    module_registry_describe(start_address, location, sizeof(location),
+                             module_name, sizeof(module_name));
+
+    if (cpu_percent >= 0.1) {
+      log_info("  Thread %5lu %5.1f%% CPU, started at %s", entry.th32ThreadID,
+               cpu_percent, location);
+    }
+
+    if (json_used < size) {
+      json_used += snprintf(json + json_used, size - json_used,
+                            "%s{\"id\": %lu, \"module\": \"%s\", "
+                            "\"cpu_percent\": %.2f}",
+                            (json_used > 0) ? ", " : "", entry.th32ThreadID,
+                            module_name, cpu_percent);
+    }
+  }
+
+  CloseHandle(snapshot);
+
+  // Forget about threads that have exited
+  for (size_t i = 0; i < g_thread_count;) {
+    if (g_threads[i].seen) {
+      i++;
+    } else {
+      g_threads[i] = g_threads[--g_thread_count];
+    }
+  }
+
+  if (json_used >= size) {
+    json[0] = '\0'; // rather than invalid JSON
+  }
+
+  return thread_count;
+}
+
+// Least-squares fit over the window; growth is only reported when it is
+// both steady (correlation) and relevant (slope) to not warn about noise.
+static void check_trend(const trend_t *trend, size_t count) {
+  double mean_x = 0;
+  double mean_y = 0;
+  for (size_t i = 0; i < count; i++) {
+    mean_x += trend->seconds[i];
+    mean_y += trend->values[i];
+  }
+  mean_x /= count;
+  mean_y /= count;
+
+  double covariance = 0;
+  double variance_x = 0;
+  double variance_y = 0;
+  for (size_t i = 0; i < count; i++) {
+    const double dx = trend->seconds[i] - mean_x;
+    const double dy = trend->values[i] - mean_y;
+    covariance += dx * dy;
+    variance_x += dx * dx;
+    variance_y += dy * dy;
+  }
+  if (variance_x <= 0 || variance_y <= 0) {
+    return;
+  }
+
+  const double growth_per_hour = covariance / variance_x * 3600.0;
+  const double correlation = covariance / sqrt(variance_x * variance_y);
+  if (correlation >= TREND_MIN_CORRELATION &&
+      growth_per_hour >= trend->min_growth_per_hour) {
+    log_error("%s keeps growing: %+.1f per hour over the last %.0f minutes "
+              "(now %.0f).",
+              trend->name, growth_per_hour,
+              (trend->seconds[count - 1] - trend->seconds[0]) / 60.0,
+              trend->values[count - 1]);
+  }
+}
+
+static void add_trend_samples(const double *values, double seconds) {
+  const size_t index = g_trend_samples % TREND_WINDOW;
+  for (int r = 0; r < TREND_RESOURCE_COUNT; r++) {
+    g_trends[r].values[index] = values[r];
+    g_trends[r].seconds[index] = seconds;
+  }
+  g_trend_samples++;
+
+  // Check once per full window, in chronological order
+  if (g_trend_samples % TREND_WINDOW != 0) {
+    return;
+  }
+  for (int r = 0; r < TREND_RESOURCE_COUNT; r++) {
+    check_trend(&g_trends[r], TREND_WINDOW);
+  }
+}
+
+void resource_monitor_sample() {
+  const ULONGLONG now_ms = GetTickCount64();
+  const ULONGLONG elapsed_ms =
+      (g_last_sample_at_ms == 0) ? 0 : (now_ms - g_last_sample_at_ms);
+  g_last_sample_at_ms = now_ms;
+
+  const HANDLE process = GetCurrentProcess();
+
+  PROCESS_MEMORY_COUNTERS memory;
+  memset(&memory, 0, sizeof(memory));
+  memory.cb = sizeof(memory);
+  GetProcessMemoryInfo(process, &memory, sizeof(memory));
+
+  DWORD handle_count = 0;
+  GetProcessHandleCount(process, &handle_count);
+  const DWORD gdi_objects = GetGuiResources(process, GR_GDIOBJECTS);
+  const DWORD user_objects = GetGuiResources(process, GR_USEROBJECTS);
+
+  const unsigned long working_set_kb =
+      (unsigned long)(memory.WorkingSetSize / 1024);
+  const unsigned long private_kb = (unsigned long)(memory.PagefileUsage / 1024);
+
+  log_info("Resources: working set %luKiB, private %luKiB, %lu handles, "
+           "%lu GDI objects, %lu user objects",
+           working_set_kb, private_kb, handle_count, gdi_objects,
+           user_objects);
+
+  static char threads_json[4096];
+  const size_t thread_count =
+      sample_threads(elapsed_ms, threads_json, sizeof(threads_json));
+
+  char line[sizeof(threads_json) + 512];
+  snprintf(line, sizeof(line),
+           "{\"type\": \"resources\", \"uptime_ms\": %.0f, "
+           "\"working_set_kb\": %lu, \"private_kb\": %lu, \"handles\": %lu, "
+           "\"gdi_objects\": %lu, \"user_objects\": %lu, "
+           "\"threads\": [%s]}",
+           (double)metrics_uptime_ms(), working_set_kb, private_kb,
+           handle_count, gdi_objects, user_objects, threads_json);
+  metrics_export_line(line);
+
+  const double values[TREND_RESOURCE_COUNT] = {
+      (double)working_set_kb, (double)private_kb,   (double)handle_count,
+      (double)gdi_objects,    (double)user_objects, (double)thread_count,
+  };
+  add_trend_samples(values, now_ms / 1000.0);
+}
@@ -0,0 +1,70 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <string.h>
+
+#include "stream_io.h"
+
+bool stream_io_is_pipe_path(const char *path) {
+  return strncmp(path, "\\\\.\\pipe\\", strlen("\\\\.\\pipe\\")) == 0;
+}
+
+// Blocks until a reader connects, for pipes and FIFOs alike
+HANDLE stream_io_open_output(const char *path) {
+  if (!stream_io_is_pipe_path(path)) {
+    return CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                       CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  }
+
+  const HANDLE pipe = CreateNamedPipeA(
+      path, PIPE_ACCESS_OUTBOUND, PIPE_TYPE_BYTE | PIPE_WAIT, 1,
+      1024 * 1024, 0, 0, NULL);
+  if (pipe == INVALID_HANDLE_VALUE) {
+    return pipe;
+  }
+  if (!ConnectNamedPipe(pipe, NULL) &&
+      GetLastError() != ERROR_PIPE_CONNECTED) {
+    CloseHandle(pipe);
+    return INVALID_HANDLE_VALUE;
+  }
+  return pipe;
+}
+
+bool stream_io_write_all(HANDLE output, const void *data, DWORD size) {
+  const char *remaining = (const char *)data;
+  while (size > 0) {
+    DWORD bytes_written = 0;
+    if (!WriteFile(output, remaining, size, &bytes_written, NULL) ||
+        bytes_written == 0) {
+      return false;
+    }
+    remaining += bytes_written;
+    size -= bytes_written;
+  }
+  return true;
+}
+
+void stream_io_join_thread(HANDLE thread, const volatile LONG *opened) {
+  const ULONGLONG stop_requested_at_ms = GetTickCount64();
+  while (WaitForSingleObject(thread, 100) == WAIT_TIMEOUT) {
+    if (opened == NULL || !*opened ||
+        GetTickCount64() - stop_requested_at_ms >= STREAM_IO_STOP_GRACE_MS) {
+      CancelSynchronousIo(thread);
+    }
+  }
+  CloseHandle(thread);
+}
@@ -0,0 +1,45 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef STREAM_IO_H
+#define STREAM_IO_H
+
+#include <stdbool.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#define STREAM_IO_STOP_GRACE_MS 5000
+
+// Streaming to files, FIFOs and named pipes alike, from threads of their own
+
+// For paths like "\\.\pipe\NAME"
+bool stream_io_is_pipe_path(const char *path);
+
+// Creates the file, or a named pipe to then block until a reader connects;
+// returns INVALID_HANDLE_VALUE on failure
+HANDLE stream_io_open_output(const char *path);
+
+bool stream_io_write_all(HANDLE output, const void *data, DWORD size);
+
+// Waits for a thread doing blocking I/O to end once asked to, and closes
+// it.  I/O is cancelled while opened is 0 (e.g. opening without a reader)
+// or NULL, and after STREAM_IO_STOP_GRACE_MS otherwise (e.g. writing to a
+// reader that does not keep up).
+void stream_io_join_thread(HANDLE thread, const volatile LONG *opened);
+
+#endif // ifndef STREAM_IO_H
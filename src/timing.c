@@ -0,0 +1,35 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include "timing.h"
+
+LONGLONG timing_now_us() {
+  static LONGLONG ticks_per_second = 0;
+  if (ticks_per_second == 0) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    ticks_per_second = frequency.QuadPart;
+  }
+
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+
+  // Split to avoid overflow of "ticks * 1000000" for long uptimes
+  const LONGLONG seconds = now.QuadPart / ticks_per_second;
+  const LONGLONG remainder = now.QuadPart % ticks_per_second;
+  return seconds * 1000000 + remainder * 1000000 / ticks_per_second;
+}
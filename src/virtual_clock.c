@@ -0,0 +1,100 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include "log.h"
+#include "pe_image.h"
+#include "virtual_clock.h"
+
+#include <mmsystem.h> // timeGetTime, after windows.h
+
+static bool g_started = false;
+static volatile LONGLONG g_elapsed_us = 0;
+
+// Real clock readings at virtual_clock_start, so that virtual time picks
+// up where real time was
+static DWORD g_base_tick_ms = 0;
+static ULONGLONG g_base_tick64_ms = 0;
+static DWORD g_base_time_ms = 0;
+static LONGLONG g_base_counter = 0;
+static LONGLONG g_counter_frequency = 0;
+
+static LONGLONG elapsed_us() {
+  // i.e. an atomic 64 bit read, even on 32 bit x86
+  return InterlockedCompareExchange64(&g_elapsed_us, 0, 0);
+}
+
+static DWORD WINAPI virtual_get_tick_count() {
+  return g_base_tick_ms + (DWORD)(elapsed_us() / 1000);
+}
+
+static ULONGLONG WINAPI virtual_get_tick_count64() {
+  return g_base_tick64_ms + (ULONGLONG)(elapsed_us() / 1000);
+}
+
+static DWORD WINAPI virtual_time_get_time() {
+  return g_base_time_ms + (DWORD)(elapsed_us() / 1000);
+}
+
+static BOOL WINAPI virtual_query_performance_counter(LARGE_INTEGER *counter) {
+  const LONGLONG elapsed = elapsed_us();
+  // Split to avoid overflow, like timing_now_us
+  counter->QuadPart = g_base_counter +
+                      elapsed / 1000000 * g_counter_frequency +
+                      elapsed % 1000000 * g_counter_frequency / 1000000;
+  return TRUE;
+}
+
+static void WINAPI virtual_sleep(DWORD milliseconds) {
+  (void)milliseconds;
+  Sleep(0); // i.e. only give up the rest of the time slice
+}
+
+void virtual_clock_start() {
+  LARGE_INTEGER counter;
+  LARGE_INTEGER frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+
+  g_base_tick_ms = GetTickCount();
+  g_base_tick64_ms = GetTickCount64();
+  g_base_time_ms = timeGetTime();
+  g_base_counter = counter.QuadPart;
+  g_counter_frequency = frequency.QuadPart;
+  InterlockedExchange64(&g_elapsed_us, 0);
+  g_started = true;
+}
+
+bool virtual_clock_started() { return g_started; }
+
+void virtual_clock_hook_module(HMODULE module) {
+  if (!g_started) {
+    return;
+  }
+
+  const int count =
+      pe_hook_imports(module, "GetTickCount", virtual_get_tick_count) +
+      pe_hook_imports(module, "GetTickCount64", virtual_get_tick_count64) +
+      pe_hook_imports(module, "timeGetTime", virtual_time_get_time) +
+      pe_hook_imports(module, "QueryPerformanceCounter",
+                      virtual_query_performance_counter) +
+      pe_hook_imports(module, "Sleep", virtual_sleep);
+  log_debug("Hooked %d time related imports for virtual time.", count);
+}
+
+void virtual_clock_set_elapsed_us(LONGLONG elapsed_us) {
+  InterlockedExchange64(&g_elapsed_us, elapsed_us);
+}
@@ -0,0 +1,42 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef VIRTUAL_CLOCK_H
+#define VIRTUAL_CLOCK_H
+
+#include <stdbool.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+// Vis plug-ins animate by the clock, so when frames are not rendered in
+// real time (see --offline), they need to see a clock of our choosing.
+// Once started, modules hooked get GetTickCount, GetTickCount64,
+// timeGetTime and QueryPerformanceCounter imports answered by a virtual
+// clock instead, and Sleep returns right away.  Modules loaded while not
+// started stay untouched, i.e. cost nothing at all.
+void virtual_clock_start();
+
+bool virtual_clock_started();
+
+// Patches the module's import address table, if started
+void virtual_clock_hook_module(HMODULE module);
+
+// Sets how much time has passed since virtual_clock_start
+void virtual_clock_set_elapsed_us(LONGLONG elapsed_us);
+
+#endif // ifndef VIRTUAL_CLOCK_H
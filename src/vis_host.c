@@ -0,0 +1,518 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>  // snprintf
+#include <string.h> // memcpy
+
+#include "frame_capture.h"
+#include "log.h"
+#include "main_window.h"
+#include "metrics.h"
+#include "render_watchdog.h"
+#include "timing.h"
+#include "vis_host.h"
+#include "vis_plugin.h"
+
+// Consecutive overlong renders before a module gets re-initialized
+#define VIS_HOST_REINIT_AFTER 8
+
+typedef struct _hosted_vis_module_t {
+  winampVisModule *module;
+  int index; // i.e. for getModule, see restart_render_thread
+  LONGLONG last_render_at_us;
+  LONGLONG skip_until_us;
+  int overlong_count;
+} hosted_vis_module_t;
+
+typedef struct _render_thread_t {
+  hosted_vis_module_t modules[VIS_HOST_MODULES_MAX];
+  int module_count;
+  HANDLE handle;
+  HANDLE frame_event;
+  HANDLE ready_event;
+  HANDLE rendered_event; // see vis_host_render_frame
+  volatile LONG active; // i.e. receiving frames
+  volatile LONG stop_requested;
+  int index;
+  bool abandoned; // i.e. hung in Render, see restart_render_thread
+
+  // For fresh instances of hung plug-ins, see restart_render_thread
+  winampVisHeader *copy_header;
+  HMODULE copy_dll_handle;
+  char copy_filename[MAX_PATH];
+
+  // Latest-frame mailbox: an unrendered frame is replaced, never queued,
+  // so that a slow plug-in cannot hold back anyone else
+  SRWLOCK mailbox_lock;
+  analysis_frame_t mailbox;
+  bool mailbox_full;
+
+  analysis_frame_t frame; // owned by the render thread
+} render_thread_t;
+
+static render_thread_t g_render_threads[VIS_HOST_THREADS_MAX];
+static int g_render_thread_count = 0;
+static int g_sample_rate = 0;
+static volatile LONG g_offline = 0; // i.e. render every frame, and wait
+
+// Embedding (IPC_GET_EMBEDIF) is not re-entrant, see main_window.c
+static CRITICAL_SECTION g_init_lock;
+static bool g_init_lock_ready = false;
+
+bool vis_host_add(winampVisModule *vis_module, int module_index,
+                  int thread_index) {
+  if (thread_index < 0 || thread_index >= VIS_HOST_THREADS_MAX) {
+    log_error("Cannot host more than %d vis plug-ins.", VIS_HOST_THREADS_MAX);
+    return false;
+  }
+  render_thread_t *const render_thread = &g_render_threads[thread_index];
+  if (render_thread->module_count >= VIS_HOST_MODULES_MAX) {
+    log_error("Cannot host more than %d vis modules per plug-in.",
+              VIS_HOST_MODULES_MAX);
+    return false;
+  }
+  hosted_vis_module_t *const hosted =
+      &render_thread->modules[render_thread->module_count++];
+  hosted->module = vis_module;
+  hosted->index = module_index;
+  hosted->last_render_at_us = 0;
+  hosted->skip_until_us = 0;
+  hosted->overlong_count = 0;
+  if (g_sample_rate != 0) {
+    vis_module->sRate = g_sample_rate;
+  }
+  if (thread_index >= g_render_thread_count) {
+    g_render_thread_count = thread_index + 1;
+  }
+  return true;
+}
+
+static void pump_messages() {
+  MSG message;
+  while (PeekMessageA(&message, NULL, 0, 0, PM_REMOVE)) {
+    TranslateMessage(&message);
+    DispatchMessage(&message);
+  }
+}
+
+// Plug-ins send messages to windows of the calling thread, so that thread
+// needs to keep its message queue going while waiting for them
+static void wait_pumping_messages(HANDLE handle) {
+  while (MsgWaitForMultipleObjects(1, &handle, FALSE, INFINITE,
+                                   QS_ALLINPUT) != WAIT_OBJECT_0) {
+    pump_messages();
+  }
+}
+
+static void fill_vis_module(winampVisModule *vis_module,
+                            const analysis_frame_t *frame) {
+  memcpy(vis_module->spectrumData, frame->spectrum_data,
+         sizeof(vis_module->spectrumData));
+  memcpy(vis_module->waveformData, frame->waveform_data,
+         sizeof(vis_module->waveformData));
+  vis_module->nCh = frame->channels;
+}
+
+static bool take_frame(render_thread_t *render_thread) {
+  AcquireSRWLockExclusive(&render_thread->mailbox_lock);
+  const bool taken = render_thread->mailbox_full;
+  if (taken) {
+    memcpy(&render_thread->frame, &render_thread->mailbox,
+           sizeof(render_thread->frame));
+    render_thread->mailbox_full = false;
+  }
+  ReleaseSRWLockExclusive(&render_thread->mailbox_lock);
+  return taken;
+}
+
+// Skips frames after overlong renders (for as long as the render took),
+// and re-initializes modules that keep overrunning
+static void handle_render_duration(hosted_vis_module_t *hosted,
+                                   LONGLONG started_at_us,
+                                   LONGLONG duration_us, int stall_ms) {
+  if (duration_us < stall_ms * 1000LL) {
+    hosted->overlong_count = 0;
+    return;
+  }
+
+  winampVisModule *const vis_module = hosted->module;
+  hosted->skip_until_us = started_at_us + 2 * duration_us;
+  hosted->overlong_count++;
+  if (hosted->overlong_count < VIS_HOST_REINIT_AFTER) {
+    return;
+  }
+
+  log_error("Vis module \"%s\" keeps overrunning Render, re-initializing...",
+            vis_module->description);
+  hosted->overlong_count = 0;
+  vis_module->Quit(vis_module);
+  EnterCriticalSection(&g_init_lock);
+  vis_module->Init(vis_module);
+  LeaveCriticalSection(&g_init_lock);
+}
+
+static void render_frame(render_thread_t *render_thread) {
+  for (int i = 0; i < render_thread->module_count; i++) {
+    hosted_vis_module_t *const hosted = &render_thread->modules[i];
+    winampVisModule *const vis_module = hosted->module;
+
+    // Respect the cadence that the module asked for (unless offline, where
+    // every frame stands for a fixed amount of time already)
+    const LONGLONG now_us = timing_now_us();
+    if (!g_offline) {
+      if (now_us - hosted->last_render_at_us <
+          vis_module->delayMs * 1000LL) {
+        continue;
+      }
+      if (now_us < hosted->skip_until_us) {
+        metrics_note_dropped_frame();
+        continue;
+      }
+    }
+    hosted->last_render_at_us = now_us;
+
+    fill_vis_module(vis_module, &render_thread->frame);
+    render_watchdog_enter(render_thread->index, render_thread->handle,
+                          vis_module->description);
+    vis_module->Render(vis_module);
+    render_watchdog_leave(render_thread->index);
+    present_vis_window(vis_module->hwndParent);
+    frame_capture_submit(vis_module->hwndParent);
+    const LONGLONG duration_us = timing_now_us() - now_us;
+    metrics_note_render(duration_us);
+
+    const int stall_ms = render_watchdog_stall_ms();
+    if (stall_ms > 0 && !g_offline) {
+      handle_render_duration(hosted, now_us, duration_us, stall_ms);
+    }
+  }
+}
+
+static DWORD WINAPI render_thread_main(LPVOID parameter) {
+  render_thread_t *const render_thread = (render_thread_t *)parameter;
+
+  // Like Winamp, call Init, Render and Quit from the same thread
+  EnterCriticalSection(&g_init_lock);
+  for (int i = 0; i < render_thread->module_count; i++) {
+    winampVisModule *const vis_module = render_thread->modules[i].module;
+    vis_module->Config(vis_module);
+    vis_module->Init(vis_module);
+  }
+  LeaveCriticalSection(&g_init_lock);
+  SetEvent(render_thread->ready_event);
+
+  while (!render_thread->stop_requested) {
+    const DWORD wait_result =
+        MsgWaitForMultipleObjects(1, &render_thread->frame_event, FALSE,
+                                  INFINITE, QS_ALLINPUT);
+    pump_messages();
+    if (wait_result == WAIT_OBJECT_0 && !render_thread->stop_requested &&
+        take_frame(render_thread)) {
+      render_frame(render_thread);
+      if (g_offline) {
+        SetEvent(render_thread->rendered_event);
+      }
+    }
+  }
+
+  for (int i = render_thread->module_count - 1; i >= 0; i--) {
+    unload_vis_module(render_thread->modules[i].module);
+  }
+  pump_messages();
+  return 0;
+}
+
+static void close_render_thread_handles(render_thread_t *render_thread) {
+  if (render_thread->handle != NULL) {
+    CloseHandle(render_thread->handle);
+    render_thread->handle = NULL;
+  }
+  if (render_thread->frame_event != NULL) {
+    CloseHandle(render_thread->frame_event);
+    render_thread->frame_event = NULL;
+  }
+  if (render_thread->ready_event != NULL) {
+    CloseHandle(render_thread->ready_event);
+    render_thread->ready_event = NULL;
+  }
+  if (render_thread->rendered_event != NULL) {
+    CloseHandle(render_thread->rendered_event);
+    render_thread->rendered_event = NULL;
+  }
+}
+
+bool vis_host_start_thread(int thread_index, bool active) {
+  if (!g_init_lock_ready) {
+    InitializeCriticalSection(&g_init_lock);
+    g_init_lock_ready = true;
+  }
+
+  render_thread_t *const render_thread = &g_render_threads[thread_index];
+  InitializeSRWLock(&render_thread->mailbox_lock);
+  render_thread->mailbox_full = false;
+  render_thread->active = active ? 1 : 0;
+  render_thread->stop_requested = 0;
+  render_thread->frame_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+  render_thread->ready_event = CreateEventA(NULL, TRUE, FALSE, NULL);
+  render_thread->rendered_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+  if (render_thread->frame_event == NULL ||
+      render_thread->ready_event == NULL ||
+      render_thread->rendered_event == NULL) {
+    log_error("Could not create events for vis render thread %d.",
+              thread_index + 1);
+    close_render_thread_handles(render_thread);
+    return false;
+  }
+
+  render_thread->index = thread_index;
+  render_watchdog_forget(thread_index);
+
+  // Suspended until render_thread->handle is in place
+  render_thread->handle = CreateThread(NULL, 0, render_thread_main,
+                                       render_thread, CREATE_SUSPENDED, NULL);
+  if (render_thread->handle == NULL) {
+    log_error("Could not start vis render thread %d.", thread_index + 1);
+    close_render_thread_handles(render_thread);
+    return false;
+  }
+
+  // Spread plug-ins across cores, leaving the first one to decoding
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
+  const DWORD processor_count = system_info.dwNumberOfProcessors;
+  if (processor_count > 1) {
+    SetThreadIdealProcessor(render_thread->handle,
+                            (DWORD)(1 + thread_index % (processor_count - 1)));
+  }
+  ResumeThread(render_thread->handle);
+  return true;
+}
+
+bool vis_host_is_ready(int thread_index) {
+  const HANDLE ready_event = g_render_threads[thread_index].ready_event;
+  return ready_event != NULL &&
+         WaitForSingleObject(ready_event, 0) == WAIT_OBJECT_0;
+}
+
+void vis_host_activate(int thread_index) {
+  InterlockedExchange(&g_render_threads[thread_index].active, 1);
+}
+
+void vis_host_request_stop(int thread_index) {
+  render_thread_t *const render_thread = &g_render_threads[thread_index];
+  InterlockedExchange(&render_thread->active, 0);
+  InterlockedExchange(&render_thread->stop_requested, 1);
+  if (render_thread->frame_event != NULL) {
+    SetEvent(render_thread->frame_event);
+  }
+}
+
+bool vis_host_reap(int thread_index) {
+  render_thread_t *const render_thread = &g_render_threads[thread_index];
+  if (render_thread->handle != NULL &&
+      WaitForSingleObject(render_thread->handle, 0) != WAIT_OBJECT_0) {
+    return false;
+  }
+  close_render_thread_handles(render_thread);
+  render_thread->module_count = 0;
+  return true;
+}
+
+bool vis_host_start() {
+  for (int i = 0; i < g_render_thread_count; i++) {
+    if (!vis_host_start_thread(i, true)) {
+      vis_host_stop();
+      return false;
+    }
+    wait_pumping_messages(g_render_threads[i].ready_event);
+  }
+  return true;
+}
+
+void vis_host_set_sample_rate(int sample_rate) {
+  g_sample_rate = sample_rate;
+  for (int i = 0; i < g_render_thread_count; i++) {
+    render_thread_t *const render_thread = &g_render_threads[i];
+    for (int k = 0; k < render_thread->module_count; k++) {
+      render_thread->modules[k].module->sRate = sample_rate;
+    }
+  }
+}
+
+void vis_host_submit_frame(const analysis_frame_t *frame) {
+  for (int i = 0; i < g_render_thread_count; i++) {
+    render_thread_t *const render_thread = &g_render_threads[i];
+    if (render_thread->handle == NULL || !render_thread->active) {
+      continue;
+    }
+
+    AcquireSRWLockExclusive(&render_thread->mailbox_lock);
+    if (render_thread->mailbox_full) {
+      metrics_note_dropped_frame(); // the plug-in did not keep up
+    }
+    memcpy(&render_thread->mailbox, frame, sizeof(render_thread->mailbox));
+    render_thread->mailbox_full = true;
+    ReleaseSRWLockExclusive(&render_thread->mailbox_lock);
+
+    SetEvent(render_thread->frame_event);
+  }
+}
+
+void vis_host_set_offline(bool offline) {
+  InterlockedExchange(&g_offline, offline ? 1 : 0);
+}
+
+void vis_host_render_frame(const analysis_frame_t *frame) {
+  bool waiting_for[VIS_HOST_THREADS_MAX];
+  for (int i = 0; i < g_render_thread_count; i++) {
+    const render_thread_t *const render_thread = &g_render_threads[i];
+    waiting_for[i] = render_thread->handle != NULL && render_thread->active;
+  }
+
+  vis_host_submit_frame(frame);
+
+  for (int i = 0; i < g_render_thread_count; i++) {
+    const render_thread_t *const render_thread = &g_render_threads[i];
+    if (!waiting_for[i]) {
+      continue;
+    }
+    // A thread hung in Render gets abandoned by vis_host_tick eventually
+    while (!render_thread->abandoned &&
+           WaitForSingleObject(render_thread->rendered_event, 100) ==
+               WAIT_TIMEOUT) {
+    }
+  }
+}
+
+static int find_free_render_thread() {
+  for (int i = 0; i < VIS_HOST_THREADS_MAX; i++) {
+    const render_thread_t *const render_thread = &g_render_threads[i];
+    if (render_thread->handle == NULL && render_thread->module_count == 0 &&
+        !render_thread->abandoned) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// A hung Render call cannot be interrupted, so we leave that thread
+// behind and start over with a fresh instance of the plug-in, loaded from a
+// copy of its DLL (as the same path would only give us the same instance).
+static void restart_render_thread(int thread_index) {
+  render_thread_t *const hung = &g_render_threads[thread_index];
+  const HMODULE original_dll_handle = hung->modules[0].module->hDllInstance;
+
+  char original_filename[MAX_PATH];
+  if (GetModuleFileNameA(original_dll_handle, original_filename,
+                         sizeof(original_filename)) == 0) {
+    return;
+  }
+  log_error("Vis plug-in \"%s\" hangs in Render, starting a fresh "
+            "instance...",
+            original_filename);
+
+  // Keep the DLL loaded for good, the hung thread is still running its code
+  HMODULE pinned = NULL;
+  GetModuleHandleExA(0, original_filename, &pinned);
+  InterlockedExchange(&hung->active, 0);
+  InterlockedExchange(&hung->stop_requested, 1);
+  hung->abandoned = true;
+
+  const int fresh_index = find_free_render_thread();
+  if (fresh_index < 0) {
+    log_error("No render thread left for a fresh instance.");
+    return;
+  }
+  render_thread_t *const fresh = &g_render_threads[fresh_index];
+
+  static unsigned int copy_count = 0;
+  char temp_path[MAX_PATH];
+  const char *const base_name = strrchr(original_filename, '\\');
+  GetTempPathA(sizeof(temp_path), temp_path);
+  snprintf(fresh->copy_filename, sizeof(fresh->copy_filename),
+           "%svisdriver-%u-%u-%s", temp_path, (unsigned)GetCurrentProcessId(),
+           ++copy_count,
+           (base_name != NULL) ? base_name + 1 : original_filename);
+  if (!CopyFileA(original_filename, fresh->copy_filename, FALSE)) {
+    log_error("Could not copy \"%s\" to \"%s\".", original_filename,
+              fresh->copy_filename);
+    fresh->copy_filename[0] = '\0';
+    return;
+  }
+
+  fresh->copy_header =
+      load_vis_header(fresh->copy_filename, &fresh->copy_dll_handle);
+  if (fresh->copy_header == NULL) {
+    DeleteFileA(fresh->copy_filename);
+    fresh->copy_filename[0] = '\0';
+    return;
+  }
+
+  // Same modules, each in a new window on top of the hung one; indices are
+  // the ones from loading, as calling into the hung instance could block
+  for (int i = 0; i < hung->module_count; i++) {
+    const hosted_vis_module_t *const hung_hosted = &hung->modules[i];
+    const HWND slot = create_vis_slot_window(hung_hosted->module->hwndParent);
+    if (slot == NULL) {
+      continue;
+    }
+    winampVisModule *const vis_module = load_vis_module(
+        fresh->copy_header, hung_hosted->index, slot, fresh->copy_dll_handle);
+    if (vis_module != NULL &&
+        vis_host_add(vis_module, hung_hosted->index, fresh_index)) {
+      activate_vis_slot_window(slot);
+    }
+  }
+
+  vis_host_start_thread(fresh_index, true);
+}
+
+void vis_host_tick() {
+  if (render_watchdog_stall_ms() == 0) {
+    return;
+  }
+  for (int i = 0; i < g_render_thread_count; i++) {
+    const render_thread_t *const render_thread = &g_render_threads[i];
+    if (render_thread->handle != NULL && !render_thread->abandoned &&
+        render_watchdog_is_hung(i)) {
+      restart_render_thread(i);
+    }
+  }
+}
+
+void vis_host_stop() {
+  for (int i = g_render_thread_count - 1; i >= 0; i--) {
+    render_thread_t *const render_thread = &g_render_threads[i];
+    if (render_thread->abandoned) {
+      continue; // i.e. waiting would hang us, too
+    }
+    if (render_thread->handle != NULL) {
+      vis_host_request_stop(i);
+      wait_pumping_messages(render_thread->handle);
+    }
+    vis_host_reap(i);
+
+    if (render_thread->copy_header != NULL) {
+      unload_vis_header(render_thread->copy_header,
+                        render_thread->copy_dll_handle);
+      render_thread->copy_header = NULL;
+      DeleteFileA(render_thread->copy_filename);
+      render_thread->copy_filename[0] = '\0';
+    }
+  }
+  g_render_thread_count = 0;
+}
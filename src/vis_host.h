@@ -0,0 +1,76 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef VIS_HOST_H
+#define VIS_HOST_H
+
+#include <stdbool.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <winamp/vis.h>
+
+#include "analysis_frame.h"
+
+#define VIS_HOST_MODULES_MAX 16
+#define VIS_HOST_THREADS_MAX 8
+
+// Drives any number of vis modules from a single analysis pass. Every vis
+// plug-in gets a render thread of its own (selected by thread_index), and
+// every module renders at its own cadence (as requested by its delayMs).
+// module_index is the one the module was loaded with (see load_vis_module).
+bool vis_host_add(winampVisModule *vis_module, int module_index,
+                  int thread_index);
+
+// Runs Config and Init of all modules on their render threads
+bool vis_host_start();
+
+// Starts a single render thread without waiting for its Init to finish;
+// inactive threads do not receive frames until activated
+bool vis_host_start_thread(int thread_index, bool active);
+
+bool vis_host_is_ready(int thread_index);
+
+void vis_host_activate(int thread_index);
+
+// Deactivates a render thread and asks it to run Quit and end, see
+// vis_host_reap
+void vis_host_request_stop(int thread_index);
+
+// Cleans up after a render thread, returns false while it is still running
+bool vis_host_reap(int thread_index);
+
+void vis_host_set_sample_rate(int sample_rate);
+
+// Hands the frame to all render threads without waiting for them
+void vis_host_submit_frame(const analysis_frame_t *frame);
+
+// Offline, every module renders every frame, regardless of delayMs, and
+// frames are handed over with vis_host_render_frame
+void vis_host_set_offline(bool offline);
+
+// Hands the frame to all render threads and waits for them to render it
+void vis_host_render_frame(const analysis_frame_t *frame);
+
+// Restarts plug-ins hung in Render (see render_watchdog), from the main loop
+void vis_host_tick();
+
+// Runs Quit of all modules on their render threads and ends those
+void vis_host_stop();
+
+#endif // ifndef VIS_HOST_H
@@ -0,0 +1,185 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "vis_isolation.h"
+
+#define VIS_ISOLATION_RESTART_DELAY_MIN_MS 1000
+#define VIS_ISOLATION_RESTART_DELAY_MAX_MS 30000
+#define VIS_ISOLATION_STABLE_MS 10000
+#define VIS_ISOLATION_QUIT_TIMEOUT_MS 5000
+#define VIS_ISOLATION_EXIT_CODE_MAX 0xFF // i.e. ours, unlike 0xC0000005
+
+static char g_command_line[4096];
+static HANDLE g_job = NULL;
+static HANDLE g_quit_event = NULL;
+static HANDLE g_process = NULL;
+static ULONGLONG g_started_at_ms = 0;
+static ULONGLONG g_restart_at_ms = 0;
+static DWORD g_restart_delay_ms = VIS_ISOLATION_RESTART_DELAY_MIN_MS;
+
+static void make_quit_event_name(char *event_name, size_t size,
+                                 const char *bus_name) {
+  snprintf(event_name, size, "%s-quit", bus_name);
+}
+
+static bool spawn_child() {
+  STARTUPINFOA startup_info;
+  memset(&startup_info, 0, sizeof(startup_info));
+  startup_info.cb = sizeof(startup_info);
+  PROCESS_INFORMATION process_information;
+
+  // CreateProcessA may modify the command line in place
+  char command_line[sizeof(g_command_line)];
+  strcpy(command_line, g_command_line);
+
+  if (!CreateProcessA(NULL, command_line, NULL, NULL, FALSE, CREATE_SUSPENDED,
+                      NULL, NULL, &startup_info, &process_information)) {
+    log_error("Could not start vis host process (error %u).",
+              (unsigned)GetLastError());
+    return false;
+  }
+
+  // So that the child cannot outlive us, not even if we crash
+  if (g_job != NULL &&
+      !AssignProcessToJobObject(g_job, process_information.hProcess)) {
+    log_debug("Could not add vis host process to job (error %u).",
+              (unsigned)GetLastError());
+  }
+  ResumeThread(process_information.hThread);
+  CloseHandle(process_information.hThread);
+
+  g_process = process_information.hProcess;
+  g_started_at_ms = GetTickCount64();
+  log_info("Started vis host process %u.",
+           (unsigned)process_information.dwProcessId);
+  return true;
+}
+
+bool vis_isolation_start(const char *bus_name, const char *arguments) {
+  char executable[MAX_PATH];
+  if (GetModuleFileNameA(NULL, executable, sizeof(executable)) == 0) {
+    log_error("Could not determine own executable.");
+    return false;
+  }
+  const int length = snprintf(g_command_line, sizeof(g_command_line),
+                              "\"%s\" %s", executable, arguments);
+  if (length < 0 || (size_t)length >= sizeof(g_command_line)) {
+    log_error("Vis host command line is too long.");
+    return false;
+  }
+
+  char event_name[MAX_PATH];
+  make_quit_event_name(event_name, sizeof(event_name), bus_name);
+  g_quit_event = CreateEventA(NULL, TRUE, FALSE, event_name);
+  if (g_quit_event == NULL) {
+    log_error("Could not create event \"%s\".", event_name);
+    return false;
+  }
+
+  g_job = CreateJobObjectA(NULL, NULL);
+  if (g_job != NULL) {
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits;
+    memset(&limits, 0, sizeof(limits));
+    limits.BasicLimitInformation.LimitFlags =
+        JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+    SetInformationJobObject(g_job, JobObjectExtendedLimitInformation, &limits,
+                            sizeof(limits));
+  }
+
+  if (!spawn_child()) {
+    vis_isolation_stop();
+    return false;
+  }
+  return true;
+}
+
+bool vis_isolation_tick() {
+  const ULONGLONG now_ms = GetTickCount64();
+
+  if (g_process == NULL) {
+    if (now_ms >= g_restart_at_ms) {
+      spawn_child(); // or try again later
+      g_restart_at_ms = now_ms + g_restart_delay_ms;
+    }
+    return true;
+  }
+
+  if (WaitForSingleObject(g_process, 0) != WAIT_OBJECT_0) {
+    return true;
+  }
+
+  DWORD exit_code = 0;
+  GetExitCodeProcess(g_process, &exit_code);
+  CloseHandle(g_process);
+  g_process = NULL;
+
+  if (exit_code == 0) {
+    log_info("Vis host process has quit.");
+    return false;
+  }
+
+  // Exit codes of visdriver itself (e.g. 6 for a vis plug-in that could not
+  // be loaded) early on mean that restarting would fail the same way
+  const bool stable = now_ms - g_started_at_ms >= VIS_ISOLATION_STABLE_MS;
+  if (!stable && exit_code <= VIS_ISOLATION_EXIT_CODE_MAX) {
+    log_error("Vis host process failed to start (exit code %u), giving up.",
+              (unsigned)exit_code);
+    return false;
+  }
+
+  // Back off from plug-ins that crash right away, again and again
+  if (stable) {
+    g_restart_delay_ms = VIS_ISOLATION_RESTART_DELAY_MIN_MS;
+  } else if (g_restart_delay_ms < VIS_ISOLATION_RESTART_DELAY_MAX_MS) {
+    g_restart_delay_ms *= 2;
+  }
+  g_restart_at_ms = now_ms + g_restart_delay_ms;
+  log_error("Vis host process died (exit code 0x%08X), restarting in %ums...",
+            (unsigned)exit_code, (unsigned)g_restart_delay_ms);
+  return true;
+}
+
+void vis_isolation_stop() {
+  if (g_process != NULL) {
+    SetEvent(g_quit_event);
+    if (WaitForSingleObject(g_process, VIS_ISOLATION_QUIT_TIMEOUT_MS) !=
+        WAIT_OBJECT_0) {
+      log_error("Vis host process did not quit in time, terminating.");
+      TerminateProcess(g_process, 1);
+    }
+    CloseHandle(g_process);
+    g_process = NULL;
+  }
+  if (g_job != NULL) {
+    CloseHandle(g_job);
+    g_job = NULL;
+  }
+  if (g_quit_event != NULL) {
+    CloseHandle(g_quit_event);
+    g_quit_event = NULL;
+  }
+}
+
+HANDLE vis_isolation_open_quit_event(const char *bus_name) {
+  char event_name[MAX_PATH];
+  make_quit_event_name(event_name, sizeof(event_name), bus_name);
+  return OpenEventA(SYNCHRONIZE, FALSE, event_name);
+}
@@ -0,0 +1,41 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef VIS_ISOLATION_H
+#define VIS_ISOLATION_H
+
+#include <stdbool.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+// Runs vis plug-ins in a child process ("vis host") that renders frames
+// from the analysis bus of the given name, so that a crashing plug-in
+// cannot take audio down with it.  The child is restarted if it crashes
+// and ended together with this process.
+bool vis_isolation_start(const char *bus_name, const char *arguments);
+
+// Returns false once the child has quit by itself (e.g. its window was
+// closed), restarts it after crashes
+bool vis_isolation_tick();
+
+void vis_isolation_stop();
+
+// For the child: signaled when the parent asks it to quit, NULL if missing
+HANDLE vis_isolation_open_quit_event(const char *bus_name);
+
+#endif // ifndef VIS_ISOLATION_H
@@ -15,8 +15,13 @@
 // You should have received a copy of the GNU General Public License along
 // with visdriver. If not, see <https://www.gnu.org/licenses/>.
 
+#include <stdlib.h> // strtol
+#include <string.h> // strcmp
+
 #include "vis_plugin.h"
 #include "log.h"
+#include "module_registry.h"
+#include "virtual_clock.h"
 
 winampVisHeader *load_vis_header(const char *filename, HMODULE *p_dll_handle) {
   const HMODULE dll_handle = LoadLibraryA(filename);
@@ -24,6 +29,7 @@ winampVisHeader *load_vis_header(const char *filename, HMODULE *p_dll_handle) {
     log_error("LoadLibraryA failed for file \"%s\".", filename);
     return NULL;
   }
+  virtual_clock_hook_module(dll_handle);
 
   const char *const function_name = "winampVisGetHeader";
   winampVisGetHeaderType winampVisGetHeader =
@@ -42,6 +48,8 @@ winampVisHeader *load_vis_header(const char *filename, HMODULE *p_dll_handle) {
 
   *p_dll_handle = dll_handle;
 
+  module_registry_add(filename, dll_handle);
+
   return vis_header;
 }
 
@@ -58,11 +66,38 @@ winampVisModule *load_vis_module(winampVisHeader *vis_header, int index,
   return vis_module;
 }
 
+int parse_vis_module_indices(const char *spec, winampVisHeader *vis_header,
+                             int *indices, int max_count) {
+  int count = 0;
+
+  if (strcmp(spec, "all") == 0) {
+    while (count < max_count && vis_header->getModule(count) != NULL) {
+      indices[count] = count;
+      count++;
+    }
+    return count;
+  }
+
+  const char *cursor = spec;
+  while (*cursor != '\0') {
+    char *end = NULL;
+    const long index = strtol(cursor, &end, 10);
+    if (end == cursor || index < 0 || count >= max_count ||
+        (*end != ',' && *end != '\0')) {
+      return -1;
+    }
+    indices[count++] = (int)index;
+    cursor = (*end == ',') ? end + 1 : end;
+  }
+  return count;
+}
+
 void unload_vis_module(winampVisModule *vis_module) {
   vis_module->Quit(vis_module);
 }
 
 void unload_vis_header(winampVisHeader *vis_header, HMODULE dll_handle) {
   (void)vis_header;
+  module_registry_remove(dll_handle);
   FreeLibrary(dll_handle);
 }
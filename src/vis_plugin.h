@@ -28,6 +28,11 @@ winampVisHeader *load_vis_header(const char *filename, HMODULE *p_dll_handle);
 winampVisModule *load_vis_module(winampVisHeader *vis_header, int index,
                                  HWND main_window, HMODULE dll_handle);
 
+// Turns "all" or a comma-separated list like "0,2" into module indices,
+// returns the number of indices or -1 for invalid input
+int parse_vis_module_indices(const char *spec, winampVisHeader *vis_header,
+                             int *indices, int max_count);
+
 void unload_vis_module(winampVisModule *vis_module);
 
 void unload_vis_header(winampVisHeader *vis_header, HMODULE dll_handle);
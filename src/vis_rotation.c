@@ -0,0 +1,287 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <ctype.h>  // isspace
+#include <stdio.h>  // fopen
+#include <stdlib.h> // malloc
+#include <string.h> // strcpy
+
+#include "log.h"
+#include "main_window.h"
+#include "plugin_proxy.h"
+#include "vis_host.h"
+#include "vis_plugin.h"
+#include "vis_rotation.h"
+
+typedef struct _vis_rotation_entry_t {
+  const char *filename;
+  char *owned_filename; // i.e. to free, for entries read from a schedule
+  int seconds;
+} vis_rotation_entry_t;
+
+typedef struct _vis_rotation_instance_t {
+  int entry_index; // -1 for none
+  int thread_index;
+  HWND window;
+  winampVisHeader *header;
+  HMODULE dll_handle;
+} vis_rotation_instance_t;
+
+static vis_rotation_entry_t g_entries[VIS_ROTATION_ENTRIES_MAX];
+static int g_entry_count = 0;
+
+static HWND g_host_window = NULL;
+static const char *g_vis_modules = NULL;
+static int g_default_seconds = 0;
+static bool g_trace_plugins = false;
+
+static vis_rotation_instance_t g_active = {-1};
+static vis_rotation_instance_t g_standby = {-1};
+static vis_rotation_instance_t g_retiring = {-1};
+static ULONGLONG g_active_since_ms = 0;
+static volatile LONG g_next_requested = 0;
+
+bool vis_rotation_add(const char *filename, int seconds) {
+  if (g_entry_count >= VIS_ROTATION_ENTRIES_MAX) {
+    log_error("Cannot rotate more than %d vis plugins.",
+              VIS_ROTATION_ENTRIES_MAX);
+    return false;
+  }
+  g_entries[g_entry_count].filename = filename;
+  g_entries[g_entry_count].owned_filename = NULL;
+  g_entries[g_entry_count].seconds = seconds;
+  g_entry_count++;
+  return true;
+}
+
+bool vis_rotation_load_schedule(const char *filename) {
+  FILE *const file = fopen(filename, "r");
+  if (file == NULL) {
+    log_error("Could not open vis schedule \"%s\".", filename);
+    return false;
+  }
+
+  bool success = true;
+  char line[1024];
+  int line_number = 0;
+  while (success && fgets(line, sizeof(line), file) != NULL) {
+    line_number++;
+
+    size_t length = strlen(line);
+    while (length > 0 && isspace((unsigned char)line[length - 1])) {
+      line[--length] = '\0';
+    }
+    const char *cursor = line;
+    while (isspace((unsigned char)*cursor)) {
+      cursor++;
+    }
+    if (*cursor == '\0' || *cursor == '#') {
+      continue;
+    }
+
+    int seconds = 0;
+    int consumed = 0;
+    if (sscanf(cursor, "%d %n", &seconds, &consumed) != 1 || seconds < 0 ||
+        cursor[consumed] == '\0') {
+      log_error("Line %d of vis schedule \"%s\" is not of form \"SECONDS "
+                "PATH\".",
+                line_number, filename);
+      success = false;
+      break;
+    }
+
+    char *const plugin_filename = malloc(strlen(cursor + consumed) + 1);
+    if (plugin_filename == NULL) {
+      success = false;
+      break;
+    }
+    strcpy(plugin_filename, cursor + consumed);
+    success = vis_rotation_add(plugin_filename, seconds);
+    if (success) {
+      g_entries[g_entry_count - 1].owned_filename = plugin_filename;
+    } else {
+      free(plugin_filename);
+    }
+  }
+
+  fclose(file);
+
+  if (success && g_entry_count == 0) {
+    log_error("Vis schedule \"%s\" does not list any plugins.", filename);
+    success = false;
+  }
+  return success;
+}
+
+static void unload_instance(vis_rotation_instance_t *instance) {
+  if (instance->entry_index < 0) {
+    return;
+  }
+  unload_vis_header(instance->header, instance->dll_handle);
+  DestroyWindow(instance->window);
+  instance->entry_index = -1;
+}
+
+static bool load_instance(vis_rotation_instance_t *instance, int entry_index,
+                          int thread_index, bool active) {
+  const char *const filename = g_entries[entry_index].filename;
+  log_info("Loading vis plugin \"%s\"...", filename);
+
+  HMODULE dll_handle = 0;
+  winampVisHeader *const vis_header = load_vis_header(filename, &dll_handle);
+  if (vis_header == NULL) {
+    log_error("Vis plugin could not be loaded.");
+    return false;
+  }
+  log_info("Vis plugin is \"%s\" (API 0x%X).", vis_header->description,
+           vis_header->version);
+
+  instance->entry_index = entry_index;
+  instance->thread_index = thread_index;
+  instance->header = vis_header;
+  instance->dll_handle = dll_handle;
+  instance->window = create_vis_slot_window(g_host_window);
+
+  // Only the first selected module takes part in rotation
+  int vis_module_indices[VIS_HOST_MODULES_MAX];
+  winampVisModule *vis_module = NULL;
+  if (instance->window != NULL &&
+      parse_vis_module_indices(g_vis_modules, vis_header, vis_module_indices,
+                               VIS_HOST_MODULES_MAX) > 0) {
+    vis_module = load_vis_module(vis_header, vis_module_indices[0],
+                                 instance->window, dll_handle);
+  }
+  if (vis_module == NULL) {
+    log_error("Vis module selection \"%s\" does not match any modules of vis "
+              "plugin \"%s\".",
+              g_vis_modules, filename);
+    unload_instance(instance);
+    return false;
+  }
+  log_info("Vis module %d is \"%s\".", vis_module_indices[0],
+           vis_module->description);
+
+  if (g_trace_plugins) {
+    proxy_vis_module(vis_module);
+  }
+  if (!vis_host_add(vis_module, vis_module_indices[0], thread_index) ||
+      !vis_host_start_thread(thread_index, active)) {
+    vis_host_reap(thread_index);
+    unload_instance(instance);
+    return false;
+  }
+  return true;
+}
+
+// Loading the same DLL twice would share (and break) its module state
+static bool is_same_plugin_as_active(int entry_index) {
+  return _stricmp(g_entries[entry_index].filename,
+                  g_entries[g_active.entry_index].filename) == 0;
+}
+
+static void preload_next() {
+  const int thread_index = 1 - g_active.thread_index;
+  for (int step = 1; step < g_entry_count; step++) {
+    const int entry_index = (g_active.entry_index + step) % g_entry_count;
+    if (is_same_plugin_as_active(entry_index)) {
+      continue;
+    }
+    if (load_instance(&g_standby, entry_index, thread_index, false)) {
+      return;
+    }
+  }
+  log_debug("No other vis plugin to rotate to.");
+}
+
+bool vis_rotation_start(HWND main_window, const char *vis_modules,
+                        int default_seconds, bool trace_plugins) {
+  g_host_window = main_window;
+  g_vis_modules = vis_modules;
+  g_default_seconds = default_seconds;
+  g_trace_plugins = trace_plugins;
+
+  if (!load_instance(&g_active, 0, 0, true)) {
+    return false;
+  }
+  activate_vis_slot_window(g_active.window);
+  g_active_since_ms = GetTickCount64();
+
+  if (!RegisterHotKey(main_window, VIS_ROTATION_HOTKEY_ID,
+                      MOD_CONTROL | MOD_ALT, 'N')) {
+    log_info("Hotkey Ctrl+Alt+N is taken, switching by timer only.");
+  }
+
+  preload_next();
+  return true;
+}
+
+void vis_rotation_request_next() {
+  InterlockedExchange(&g_next_requested, 1);
+}
+
+static bool is_switch_due(ULONGLONG now_ms) {
+  if (g_next_requested) {
+    return true;
+  }
+  const int entry_seconds = g_entries[g_active.entry_index].seconds;
+  const int seconds = (entry_seconds > 0) ? entry_seconds : g_default_seconds;
+  return seconds > 0 && now_ms - g_active_since_ms >= seconds * 1000ULL;
+}
+
+void vis_rotation_tick() {
+  if (g_active.entry_index < 0) {
+    return;
+  }
+
+  // Switch once the next plug-in is done initializing
+  const ULONGLONG now_ms = GetTickCount64();
+  if (g_standby.entry_index >= 0 && g_retiring.entry_index < 0 &&
+      is_switch_due(now_ms) && vis_host_is_ready(g_standby.thread_index)) {
+    log_info("Switching to vis plugin \"%s\"...",
+             g_entries[g_standby.entry_index].filename);
+    vis_host_request_stop(g_active.thread_index);
+    vis_host_activate(g_standby.thread_index);
+    activate_vis_slot_window(g_standby.window);
+
+    g_retiring = g_active;
+    g_active = g_standby;
+    g_standby.entry_index = -1;
+    g_active_since_ms = now_ms;
+    InterlockedExchange(&g_next_requested, 0);
+  }
+
+  // Unload the previous plug-in once it has quit, then prepare the next
+  if (g_retiring.entry_index >= 0 && vis_host_reap(g_retiring.thread_index)) {
+    unload_instance(&g_retiring);
+    preload_next();
+  }
+}
+
+void vis_rotation_stop() {
+  if (g_host_window != NULL) {
+    UnregisterHotKey(g_host_window, VIS_ROTATION_HOTKEY_ID);
+  }
+  vis_host_stop();
+  unload_instance(&g_retiring);
+  unload_instance(&g_standby);
+  unload_instance(&g_active);
+
+  for (int i = 0; i < g_entry_count; i++) {
+    free(g_entries[i].owned_filename);
+  }
+  g_entry_count = 0;
+}
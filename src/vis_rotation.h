@@ -0,0 +1,49 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef VIS_ROTATION_H
+#define VIS_ROTATION_H
+
+#include <stdbool.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#define VIS_ROTATION_ENTRIES_MAX 64
+#define VIS_ROTATION_HOTKEY_ID 1
+
+// Takes turns with vis plug-ins: while one is showing, the next one is
+// already loaded and initialized in the background (on a render thread of
+// its own, see vis_host), so that switching costs no more than a frame.
+bool vis_rotation_add(const char *filename, int seconds);
+
+// Reads lines of "SECONDS PATH/VIS.dll" with '#' starting comments
+bool vis_rotation_load_schedule(const char *filename);
+
+// Switching every default_seconds (0 for only on request); also registers
+// Ctrl+Alt+N as a hotkey with VIS_ROTATION_HOTKEY_ID for the main window
+bool vis_rotation_start(HWND main_window, const char *vis_modules,
+                        int default_seconds, bool trace_plugins);
+
+void vis_rotation_request_next();
+
+// Needs calling from the main loop, frequently
+void vis_rotation_tick();
+
+void vis_rotation_stop();
+
+#endif // ifndef VIS_ROTATION_H
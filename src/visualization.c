@@ -27,15 +27,22 @@
 
 #include <kissfft/kiss_fftr.h>
 
+#include "analysis_bus.h"
 #include "log.h"
+#include "metrics.h"
+#include "timing.h"
+#include "vis_host.h"
 #include "visualization.h"
 
-#define VIS_FRAMES 576 // dictated by vis.h
+#define VIS_FRAMES ANALYSIS_FRAME_SAMPLES
 
-winampVisModule *g_active_vis_module = NULL;
 static kiss_fftr_cfg g_kiss_fft_cfg = NULL;
 static int16_t g_prev_interleaved[VIS_FRAMES * 2];
 static kiss_fft_scalar g_hann_factors[VIS_FRAMES * 2];
+static int g_sample_rate = 0;
+static analysis_bus_t g_analysis_bus = {NULL, NULL, NULL};
+static int(__cdecl *g_get_output_time_ms)() = NULL;
+static bool g_pcm_from_elsewhere = false; // i.e. ignore SAAddPCMData
 
 static kiss_fft_scalar hann_factor(size_t index, size_t samples);
 
@@ -45,19 +52,30 @@ static void compute_hann_factors() {
   }
 }
 
+static void prepare_analysis(int sample_rate) {
+  vis_host_set_sample_rate(sample_rate);
+  g_sample_rate = sample_rate;
+  memset(g_prev_interleaved, 0, sizeof(g_prev_interleaved));
+
+  if (g_kiss_fft_cfg == NULL) {
+    g_kiss_fft_cfg = kiss_fftr_alloc(VIS_FRAMES * 2, 0, NULL, NULL);
+    compute_hann_factors();
+  }
+}
+
 void __cdecl SAVSAInit(int maxlatency_in_ms, int srate) {
   log_debug("Input plugin announced: Maximum latency %dms, sampling rate %d "
             "(SAVSAInit).",
             maxlatency_in_ms, srate);
-  g_active_vis_module->sRate = srate;
-  memset(g_prev_interleaved, 0, sizeof(g_prev_interleaved));
-
-  g_kiss_fft_cfg = kiss_fftr_alloc(VIS_FRAMES * 2, 0, NULL, NULL);
-
-  compute_hann_factors();
+  if (!g_pcm_from_elsewhere) {
+    prepare_analysis(srate);
+  }
 }
 
 void __cdecl SAVSADeInit() {
+  if (g_pcm_from_elsewhere) {
+    return;
+  }
   kiss_fftr_free(g_kiss_fft_cfg);
   g_kiss_fft_cfg = NULL;
 }
@@ -68,20 +86,31 @@ static kiss_fft_scalar hann_factor(size_t index, size_t samples) {
          (1 + cosf(2.0f * (float)M_PI * (index - samples / 2) / samples));
 }
 
-void __cdecl SAAddPCMData(void *PCMData, int nch, int bps, int timestamp) {
-  if (nch != 2 || bps != 16) {
-    log_error("Need 16 bit stereo samples at the moment, "
-              "got %d channels at %d bits per sample instead, skipping.",
-              nch, bps);
-    return;
-  }
+static void analyze(const int16_t *interleaved, int timestamp,
+                    analysis_frame_t *frame) {
+  frame->analyzed_at_us = timing_now_us();
+  frame->present_at_us = 0;
+  frame->stream_timestamp_ms = timestamp;
+  frame->sample_rate = g_sample_rate;
+  frame->channels = 2;
 
-  const uint16_t *const interleaved = (uint16_t *)PCMData;
+  // For waveform and VU: De-interleave, normalize, and scale to 8bit
+  for (int channel = 0; channel < 2; channel++) {
+    float sum_of_squares = 0.0f;
+    float peak = 0.0f;
+    for (int i = 0; i < VIS_FRAMES; i++) {
+      const int16_t sample = interleaved[2 * i + channel];
+      const float normalized = sample / 32768.0f;
+      frame->waveform[channel][i] = normalized;
+      frame->waveform_data[channel][i] = (uint16_t)sample / 256;
 
-  // For waveform: De-interleave and scale to 8bit
-  for (int i = 0; i < VIS_FRAMES; i++) {
-    g_active_vis_module->waveformData[0][i] = interleaved[2 * i] / 256;
-    g_active_vis_module->waveformData[1][i] = interleaved[2 * i + 1] / 256;
+      sum_of_squares += normalized * normalized;
+      if (fabsf(normalized) > peak) {
+        peak = fabsf(normalized);
+      }
+    }
+    frame->vu_rms[channel] = sqrtf(sum_of_squares / VIS_FRAMES);
+    frame->vu_peak[channel] = peak;
   }
 
   // For spectrum: De-interleave, do spectral analysis, and scale to 8bit
@@ -98,7 +127,7 @@ void __cdecl SAAddPCMData(void *PCMData, int nch, int bps, int timestamp) {
           (kiss_fft_scalar)g_prev_interleaved[2 * i + channel] *
           g_hann_factors[i];
       scalar_in_second_half[i] =
-          (kiss_fft_scalar)(int16_t)interleaved[2 * i + channel] *
+          (kiss_fft_scalar)interleaved[2 * i + channel] *
           g_hann_factors[i + VIS_FRAMES];
     }
 
@@ -108,32 +137,99 @@ void __cdecl SAAddPCMData(void *PCMData, int nch, int bps, int timestamp) {
     // Post-process FFT output, in particular do scaling:
     // - We need to compensate the scaling that FFT did:
     //   factor "1.0f / (VIS_FRAMES / 2)".
-    // - We need to convert range from 0..2^15-1 to 0..2^8-1:
-    //   factor "1.0f / INT16_MAX * UINT8_MAX".
+    // - We need to normalize range 0..2^15-1 to 0..1:
+    //   factor "1.0f / INT16_MAX".
+    // - For 8bit, we need to convert range from 0..1 to 0..2^8-1:
+    //   factor "UINT8_MAX".
     // - The rest is compensation of the Hann window plus additional zoom:
     //   factor "5.0f".
-    const kiss_fft_scalar amplitude_scale =
-        1.0f / (VIS_FRAMES / 2) * 5.0f / INT16_MAX * UINT8_MAX;
+    const kiss_fft_scalar normalization_scale =
+        1.0f / (VIS_FRAMES / 2) / INT16_MAX;
+    const kiss_fft_scalar amplitude_scale = 5.0f * UINT8_MAX;
 
     for (int i = 0; i < VIS_FRAMES; i++) {
       const kiss_fft_scalar real = cx_out[i + 1].r;
       const kiss_fft_scalar imag = cx_out[i + 1].i;
-      const kiss_fft_scalar amplitude =
-          sqrt(real * real + imag * imag) * amplitude_scale;
+      const kiss_fft_scalar normalized =
+          sqrt(real * real + imag * imag) * normalization_scale;
+      const kiss_fft_scalar amplitude = normalized * amplitude_scale;
       const unsigned char final_amplitude =
           (amplitude > UINT8_MAX)
               ? UINT8_MAX
               : ((amplitude < 0) ? 0 : (unsigned char)amplitude);
 
-      g_active_vis_module->spectrumData[channel][i] = final_amplitude;
+      frame->spectrum[channel][i] = normalized;
+      frame->spectrum_data[channel][i] = final_amplitude;
     }
   }
 
   // Feed future FFT
   memcpy(g_prev_interleaved, interleaved, sizeof(g_prev_interleaved));
+}
+
+bool open_analysis_bus(const char *name) {
+  if (!analysis_bus_create(&g_analysis_bus, name)) {
+    return false;
+  }
+  log_info("Publishing analysis frames to shared memory \"%s\".", name);
+  return true;
+}
+
+void close_analysis_bus() { analysis_bus_close(&g_analysis_bus); }
 
-  g_active_vis_module->nCh = 2;
-  g_active_vis_module->Render(g_active_vis_module);
+void set_playback_clock(int(__cdecl *get_output_time_ms)()) {
+  g_get_output_time_ms = get_output_time_ms;
+}
+
+// Decoding runs ahead of playback by as much as the output plug-in buffers
+static void stamp_presentation_time(analysis_frame_t *frame) {
+  const LONGLONG now_us = timing_now_us();
+  const int position_ms = g_get_output_time_ms();
+  analysis_bus_publish_clock(&g_analysis_bus, now_us, position_ms);
+
+  const LONGLONG ahead_us =
+      (frame->stream_timestamp_ms - position_ms) * 1000LL;
+  frame->present_at_us = now_us + ((ahead_us > 0) ? ahead_us : 0);
+}
+
+void take_pcm_from_elsewhere() { g_pcm_from_elsewhere = true; }
+
+const analysis_frame_t *analyze_pcm(const int16_t *interleaved,
+                                    int sample_rate, int timestamp_ms) {
+  if (sample_rate != g_sample_rate || g_kiss_fft_cfg == NULL) {
+    prepare_analysis(sample_rate);
+  }
+
+  const LONGLONG analysis_started_at_us = timing_now_us();
+
+  static analysis_frame_t frame; // only used by a single thread at a time
+  analyze(interleaved, timestamp_ms, &frame);
+  if (g_analysis_bus.layout != NULL) {
+    if (g_get_output_time_ms != NULL) {
+      stamp_presentation_time(&frame);
+    }
+    analysis_bus_publish(&g_analysis_bus, &frame);
+  }
+  metrics_note_analysis(timing_now_us() - analysis_started_at_us);
+  return &frame;
+}
+
+void __cdecl SAAddPCMData(void *PCMData, int nch, int bps, int timestamp) {
+  if (g_pcm_from_elsewhere) {
+    return;
+  }
+  metrics_note_pcm_block(timestamp);
+
+  if (nch != 2 || bps != 16) {
+    log_error("Need 16 bit stereo samples at the moment, "
+              "got %d channels at %d bits per sample instead, skipping.",
+              nch, bps);
+    metrics_note_dropped_frame();
+    return;
+  }
+
+  vis_host_submit_frame(
+      analyze_pcm((const int16_t *)PCMData, g_sample_rate, timestamp));
 }
 
 int __cdecl SAGetMode() {
@@ -165,5 +261,8 @@ void __cdecl VSASetInfo(int srate, int nch) {
   log_debug(
       "Input plugin announced: Sampling rate %d, %d channels (VSASetInfo).",
       srate, nch);
-  g_active_vis_module->sRate = srate;
+  if (!g_pcm_from_elsewhere) {
+    vis_host_set_sample_rate(srate);
+    g_sample_rate = srate;
+  }
 }
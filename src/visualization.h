@@ -18,12 +18,33 @@
 #ifndef VISUALIZATION_H
 #define VISUALIZATION_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
 #include <winamp/vis.h>
 
-extern winampVisModule *g_active_vis_module;
+#include "analysis_frame.h"
+
+bool open_analysis_bus(const char *name);
+
+void close_analysis_bus();
+
+// Stamps frames published with when their audio will be heard, based on
+// the given playback position (e.g. In_Module.GetOutputTime)
+void set_playback_clock(int(__cdecl *get_output_time_ms)());
+
+// Has the input plug-in's SAAddPCMData ignored from now on, for analysis
+// of PCM from elsewhere, see analyze_pcm
+void take_pcm_from_elsewhere();
+
+// Analyzes ANALYSIS_FRAME_SAMPLES samples of 16 bit stereo and publishes
+// the frame to the analysis bus, if any; the frame returned is valid until
+// the next call
+const analysis_frame_t *analyze_pcm(const int16_t *interleaved,
+                                    int sample_rate, int timestamp_ms);
 
 void __cdecl SAVSAInit(int maxlatency_in_ms, int srate);
 
@@ -0,0 +1,417 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#if defined(_MSC_VER)
+#define strcasecmp _stricmp
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <winamp/wa_ipc.h>
+
+#include "builtin_input.h"
+#include "log.h"
+#include "pcm.h"
+#include "wav_input.h"
+
+#define WAVE_FORMAT_PCM_ 0x0001
+#define WAVE_FORMAT_EXTENSIBLE_ 0xfffe
+
+typedef struct _mapped_audio_t {
+  HANDLE file;
+  HANDLE mapping;
+  char *view;
+  const char *samples;
+  LONGLONG frame_count;
+  int sample_rate;
+  int channels;
+  int bits_per_sample;
+  int block_align;
+  bool big_endian; // i.e. AIFF
+} mapped_audio_t;
+
+static In_Module g_in_module;
+
+static mapped_audio_t g_audio = {NULL, NULL, NULL, NULL, 0, 0, 0, 0, 0, false};
+static char g_filename[MAX_PATH] = "";
+static HANDLE g_decoder_thread = NULL;
+static volatile LONG g_stop_requested = 0;
+static volatile LONG g_seek_to_ms = -1; // i.e. no seek pending
+static LONGLONG g_position = 0; // in frames, decoder thread only
+
+// Little endian for the output plug-in, for AIFF only
+static char g_swapped[BUILTIN_INPUT_CHUNK_FRAMES * BUILTIN_INPUT_CHANNELS_MAX *
+                      4];
+
+static DWORD get_le16(const unsigned char *bytes) {
+  return bytes[0] | (bytes[1] << 8);
+}
+
+static DWORD get_le32(const unsigned char *bytes) {
+  return get_le16(bytes) | (get_le16(bytes + 2) << 16);
+}
+
+static DWORD get_be16(const unsigned char *bytes) {
+  return (bytes[0] << 8) | bytes[1];
+}
+
+static DWORD get_be32(const unsigned char *bytes) {
+  return (get_be16(bytes) << 16) | get_be16(bytes + 2);
+}
+
+// AIFF has the sample rate as an 80 bit IEEE 754 extended float
+static int get_be_extended(const unsigned char *bytes) {
+  const int exponent = ((bytes[0] & 0x7f) << 8) | bytes[1];
+  const ULONGLONG mantissa =
+      ((ULONGLONG)get_be32(bytes + 2) << 32) | get_be32(bytes + 6);
+  const int shift = 16383 + 63 - exponent;
+  if ((bytes[0] & 0x80) || shift < 0 || shift > 63) {
+    return 0; // i.e. not a sample rate
+  }
+  return (int)(mantissa >> shift);
+}
+
+static bool parse_wav(mapped_audio_t *audio, const unsigned char *bytes,
+                      DWORD size) {
+  const unsigned char *data = NULL;
+  DWORD data_size = 0;
+  bool have_format = false;
+
+  DWORD offset = 12;
+  while (offset + 8 <= size) {
+    const unsigned char *const chunk = bytes + offset + 8;
+    DWORD chunk_size = get_le32(bytes + offset + 4);
+    if (chunk_size > size - offset - 8) {
+      chunk_size = size - offset - 8; // e.g. sizes left at maximum
+    }
+
+    if (memcmp(bytes + offset, "fmt ", 4) == 0 && chunk_size >= 16) {
+      DWORD format_tag = get_le16(chunk);
+      if (format_tag == WAVE_FORMAT_EXTENSIBLE_ && chunk_size >= 26) {
+        format_tag = get_le16(chunk + 24); // i.e. that of the sub-format
+      }
+      if (format_tag != WAVE_FORMAT_PCM_) {
+        log_error("WAV format 0x%lx is not supported.",
+                  (unsigned long)format_tag);
+        return false;
+      }
+      audio->channels = (int)get_le16(chunk + 2);
+      audio->sample_rate = (int)get_le32(chunk + 4);
+      audio->bits_per_sample = (int)get_le16(chunk + 14);
+      have_format = true;
+    } else if (memcmp(bytes + offset, "data", 4) == 0) {
+      data = chunk;
+      data_size = chunk_size;
+      break; // i.e. ignore anything after
+    }
+
+    offset += 8 + chunk_size + (chunk_size & 1); // i.e. padded to words
+  }
+
+  if (!have_format || data == NULL) {
+    log_error("WAV file lacks a format or data chunk.");
+    return false;
+  }
+  audio->samples = (const char *)data;
+  audio->block_align = audio->channels * audio->bits_per_sample / 8;
+  audio->frame_count =
+      (audio->block_align > 0) ? data_size / audio->block_align : 0;
+  audio->big_endian = false;
+  return true;
+}
+
+static bool parse_aiff(mapped_audio_t *audio, const unsigned char *bytes,
+                       DWORD size, bool compressed) {
+  const unsigned char *data = NULL;
+  DWORD data_size = 0;
+  bool have_format = false;
+
+  DWORD offset = 12;
+  while (offset + 8 <= size) {
+    const unsigned char *const chunk = bytes + offset + 8;
+    DWORD chunk_size = get_be32(bytes + offset + 4);
+    if (chunk_size > size - offset - 8) {
+      chunk_size = size - offset - 8;
+    }
+
+    if (memcmp(bytes + offset, "COMM", 4) == 0 && chunk_size >= 18) {
+      audio->channels = (int)get_be16(chunk);
+      audio->frame_count = get_be32(chunk + 2);
+      audio->bits_per_sample = (int)get_be16(chunk + 6);
+      audio->sample_rate = get_be_extended(chunk + 8);
+      audio->big_endian = true;
+      if (compressed) {
+        if (chunk_size >= 22 && memcmp(chunk + 18, "sowt", 4) == 0) {
+          audio->big_endian = false;
+        } else if (chunk_size < 22 || memcmp(chunk + 18, "NONE", 4) != 0) {
+          log_error("Compressed AIFF-C files are not supported.");
+          return false;
+        }
+      }
+      have_format = true;
+    } else if (memcmp(bytes + offset, "SSND", 4) == 0 && chunk_size >= 8) {
+      const DWORD sample_offset = get_be32(chunk);
+      if (sample_offset <= chunk_size - 8) {
+        data = chunk + 8 + sample_offset;
+        data_size = chunk_size - 8 - sample_offset;
+      }
+    }
+
+    offset += 8 + chunk_size + (chunk_size & 1);
+  }
+
+  if (!have_format || data == NULL) {
+    log_error("AIFF file lacks a COMM or SSND chunk.");
+    return false;
+  }
+  audio->samples = (const char *)data;
+  audio->block_align = audio->channels * audio->bits_per_sample / 8;
+  if (audio->block_align > 0 &&
+      audio->frame_count > data_size / audio->block_align) {
+    audio->frame_count = data_size / audio->block_align; // i.e. truncated
+  }
+  return true;
+}
+
+static void unmap_audio(mapped_audio_t *audio) {
+  if (audio->view != NULL) {
+    UnmapViewOfFile(audio->view);
+  }
+  if (audio->mapping != NULL) {
+    CloseHandle(audio->mapping);
+  }
+  if (audio->file != NULL) {
+    CloseHandle(audio->file);
+  }
+  memset(audio, 0, sizeof(*audio));
+}
+
+static bool map_audio(mapped_audio_t *audio, const char *filename) {
+  memset(audio, 0, sizeof(*audio));
+
+  audio->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (audio->file == INVALID_HANDLE_VALUE) {
+    log_error("Could not open \"%s\" for reading (error %lu).", filename,
+              (unsigned long)GetLastError());
+    audio->file = NULL;
+    return false;
+  }
+  const DWORD size = GetFileSize(audio->file, NULL);
+  if (size == INVALID_FILE_SIZE || size < 12) {
+    unmap_audio(audio);
+    return false;
+  }
+  audio->mapping =
+      CreateFileMappingA(audio->file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+  if (audio->mapping != NULL) {
+    audio->view = MapViewOfFile(audio->mapping, FILE_MAP_COPY, 0, 0, 0);
+  }
+  if (audio->view == NULL) {
+    log_error("Could not map \"%s\" into memory (error %lu).", filename,
+              (unsigned long)GetLastError());
+    unmap_audio(audio);
+    return false;
+  }
+
+  const unsigned char *const bytes = (const unsigned char *)audio->view;
+  bool parsed = false;
+  if (memcmp(bytes, "RIFF", 4) == 0 && memcmp(bytes + 8, "WAVE", 4) == 0) {
+    parsed = parse_wav(audio, bytes, size);
+  } else if (memcmp(bytes, "FORM", 4) == 0 &&
+             (memcmp(bytes + 8, "AIFF", 4) == 0 ||
+              memcmp(bytes + 8, "AIFC", 4) == 0)) {
+    parsed = parse_aiff(audio, bytes, size, bytes[11] == 'C');
+  } else {
+    log_error("\"%s\" is neither a WAV nor an AIFF file.", filename);
+  }
+
+  if (parsed &&
+      (audio->sample_rate <= 0 || audio->channels <= 0 ||
+       audio->channels > BUILTIN_INPUT_CHANNELS_MAX ||
+       !pcm_bits_supported(audio->bits_per_sample))) {
+    log_error("Cannot play %d Hz, %d channels at %d bits.",
+              audio->sample_rate, audio->channels, audio->bits_per_sample);
+    parsed = false;
+  }
+  if (!parsed) {
+    unmap_audio(audio);
+    return false;
+  }
+  return true;
+}
+
+static const char *little_endian_chunk(const char *chunk, int frames) {
+  if (!g_audio.big_endian) {
+    return chunk;
+  }
+
+  const int bytes_per_sample = g_audio.bits_per_sample / 8;
+  const int sample_count = frames * g_audio.channels;
+  for (int i = 0; i < sample_count; i++) {
+    const char *const source = chunk + i * bytes_per_sample;
+    char *const target = g_swapped + i * bytes_per_sample;
+    if (bytes_per_sample == 1) {
+      target[0] = (char)(source[0] ^ 0x80); // i.e. signed to unsigned
+    } else {
+      for (int b = 0; b < bytes_per_sample; b++) {
+        target[b] = source[bytes_per_sample - 1 - b];
+      }
+    }
+  }
+  return g_swapped;
+}
+
+static DWORD WINAPI decoder_thread_main(LPVOID parameter) {
+  Out_Module *const out = g_in_module.outMod;
+
+  while (!g_stop_requested) {
+    const LONG seek_to_ms = InterlockedExchange(&g_seek_to_ms, -1);
+    if (seek_to_ms >= 0) {
+      g_position = (LONGLONG)seek_to_ms * g_audio.sample_rate / 1000;
+      if (g_position > g_audio.frame_count) {
+        g_position = g_audio.frame_count;
+      }
+      out->Flush(seek_to_ms);
+    }
+
+    if (g_position >= g_audio.frame_count) {
+      if (!out->IsPlaying()) {
+        PostMessageA(g_in_module.hMainWindow, WM_WA_MPEG_EOF, 0, 0);
+        return 0;
+      }
+      Sleep(10);
+      continue;
+    }
+
+    int frames = BUILTIN_INPUT_CHUNK_FRAMES;
+    if (frames > g_audio.frame_count - g_position) {
+      frames = (int)(g_audio.frame_count - g_position);
+    }
+    if (!builtin_input_can_write(frames)) {
+      Sleep(10);
+      continue;
+    }
+
+    // For as long as the output plug-in is open, the mapping is
+    builtin_input_write(
+        little_endian_chunk(g_audio.samples + g_position * g_audio.block_align,
+                            frames),
+        frames);
+    g_position += frames;
+  }
+  return 0;
+}
+
+static void wav_get_file_info(const char *file, char *title,
+                              int *length_in_ms) {
+  const char *const filename =
+      (file == NULL || file[0] == '\0') ? g_filename : file;
+  if (title != NULL) {
+    const char *basename = strrchr(filename, '\\');
+    basename = (basename != NULL) ? basename + 1 : filename;
+    snprintf(title, GETFILEINFO_TITLE_LENGTH, "%s", basename);
+  }
+  if (length_in_ms == NULL) {
+    return;
+  }
+
+  mapped_audio_t audio;
+  if (map_audio(&audio, filename)) {
+    *length_in_ms = (int)(audio.frame_count * 1000 / audio.sample_rate);
+    unmap_audio(&audio);
+  }
+}
+
+static int __cdecl wav_is_our_file(const char *fn) {
+  const char *const extension = strrchr(fn, '.');
+  return extension != NULL &&
+         (strcasecmp(extension, ".wav") == 0 ||
+          strcasecmp(extension, ".aif") == 0 ||
+          strcasecmp(extension, ".aiff") == 0 ||
+          strcasecmp(extension, ".aifc") == 0);
+}
+
+static void __cdecl wav_stop();
+
+static int __cdecl wav_play(const char *fn) {
+  wav_stop(); // i.e. in case of a track that just finished
+
+  if (!map_audio(&g_audio, fn)) {
+    return -1; // i.e. file not found
+  }
+  snprintf(g_filename, sizeof(g_filename), "%s", fn);
+
+  if (!builtin_input_open(g_audio.sample_rate, g_audio.channels,
+                          g_audio.bits_per_sample)) {
+    unmap_audio(&g_audio);
+    return 1;
+  }
+
+  g_position = 0;
+  g_seek_to_ms = -1;
+  g_stop_requested = 0;
+  g_decoder_thread =
+      CreateThread(NULL, 0, decoder_thread_main, NULL, 0, NULL);
+  if (g_decoder_thread == NULL) {
+    log_error("Could not start decoder thread.");
+    builtin_input_close();
+    unmap_audio(&g_audio);
+    return 1;
+  }
+  return 0;
+}
+
+static void __cdecl wav_stop() {
+  if (g_decoder_thread == NULL) {
+    return;
+  }
+  InterlockedExchange(&g_stop_requested, 1);
+  WaitForSingleObject(g_decoder_thread, INFINITE);
+  CloseHandle(g_decoder_thread);
+  g_decoder_thread = NULL;
+
+  builtin_input_close(); // before unmapping what it may still hold
+  unmap_audio(&g_audio);
+}
+
+static int __cdecl wav_get_length() {
+  return (g_audio.sample_rate == 0)
+             ? 0
+             : (int)(g_audio.frame_count * 1000 / g_audio.sample_rate);
+}
+
+static void __cdecl wav_set_output_time(int time_in_ms) {
+  InterlockedExchange(&g_seek_to_ms, time_in_ms);
+}
+
+In_Module *wav_input_module() {
+  builtin_input_init(&g_in_module);
+  g_in_module.description = "visdriver WAV/AIFF input";
+  g_in_module.FileExtensions =
+      "WAV\0Waveform Audio (*.WAV)\0AIF;AIFF;AIFC\0AIFF Audio (*.AIF)\0";
+  g_in_module.is_seekable = 1;
+  g_in_module.GetFileInfo = wav_get_file_info;
+  g_in_module.IsOurFile = wav_is_our_file;
+  g_in_module.Play = wav_play;
+  g_in_module.Stop = wav_stop;
+  g_in_module.GetLength = wav_get_length;
+  g_in_module.SetOutputTime = wav_set_output_time;
+  return &g_in_module;
+}
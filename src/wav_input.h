@@ -0,0 +1,32 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef WAV_INPUT_H
+#define WAV_INPUT_H
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <winamp/in2.h>
+
+// A built-in input plug-in for uncompressed WAV and AIFF files.  Files are
+// memory-mapped (copy-on-write, in case the output plug-in writes to what
+// it is given), and audio is handed to the output plug-in straight from
+// the mapping unless it needs byte-swapping (AIFF) or goes through DSP.
+In_Module *wav_input_module();
+
+#endif // ifndef WAV_INPUT_H
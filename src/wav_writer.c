@@ -0,0 +1,99 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#include <string.h>
+
+#include "log.h"
+#include "stream_io.h"
+#include "wav_writer.h"
+
+#define WAV_HEADER_SIZE 44
+#define WAV_SIZE_UNKNOWN 0xffffffff
+
+static void put_le16(unsigned char *target, unsigned int value) {
+  target[0] = (unsigned char)(value & 0xff);
+  target[1] = (unsigned char)((value >> 8) & 0xff);
+}
+
+static void put_le32(unsigned char *target, DWORD value) {
+  put_le16(target, value & 0xffff);
+  put_le16(target + 2, (value >> 16) & 0xffff);
+}
+
+bool wav_writer_open(wav_writer_t *writer, const char *path, int sample_rate,
+                     int channels, int bits_per_sample) {
+  writer->file = stream_io_open_output(path);
+  if (writer->file == INVALID_HANDLE_VALUE) {
+    log_error("Could not open \"%s\" for writing (error %lu).", path,
+              (unsigned long)GetLastError());
+    writer->file = NULL;
+    return false;
+  }
+  writer->data_size = 0;
+  writer->seekable = (GetFileType(writer->file) == FILE_TYPE_DISK);
+
+  const int block_align = channels * bits_per_sample / 8;
+  unsigned char header[WAV_HEADER_SIZE];
+  memcpy(header, "RIFF", 4);
+  put_le32(header + 4, WAV_SIZE_UNKNOWN);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  put_le32(header + 16, 16);
+  put_le16(header + 20, 1); // i.e. PCM
+  put_le16(header + 22, channels);
+  put_le32(header + 24, sample_rate);
+  put_le32(header + 28, sample_rate * block_align);
+  put_le16(header + 32, block_align);
+  put_le16(header + 34, bits_per_sample);
+  memcpy(header + 36, "data", 4);
+  put_le32(header + 40, WAV_SIZE_UNKNOWN);
+
+  if (!stream_io_write_all(writer->file, header, sizeof(header))) {
+    log_error("Could not write to \"%s\".", path);
+    CloseHandle(writer->file);
+    writer->file = NULL;
+    return false;
+  }
+  return true;
+}
+
+bool wav_writer_write(wav_writer_t *writer, const void *data, DWORD size) {
+  if (!stream_io_write_all(writer->file, data, size)) {
+    return false;
+  }
+  writer->data_size += size;
+  return true;
+}
+
+void wav_writer_close(wav_writer_t *writer) {
+  if (writer->file == NULL) {
+    return;
+  }
+
+  if (writer->seekable) {
+    unsigned char size[4];
+    put_le32(size, WAV_HEADER_SIZE - 8 + writer->data_size);
+    SetFilePointer(writer->file, 4, NULL, FILE_BEGIN);
+    stream_io_write_all(writer->file, size, sizeof(size));
+
+    put_le32(size, writer->data_size);
+    SetFilePointer(writer->file, 40, NULL, FILE_BEGIN);
+    stream_io_write_all(writer->file, size, sizeof(size));
+  }
+
+  CloseHandle(writer->file);
+  writer->file = NULL;
+}
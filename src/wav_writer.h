@@ -0,0 +1,43 @@
+// This file is part of the visdriver project.
+//
+// Copyright (c) 2023 Sebastian Pipping <sebastian@pipping.org>
+//
+// visdriver is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// visdriver is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with visdriver. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef WAV_WRITER_H
+#define WAV_WRITER_H
+
+#include <stdbool.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+typedef struct _wav_writer_t {
+  HANDLE file;
+  DWORD data_size;
+  bool seekable; // i.e. sizes can be fixed up at close
+} wav_writer_t;
+
+// Writes a canonical 44 byte header; for pipes and FIFOs, sizes in the
+// header are left at their maximum as they cannot be fixed up later.  For
+// paths like "\\.\pipe\NAME", a named pipe is created; opening blocks
+// until a reader connects.
+bool wav_writer_open(wav_writer_t *writer, const char *path, int sample_rate,
+                     int channels, int bits_per_sample);
+
+bool wav_writer_write(wav_writer_t *writer, const void *data, DWORD size);
+
+void wav_writer_close(wav_writer_t *writer);
+
+#endif // ifndef WAV_WRITER_H